@@ -848,6 +848,15 @@ union wimlib_progress_info {
 
 		/** This is currently broken and will always be 0.  */
 		uint32_t completed_parts;
+
+		/** The number of bytes, among @p completed_bytes, that were
+		 * stored uncompressed without running the compressor on them
+		 * because they looked incompressible.  This measures the
+		 * compression work that was saved; see
+		 * wimlib_set_incompressible_chunk_threshold().
+		 *
+		 * @since This member was added in wimlib v1.14.0.  */
+		uint64_t skipped_compression_bytes;
 	} write_streams;
 
 	/** Valid on messages ::WIMLIB_PROGRESS_MSG_SCAN_BEGIN,
@@ -944,7 +953,9 @@ union wimlib_progress_info {
 	struct wimlib_progress_info_extract {
 
 		/** The 1-based index of the image from which files are being
-		 * extracted.  */
+		 * extracted, or ::WIMLIB_ALL_IMAGES if all images are being
+		 * extracted in a single pass into subdirectories of @p target
+		 * (see ::WIMLIB_EXTRACT_FLAG_SINGLE_PASS).  */
 		uint32_t image;
 
 		/** Extraction flags being used.  */
@@ -956,7 +967,8 @@ union wimlib_progress_info {
 		const wimlib_tchar *wimfile_name;
 
 		/** Name of the image from which files are being extracted, or
-		 * the empty string if the image is unnamed.  */
+		 * the empty string if the image is unnamed.  This is @c NULL if
+		 * @p image is ::WIMLIB_ALL_IMAGES.  */
 		const wimlib_tchar *image_name;
 
 		/** Path to the directory or NTFS volume to which the files are
@@ -1676,6 +1688,17 @@ typedef int (*wimlib_iterate_dir_tree_callback_t)(const struct wimlib_dir_entry
 typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resource_entry *resource,
 						      void *user_ctx);
 
+/**
+ * Type of a callback function to wimlib_read_blob().  It is passed the next
+ * piece of the requested data, which is nonempty but otherwise of unspecified
+ * size, and is only valid until the callback returns.  Must return 0 on
+ * success.
+ *
+ * @since This type was added in wimlib v1.14.0.
+ */
+typedef int (*wimlib_read_blob_callback_t)(const void *data, size_t size,
+					   void *user_ctx);
+
 /** For wimlib_iterate_dir_tree(): Iterate recursively on children rather than
  * just on the specified path. */
 #define WIMLIB_ITERATE_DIR_TREE_FLAG_RECURSIVE 0x00000001
@@ -1691,6 +1714,84 @@ typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resour
  * the @ref wimlib_resource_entry::is_missing "is_missing" flag.  */
 #define WIMLIB_ITERATE_DIR_TREE_FLAG_RESOURCES_NEEDED  0x00000004
 
+/** Possible values of the @ref wimlib_diff_entry::change "change" member of
+ * ::wimlib_diff_entry.  */
+enum wimlib_diff_change {
+	/** The file or directory exists only in the new image.  If it is a
+	 * directory, then its contents are not reported separately.  */
+	WIMLIB_DIFF_ADDED	= 0,
+
+	/** The file or directory exists only in the old image.  If it is a
+	 * directory, then its contents are not reported separately.  */
+	WIMLIB_DIFF_DELETED	= 1,
+
+	/** The file or directory exists in both images but differs in the ways
+	 * given by @ref wimlib_diff_entry::changed "changed".  */
+	WIMLIB_DIFF_MODIFIED	= 2,
+};
+
+/** The file was replaced with a directory or vice versa.  The contents of the
+ * directory are not reported separately.  */
+#define WIMLIB_DIFF_CHANGED_TYPE		0x00000001
+
+/** The contents of a data stream or reparse point differ, or a nonempty stream
+ * was added or removed.  Only SHA-1 message digests are compared.  */
+#define WIMLIB_DIFF_CHANGED_DATA		0x00000002
+
+/** The file attributes or the reparse tag differ.  */
+#define WIMLIB_DIFF_CHANGED_ATTRIBUTES		0x00000004
+
+/** The security descriptor differs.  */
+#define WIMLIB_DIFF_CHANGED_SECURITY		0x00000008
+
+/** The creation time or last write time differs.  Last access times are not
+ * compared.  */
+#define WIMLIB_DIFF_CHANGED_TIMESTAMPS		0x00000010
+
+/** Other metadata differs, such as the short (DOS) name, the UNIX data, or the
+ * object ID.  */
+#define WIMLIB_DIFF_CHANGED_OTHER		0x00000020
+
+/** Structure passed to the wimlib_diff_images() callback function.  Describes
+ * one file or directory that differs between the two images.  */
+struct wimlib_diff_entry {
+
+	/** Full path to the file or directory, starting with
+	 * ::WIMLIB_WIM_PATH_SEPARATOR.  This is only valid until the callback
+	 * function returns.  */
+	const wimlib_tchar *path;
+
+	/** One of the ::wimlib_diff_change values.  */
+	int change;
+
+	/** For ::WIMLIB_DIFF_MODIFIED, a bitwise OR of flags prefixed with
+	 * WIMLIB_DIFF_CHANGED; otherwise 0.  */
+	uint32_t changed;
+
+	/** The file attributes (FILE_ATTRIBUTE_* flags) in the old image, or 0
+	 * for ::WIMLIB_DIFF_ADDED.  */
+	uint32_t old_attributes;
+
+	/** The file attributes (FILE_ATTRIBUTE_* flags) in the new image, or 0
+	 * for ::WIMLIB_DIFF_DELETED.  */
+	uint32_t new_attributes;
+
+	uint64_t reserved[4];
+};
+
+/**
+ * Type of a callback function to wimlib_diff_images().  Must return 0 on
+ * success.
+ *
+ * @since This type was added in wimlib v1.14.0.
+ */
+typedef int (*wimlib_diff_images_callback_t)(const struct wimlib_diff_entry *entry,
+					     void *user_ctx);
+
+/** For wimlib_diff_images(): Don't report files and directories whose only
+ * differences are in their timestamps.  */
+#define WIMLIB_DIFF_FLAG_IGNORE_TIMESTAMPS	0x00000001
+
 
 /** @} */
 /** @addtogroup G_modifying_wims
@@ -2039,6 +2140,17 @@ typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resour
  */
 #define WIMLIB_EXTRACT_FLAG_WIMBOOT			0x00400000
 
+/**
+ * Since wimlib v1.14.0, for wimlib_extract_image() with ::WIMLIB_ALL_IMAGES
+ * only, and UNIX-like systems only: extract all images in a single pass rather
+ * than one at a time, so that file data shared by several images is only read
+ * and decompressed once.  This requires the metadata of all images to be held
+ * in memory at the same time.  In this mode, the extraction is reported as a
+ * single image with index ::WIMLIB_ALL_IMAGES and no name.  This flag is
+ * ignored when the images can't be extracted in a single pass.
+ */
+#define WIMLIB_EXTRACT_FLAG_SINGLE_PASS			0x00800000
+
 /**
  * Since wimlib v1.8.2 and Windows-only: compress the extracted files using
  * System Compression, when possible.  This only works on either Windows 10 or
@@ -2061,6 +2173,17 @@ typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resour
  * 32768 byte chunks.  */
 #define WIMLIB_EXTRACT_FLAG_COMPACT_LZX			0x08000000
 
+/**
+ * For wimlib_extract_image() and wimlib_extract_image_to_targets() only,
+ * UNIX-like systems only:  Update an existing copy of an image in the target
+ * directory rather than extracting everything again.  A regular file whose
+ * size and last modification time already match the image is kept, and its
+ * data is not read from the WIM at all; only its metadata is applied again.
+ * Files and directories that exist in the target directory but not in the
+ * image are deleted.  Other files are extracted normally.
+ */
+#define WIMLIB_EXTRACT_FLAG_INCREMENTAL			0x10000000
+
 /** @} */
 /** @addtogroup G_mounting_wim_images
  * @{ */
@@ -2117,6 +2240,17 @@ typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resour
  * called.  */
 #define WIMLIB_OPEN_FLAG_WRITE_ACCESS			0x00000004
 
+/** Open the WIM for concurrent reads.  The metadata of all images is loaded
+ * when the WIM is opened and is kept in memory until the ::WIMStruct is freed.
+ * After this, wimlib_read_blob_into_buf() and wimlib_read_file_into_buf() may
+ * be called on the ::WIMStruct from any number of threads simultaneously.  All
+ * other functions still require exclusive access to the ::WIMStruct, and must
+ * not be called while such reads are in progress.  This flag increases the time
+ * and memory needed to open a WIM containing many or large images.
+ *
+ * @since This flag was added in wimlib v1.14.0.  */
+#define WIMLIB_OPEN_FLAG_CONCURRENT_READS		0x00000008
+
 /** @} */
 /** @addtogroup G_mounting_wim_images
  * @{ */
@@ -2237,10 +2371,17 @@ typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resour
  * for some time (in some cases, 30+ seconds) before actually writing it to
  * disk, even after reporting to the application that the writes have succeeded.
  *
+ * With this flag, the data is also written back to disk progressively while it
+ * is being written (where the operating system supports this), so that the
+ * final sync doesn't need to flush the whole file at once.  In addition, all
+ * other data is synced before the WIM header is written, so that the header
+ * never refers to data that isn't on disk yet.
+ *
  * wimlib_overwrite() will set this flag automatically if it decides to
  * overwrite the WIM file via a temporary file instead of in-place.  This is
  * necessary on POSIX systems; it will, for example, avoid problems with delayed
- * allocation on ext4.
+ * allocation on ext4.  If the WIM file is instead updated in-place, then see
+ * ::WIMLIB_WRITE_FLAG_SYNC_BEFORE_HEADER.
  */
 #define WIMLIB_WRITE_FLAG_FSYNC				0x00000020
 
@@ -2368,6 +2509,54 @@ typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resour
  */
 #define WIMLIB_WRITE_FLAG_UNSAFE_COMPACT		0x00008000
 
+/**
+ * Lay out solid resources for faster random access: limit their chunk size to
+ * 1 MiB (1048576 bytes), or to the size set with
+ * wimlib_set_output_pack_chunk_size() if that is smaller.  Reading any part of
+ * a solid resource requires decompressing the whole chunk containing it, so
+ * with the default LZMS solid chunk size of 64 MiB, reading even a small file
+ * can require decompressing 64 MiB of data.  This comes at the cost of a worse
+ * compression ratio.  With this flag, existing solid resources that use a
+ * larger chunk size are not reused.
+ *
+ * This flag only has an effect in combination with ::WIMLIB_WRITE_FLAG_SOLID.
+ */
+#define WIMLIB_WRITE_FLAG_SOLID_RANDOM_ACCESS		0x00010000
+
+/**
+ * Since wimlib v1.14.0 and for wimlib_overwrite() only: compact the WIM file
+ * in-place, like ::WIMLIB_WRITE_FLAG_UNSAFE_COMPACT, but in a way that can
+ * safely be interrupted.  The WIM file is first updated by appending as usual.
+ * Then the resources in it are shifted down to fill the holes, and the file is
+ * truncated.  The progress of the compaction is recorded in a journal file
+ * named after the WIM file with ".compact" appended, which is deleted when the
+ * compaction is done.
+ *
+ * If the compaction is interrupted, then the WIM file cannot be used until the
+ * compaction is finished, which happens automatically the next time it is
+ * opened by wimlib_open_wim() with ::WIMLIB_OPEN_FLAG_WRITE_ACCESS.  Opening it
+ * without that flag fails with ::WIMLIB_ERR_WIM_IS_INCOMPLETE.
+ *
+ * This flag implies ::WIMLIB_WRITE_FLAG_SOFT_DELETE.  It cannot be combined
+ * with ::WIMLIB_WRITE_FLAG_UNSAFE_COMPACT.  If the WIM file can't be updated
+ * in-place, then it is rebuilt as usual, which leaves no holes either.
+ */
+#define WIMLIB_WRITE_FLAG_COMPACT			0x00020000
+
+/**
+ * Since wimlib v1.14.0: sync all data to disk before writing the WIM header,
+ * but don't otherwise wait for the data to be on disk like
+ * ::WIMLIB_WRITE_FLAG_FSYNC does.
+ *
+ * This is mainly useful with wimlib_overwrite() when the WIM file is updated
+ * in-place, either by appending to it or by ::WIMLIB_WRITE_FLAG_UNSAFE_COMPACT.
+ * In both cases the header of the existing WIM file is overwritten, so without
+ * this flag (or ::WIMLIB_WRITE_FLAG_FSYNC), a system crash during or shortly
+ * after the operation can leave the header pointing to data that never reached
+ * the disk.  The sync is skipped for pipable WIM files.
+ */
+#define WIMLIB_WRITE_FLAG_SYNC_BEFORE_HEADER		0x00040000
+
 /** @} */
 /** @addtogroup G_general
  * @{ */
@@ -2793,6 +2982,77 @@ extern int
 wimlib_delete_path(WIMStruct *wim, int image,
 		   const wimlib_tchar *path, int delete_flags);
 
+/**
+ * @ingroup G_wim_information
+ *
+ * Compare two WIM images and report each file or directory that differs
+ * between them.  The directory trees are walked together in collation order,
+ * and files are compared using only the metadata resources: data streams are
+ * compared by SHA-1 message digest, so no file data is read.  Security
+ * descriptors are compared by contents, so the images may be in different
+ * WIM files.  Hard link groupings are not compared.
+ *
+ * Changes are reported in a preorder traversal of the new image, so each
+ * directory is reported before its contents.  An application can turn the
+ * reported changes into a list of ::wimlib_update_command's that transforms
+ * the old image into the new one, given a directory @c SRC that contains the
+ * new version of the files:
+ *
+ * - ::WIMLIB_DIFF_ADDED: ::WIMLIB_UPDATE_OP_ADD from @c SRC/path to path
+ * - ::WIMLIB_DIFF_DELETED: ::WIMLIB_UPDATE_OP_DELETE of path with
+ *   ::WIMLIB_DELETE_FLAG_FORCE and ::WIMLIB_DELETE_FLAG_RECURSIVE
+ * - ::WIMLIB_DIFF_MODIFIED with ::WIMLIB_DIFF_CHANGED_TYPE: the above delete
+ *   followed by the above add
+ * - ::WIMLIB_DIFF_MODIFIED of a nondirectory: the above add, which replaces
+ *   the existing file
+ *
+ * A ::WIMLIB_DIFF_MODIFIED directory has differences only in its own
+ * metadata.  Adding over an existing directory merges into it without
+ * updating its metadata, so such a change cannot be expressed without
+ * re-adding the whole directory tree.
+ *
+ * @param old_wim
+ *	The ::WIMStruct containing the old image.
+ * @param old_image
+ *	The 1-based index of the old image in @p old_wim.
+ * @param new_wim
+ *	The ::WIMStruct containing the new image.  This may be the same as @p
+ *	old_wim.
+ * @param new_image
+ *	The 1-based index of the new image in @p new_wim.
+ * @param diff_flags
+ *	Bitwise OR of flags prefixed with WIMLIB_DIFF_FLAG.
+ * @param cb
+ *	A callback function that will receive each difference.
+ * @param user_ctx
+ *	An extra parameter that will always be passed to the callback function
+ *	@p cb.
+ *
+ * @return Normally, returns 0 if all calls to @p cb returned 0; otherwise the
+ * first nonzero value that was returned from @p cb.  However, additional
+ * ::wimlib_error_code values may be returned, including the following:
+ *
+ * @retval ::WIMLIB_ERR_INVALID_IMAGE
+ *	@p old_image does not exist in @p old_wim, or @p new_image does not
+ *	exist in @p new_wim.
+ * @retval ::WIMLIB_ERR_INVALID_PARAM
+ *	@p diff_flags contained an unknown flag.
+ * @retval ::WIMLIB_ERR_METADATA_NOT_FOUND
+ *	@p old_wim or @p new_wim does not contain image metadata; for example,
+ *	it represents a non-first part of a split WIM.
+ *
+ * This function can additionally return ::WIMLIB_ERR_DECOMPRESSION,
+ * ::WIMLIB_ERR_INVALID_METADATA_RESOURCE, ::WIMLIB_ERR_READ, or
+ * ::WIMLIB_ERR_UNEXPECTED_END_OF_FILE, all of which indicate failure (for
+ * different reasons) to read the metadata resource for an image.
+ *
+ * @since This function was added in wimlib v1.14.0.
+ */
+extern int
+wimlib_diff_images(WIMStruct *old_wim, int old_image,
+		   WIMStruct *new_wim, int new_image, int diff_flags,
+		   wimlib_diff_images_callback_t cb, void *user_ctx);
+
 /**
  * @ingroup G_modifying_wims
  *
@@ -2984,6 +3244,43 @@ extern int
 wimlib_extract_image(WIMStruct *wim, int image,
 		     const wimlib_tchar *target, int extract_flags);
 
+/**
+ * @ingroup G_extracting_wims
+ *
+ * Extract one image from a WIM to each of several directories, as if by calling
+ * wimlib_extract_image() once per directory.  Where supported (currently, on
+ * UNIX-like systems when not extracting to an NTFS volume), the image is
+ * extracted to all the directories in a single pass, so each file data blob is
+ * only read and decompressed once regardless of the number of directories.
+ *
+ * @param wim
+ *	Same as the corresponding parameter to wimlib_extract_image().
+ * @param image
+ *	The 1-based index of the image to extract.  Unlike
+ *	wimlib_extract_image(), ::WIMLIB_ALL_IMAGES is not accepted.
+ * @param targets
+ *	Array of @p num_targets directories to which to extract the image.
+ *	Each is interpreted as @p target is by wimlib_extract_image().
+ * @param num_targets
+ *	Number of entries in @p targets.  Must be at least 1.
+ * @param extract_flags
+ *	Same as the corresponding parameter to wimlib_extract_image().
+ *
+ * @return 0 on success; a ::wimlib_error_code value on failure.  The possible
+ * error codes are the same as those returned by wimlib_extract_image(), except
+ * that ::WIMLIB_ERR_INVALID_IMAGE is also returned if @p image is
+ * ::WIMLIB_ALL_IMAGES.
+ *
+ * Progress messages are the same as for wimlib_extract_image(), except that
+ * when several directories are extracted in a single pass, the byte and stream
+ * counts cover all of them and @p target in the progress information is the
+ * first of them.
+ */
+extern int
+wimlib_extract_image_to_targets(WIMStruct *wim, int image,
+				const wimlib_tchar * const *targets,
+				size_t num_targets, int extract_flags);
+
 /**
  * @ingroup G_extracting_wims
  *
@@ -3178,6 +3475,57 @@ wimlib_extract_xml_data(WIMStruct *wim, FILE *fp);
 extern void
 wimlib_free(WIMStruct *wim);
 
+/**
+ * @ingroup G_general
+ *
+ * Statistics about the cache of blob data that wimlib keeps when enabled with
+ * wimlib_set_blob_cache_size().  See wimlib_get_blob_cache_stats().
+ */
+struct wimlib_blob_cache_stats {
+	/** The memory budget of the cache in bytes, or 0 if it is disabled.  */
+	uint64_t max_bytes;
+
+	/** Total size in bytes of the blobs currently in the cache.  */
+	uint64_t cached_bytes;
+
+	/** Number of blobs currently in the cache.  */
+	uint64_t num_cached;
+
+	/** Number of reads of blob data that were satisfied from the cache.  */
+	uint64_t num_hits;
+
+	/** Number of reads of cacheable blob data that were not satisfied from
+	 * the cache.  */
+	uint64_t num_misses;
+
+	/** Total size in bytes of the data that was read from the cache.  */
+	uint64_t hit_bytes;
+
+	/** Number of blobs that have been added to the cache.  */
+	uint64_t num_inserted;
+
+	/** Number of blobs that have been evicted from the cache, either to stay
+	 * within the memory budget or because wimlib_global_cleanup() was
+	 * called.  */
+	uint64_t num_evicted;
+
+	uint64_t reserved[8];
+};
+
+/**
+ * @ingroup G_general
+ *
+ * Retrieve statistics about the cache of blob data.  The counters are
+ * cumulative for the process.
+ *
+ * @param stats
+ *	A ::wimlib_blob_cache_stats structure to fill in.
+ *
+ * @since This function was added in wimlib v1.14.0.
+ */
+extern void
+wimlib_get_blob_cache_stats(struct wimlib_blob_cache_stats *stats);
+
 /**
  * @ingroup G_general
  *
@@ -3672,7 +4020,9 @@ wimlib_mount_image(WIMStruct *wim,
  *	may be a Windows 8 "ESD" file.)
  * @retval ::WIMLIB_ERR_WIM_IS_INCOMPLETE
  *	The WIM file is not complete (e.g. the program which wrote it was
- *	terminated before it finished)
+ *	terminated before it finished), or a compaction of it was interrupted
+ *	and ::WIMLIB_OPEN_FLAG_WRITE_ACCESS was not specified, so the compaction
+ *	could not be finished.
  * @retval ::WIMLIB_ERR_WIM_IS_READONLY
  *	::WIMLIB_OPEN_FLAG_WRITE_ACCESS was specified but the WIM file was
  *	considered read-only because of any of the reasons mentioned in the
@@ -3714,8 +4064,9 @@ wimlib_open_wim_with_progress(const wimlib_tchar *wim_file,
  *	temporary file to the original.
  *   2. Appending: append updates to the new original WIM file, then overwrite
  *	its header such that those changes become visible to new readers.
- *   3. Compaction: normally should not be used; see
- *	::WIMLIB_WRITE_FLAG_UNSAFE_COMPACT for details.
+ *   3. Compaction: append updates, then shift the contents of the WIM file
+ *	down to fill the holes and truncate it; see ::WIMLIB_WRITE_FLAG_COMPACT
+ *	and ::WIMLIB_WRITE_FLAG_UNSAFE_COMPACT for details.
  *
  * Append mode is often much faster than a full rebuild, but it wastes some
  * amount of space due to leaving "holes" in the WIM file.  Because of the
@@ -3796,6 +4147,142 @@ wimlib_print_available_images(const WIMStruct *wim, int image);
 extern void
 wimlib_print_header(const WIMStruct *wim);
 
+/**
+ * @ingroup G_extracting_wims
+ *
+ * Read a range of the data of a blob, identified by its SHA-1 message digest,
+ * and pass it to a callback function piece by piece.  Unlike extraction, this
+ * does not use any temporary files, and only the compressed chunks that
+ * contain the requested range are read and decompressed.  In addition, each
+ * thread remembers the last chunk it decompressed, so a series of reads of
+ * consecutive small ranges does not decompress the same chunk repeatedly.
+ *
+ * If @p wim was opened with ::WIMLIB_OPEN_FLAG_CONCURRENT_READS, then this
+ * function may be called from multiple threads simultaneously, and
+ * simultaneously with wimlib_read_blob_into_buf() and
+ * wimlib_read_file_into_buf().
+ *
+ * The data is not verified against its SHA-1 message digest.
+ *
+ * @param wim
+ *	The ::WIMStruct containing, or referencing, the blob.
+ * @param hash
+ *	The SHA-1 message digest of the blob to read.  If this is all zeroes,
+ *	the blob is considered empty.
+ * @param offset
+ *	Offset, in bytes, into the uncompressed data of the blob at which to
+ *	start reading.
+ * @param size
+ *	Number of bytes to read.  @p offset + @p size must not exceed the size
+ *	of the blob.  If this is 0, then @p cb is not called.
+ * @param cb
+ *	Function to call with the data.  If it returns nonzero, reading stops
+ *	and that value is returned.
+ * @param user_ctx
+ *	An extra parameter that will always be passed to @p cb.
+ *
+ * @return 0 on success; a ::wimlib_error_code value on failure, or the nonzero
+ * value returned by @p cb.  This may return any error code which can be
+ * returned by wimlib_read_blob_into_buf(); in addition,
+ * ::WIMLIB_ERR_INVALID_PARAM is returned if the range is not within the blob.
+ *
+ * @since This function was added in wimlib v1.14.0.
+ */
+extern int
+wimlib_read_blob(WIMStruct *wim, const uint8_t hash[20],
+		 uint64_t offset, uint64_t size,
+		 wimlib_read_blob_callback_t cb, void *user_ctx);
+
+/**
+ * @ingroup G_extracting_wims
+ *
+ * Read the data of a blob, identified by its SHA-1 message digest, into a newly
+ * allocated in-memory buffer.  The SHA-1 message digests of blobs can be
+ * retrieved using wimlib_iterate_dir_tree() or wimlib_iterate_lookup_table().
+ *
+ * If @p wim was opened with ::WIMLIB_OPEN_FLAG_CONCURRENT_READS, then this
+ * function may be called from multiple threads simultaneously, and
+ * simultaneously with wimlib_read_file_into_buf().
+ *
+ * The data is not verified against its SHA-1 message digest.  Use
+ * wimlib_verify_wim() if that is needed.
+ *
+ * @param wim
+ *	The ::WIMStruct containing, or referencing, the blob.
+ * @param hash
+ *	The SHA-1 message digest of the blob to read.  If this is all zeroes,
+ *	the blob is considered empty.
+ * @param buf_ret
+ *	On success, a pointer to an allocated buffer containing the data is
+ *	written to this location, or @c NULL if the blob is empty.  The buffer
+ *	must be freed with @c free(), or with the function set with
+ *	wimlib_set_memory_allocator() if applicable.
+ * @param bufsize_ret
+ *	On success, the size of the data in bytes is written to this location.
+ *
+ * @return 0 on success; a ::wimlib_error_code value on failure.
+ *
+ * @retval ::WIMLIB_ERR_INVALID_PARAM
+ *	A required parameter was @c NULL.
+ * @retval ::WIMLIB_ERR_NOMEM
+ *	Failed to allocate a buffer for the data.
+ * @retval ::WIMLIB_ERR_RESOURCE_NOT_FOUND
+ *	No blob with the specified SHA-1 message digest is available.
+ *
+ * This function can additionally return ::WIMLIB_ERR_DECOMPRESSION,
+ * ::WIMLIB_ERR_INVALID_CHUNK_SIZE, ::WIMLIB_ERR_READ, or
+ * ::WIMLIB_ERR_UNEXPECTED_END_OF_FILE if the data could not be read.
+ *
+ * @since This function was added in wimlib v1.14.0.
+ */
+extern int
+wimlib_read_blob_into_buf(WIMStruct *wim, const uint8_t hash[20],
+			  void **buf_ret, size_t *bufsize_ret);
+
+/**
+ * @ingroup G_extracting_wims
+ *
+ * Read the contents (unnamed data stream) of a regular file in a WIM image into
+ * a newly allocated in-memory buffer.
+ *
+ * If @p wim was opened with ::WIMLIB_OPEN_FLAG_CONCURRENT_READS, then this
+ * function may be called from multiple threads simultaneously, and
+ * simultaneously with wimlib_read_blob_into_buf().  Otherwise, this function
+ * loads the image's metadata if needed, like other functions that operate on a
+ * specific image.
+ *
+ * @param wim
+ *	The ::WIMStruct containing the image.
+ * @param image
+ *	The 1-based index of the image containing the file.
+ * @param path
+ *	Path to the file in the image, using the same conventions as
+ *	wimlib_iterate_dir_tree().
+ * @param buf_ret
+ *	On success, a pointer to an allocated buffer containing the data is
+ *	written to this location, or @c NULL if the file is empty.  The buffer
+ *	must be freed with @c free(), or with the function set with
+ *	wimlib_set_memory_allocator() if applicable.
+ * @param bufsize_ret
+ *	On success, the size of the data in bytes is written to this location.
+ *
+ * @return 0 on success; a ::wimlib_error_code value on failure.  This may
+ * return any error code which can be returned by wimlib_read_blob_into_buf(), as
+ * well as the following error codes:
+ *
+ * @retval ::WIMLIB_ERR_INVALID_IMAGE
+ *	@p image does not exist in @p wim.
+ * @retval ::WIMLIB_ERR_NOT_A_REGULAR_FILE
+ *	@p path names a directory, reparse point, or encrypted file.
+ * @retval ::WIMLIB_ERR_PATH_DOES_NOT_EXIST
+ *	@p path does not exist in the image.
+ *
+ * @since This function was added in wimlib v1.14.0.
+ */
+extern int
+wimlib_read_file_into_buf(WIMStruct *wim, int image, const wimlib_tchar *path,
+			  void **buf_ret, size_t *bufsize_ret);
+
 /**
  * @ingroup G_nonstandalone_wims
  *
@@ -4002,6 +4489,31 @@ extern int
 wimlib_resolve_image(WIMStruct *wim,
 		     const wimlib_tchar *image_name_or_num);
 
+/**
+ * @ingroup G_general
+ *
+ * Set the memory budget of the cache of blob data, which is shared by all
+ * threads and ::WIMStruct's in the process.  The cache is disabled by default.
+ *
+ * When the cache is enabled, the uncompressed data of each file data blob that
+ * is read in full from a compressed WIM resource, for example while writing,
+ * exporting, extracting, or mounting, is kept in memory and looked up by its
+ * SHA-1 message digest.  Later reads of the same data, even from a different
+ * WIM file, then don't need to decompress it again.  This helps when the same
+ * data is consumed several times in one process, such as when exporting an
+ * image to several WIM files with recompression.  When the cache is full, the
+ * least recently used blobs are evicted.  Blobs larger than one eighth of the
+ * budget are not cached.
+ *
+ * @param max_bytes
+ *	The maximum total size in bytes of the blobs to keep in the cache, or 0
+ *	to disable the cache and free the blobs in it.
+ *
+ * @since This function was added in wimlib v1.14.0.
+ */
+extern void
+wimlib_set_blob_cache_size(uint64_t max_bytes);
+
 /**
  * @ingroup G_general
  *
@@ -4649,6 +5161,36 @@ struct wimlib_decompressor;
 extern int
 wimlib_set_default_compression_level(int ctype, unsigned int compression_level);
 
+/**
+ * Set how eagerly wimlib's WIM writing code skips compressing chunks of data
+ * that look incompressible.
+ *
+ * Before compressing each chunk of file data that is written to a WIM file,
+ * wimlib examines a sample of the chunk.  If the sample has nearly no repeated
+ * sequences and a nearly uniform byte distribution, as is typical of data that
+ * is already compressed or encrypted, the chunk is stored uncompressed right
+ * away instead of being compressed only to find that compression didn't make
+ * it any smaller.  The amount of data handled this way is reported in
+ * wimlib_progress_info_write_streams::skipped_compression_bytes.  Chunks larger
+ * than 2 MiB, such as the chunks of solid resources by default, are always
+ * compressed, since they usually mix the data of many files.
+ *
+ * This affects only data that is written by wimlib_write() and similar
+ * functions, not wimlib_compress().  It also never changes whether the written
+ * data is valid, only whether some chunks that might have compressed slightly
+ * are stored uncompressed instead.
+ *
+ * @param threshold
+ *	The minimum estimated compressed size, as a percentage of the original
+ *	size, at which a chunk is considered incompressible.  Lower values skip
+ *	more chunks.  If 0, the default of 99 is restored.  Any value greater
+ *	than 100 disables the check, so that all chunks are compressed.
+ *
+ * @since This function was added in wimlib v1.14.0.
+ */
+extern void
+wimlib_set_incompressible_chunk_threshold(unsigned int threshold);
+
 /**
  * Return the approximate number of bytes needed to allocate a compressor with
  * wimlib_create_compressor() for the specified compression type, maximum block
@@ -4851,6 +5393,44 @@ wimlib_decompress(const void *compressed_data, size_t compressed_size,
 extern void
 wimlib_free_decompressor(struct wimlib_decompressor *decompressor);
 
+/**
+ * Statistics about the pool of decompressors that wimlib uses internally when
+ * reading compressed data from WIM files.  See
+ * wimlib_get_decompressor_pool_stats().
+ */
+struct wimlib_decompressor_pool_stats {
+	/** Number of decompressors the pool has created.  */
+	uint64_t num_created;
+
+	/** Number of times an idle decompressor was reused rather than a new one
+	 * being created.  */
+	uint64_t num_reused;
+
+	/** Number of decompressors the pool has freed, either because too many
+	 * were idle or because wimlib_global_cleanup() was called.  */
+	uint64_t num_freed;
+
+	/** Number of decompressors currently idle in the pool.  */
+	uint32_t num_idle;
+
+	uint32_t reserved[9];
+};
+
+/**
+ * Retrieve statistics about the pool of decompressors that wimlib uses
+ * internally when reading compressed data from WIM files.  Decompressors are
+ * kept in this pool, keyed by compression type and chunk size, so that they can
+ * be reused by later reads, including reads from other threads and other
+ * ::WIMStruct's.  The statistics are cumulative for the process.
+ *
+ * @param stats
+ *	A ::wimlib_decompressor_pool_stats structure to fill in.
+ *
+ * @since This function was added in wimlib v1.14.0.
+ */
+extern void
+wimlib_get_decompressor_pool_stats(struct wimlib_decompressor_pool_stats *stats);
+
 
 /**
  * @}
@@ -50,6 +50,12 @@ struct apply_ctx {
 	/* Length of @target in tchars.  */
 	size_t target_nchars;
 
+	/* All targets of the extraction, of which @target is the first.  The
+	 * same files are extracted to each of them.  There is more than one
+	 * target only if the backend sets 'supports_multiple_targets'.  */
+	const tchar * const *targets;
+	size_t num_targets;
+
 	/* Extraction flags (WIMLIB_EXTRACT_FLAG_*)  */
 	int extract_flags;
 
@@ -76,6 +82,10 @@ struct apply_ctx {
 	struct filedes tmpfile_fd;
 	tchar *tmpfile_name;
 	unsigned int count_until_file_progress;
+	struct hlist_head *name_table;
+	size_t name_table_capacity;
+	size_t name_table_filled;
+	struct hlist_head extra_names;
 };
 
 /* Maximum number of UNIX file descriptors, NTFS attributes, or Windows file
@@ -250,6 +260,22 @@ struct apply_operations {
 	 */
 	int (*will_back_from_wim)(struct wim_dentry *dentry, struct apply_ctx *ctx);
 
+	/*
+	 * Query whether the unnamed data stream of the specified file is
+	 * already present, unchanged, in every target.  If so, then the common
+	 * extraction code will not register a usage of the unnamed data
+	 * stream's blob, and the extraction backend is assumed to only apply
+	 * the file's metadata.  This is only called in
+	 * WIMLIB_EXTRACT_FLAG_INCREMENTAL mode, which is only supported by
+	 * backends that implement this routine.
+	 *
+	 * Return:
+	 *	< 0 if the data must be extracted.
+	 *	= 0 if the data is unchanged and won't be extracted.
+	 *	> 0 (wimlib error code) if another error occurred.
+	 */
+	int (*is_data_unchanged)(struct wim_dentry *dentry, struct apply_ctx *ctx);
+
 	/*
 	 * Size of the backend-specific extraction context.  It must contain
 	 * 'struct apply_ctx' as its first member.
@@ -261,6 +287,23 @@ struct apply_operations {
 	 * that form a single tree, not multiple trees.
 	 */
 	bool single_tree_only;
+
+	/*
+	 * Set this if the extraction backend can extract all images of a WIM
+	 * in a single pass.  In that case, the dentry list may contain the
+	 * root dentries of several images, each of which will have a nonempty
+	 * 'd_extraction_name'.  The backend must then extract each image into
+	 * the subdirectory of the target with that name.
+	 */
+	bool supports_multi_image;
+
+	/*
+	 * Set this if the extraction backend can extract the same files to
+	 * several targets at once, given in ctx->common.targets.  The backend
+	 * must then create each file in every target, opening at most
+	 * 'out_refcnt * num_targets' files per blob.
+	 */
+	bool supports_multiple_targets;
 };
 
 #ifdef __WIN32__
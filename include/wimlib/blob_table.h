@@ -45,6 +45,12 @@ enum blob_location {
 	 * stream) specified by @windows_file.  The data might be only properly
 	 * accessible through the Windows API.  */
 	BLOB_IN_WINDOWS_FILE,
+#else
+	/* UNIX only: the blob's data is available as the contents of the file
+	 * specified by @unix_file.  This is like BLOB_IN_FILE_ON_DISK, but the
+	 * path is stored compactly, as a file name relative to a directory path
+	 * that is shared with the other files in that directory.  */
+	BLOB_IN_UNIX_FILE,
 #endif
 };
 
@@ -169,11 +175,13 @@ struct blob_descriptor {
 			union {
 
 				/* BLOB_IN_FILE_ON_DISK
-				 * BLOB_IN_WINDOWS_FILE  */
+				 * BLOB_IN_WINDOWS_FILE
+				 * BLOB_IN_UNIX_FILE  */
 				struct {
 					union {
 						tchar *file_on_disk;
 						struct windows_file *windows_file;
+						struct unix_file *unix_file;
 					};
 					struct wim_inode *file_inode;
 				};
@@ -200,66 +208,84 @@ struct blob_descriptor {
 		};
 	};
 
-	/* Temporary fields  */
+	/*
+	 * Temporary fields.  Writing and extraction each need several fields per
+	 * blob, but never both at the same time, and within a write the fields
+	 * needed to prepare and sort the blob list are dead by the time the
+	 * output resource headers are filled in.  So all of these share storage.
+	 */
 	union {
 		/* Fields used temporarily during WIM file writing.  */
 		struct {
 			union {
-				/* List node used for blob size table.  */
-				struct hlist_node hash_list_2;
+				/* Fields used only before the blobs are
+				 * written.  */
+				struct {
+					/* List node used for blob size table, and
+					 * for the hash table used when sorting
+					 * blobs for solid compression.  */
+					struct hlist_node hash_list_2;
+
+					/* Name under which this blob is being
+					 * sorted; used only when sorting blobs
+					 * for solid compression.  */
+					utf16lechar *solid_sort_name;
+					size_t solid_sort_name_nbytes;
+				};
 
-				/* Metadata for the underlying solid resource in
-				 * the WIM being written (only valid if
-				 * WIM_RESHDR_FLAG_SOLID set in
-				 * out_reshdr.flags).  */
+				/* Fields set when the blob is written (or, if
+				 * its resource is reused, when the blob table
+				 * is written).  */
 				struct {
+					/*
+					 * Metadata for this blob in the WIM
+					 * being written.
+					 *
+					 * If WIM_RESHDR_FLAG_SOLID is set in
+					 * the flags, then @offset_in_wim is
+					 * the offset of the blob in the
+					 * uncompressed data of the solid
+					 * resource, while @size_in_wim and
+					 * @uncompressed_size are the size and
+					 * uncompressed size of the solid
+					 * resource itself.  The blob table
+					 * entry for the blob is implied by the
+					 * blob's own size.
+					 */
+					struct wim_reshdr out_reshdr;
+
+					/* Offset of the underlying solid
+					 * resource in the WIM being written
+					 * (only valid if WIM_RESHDR_FLAG_SOLID
+					 * is set in out_reshdr.flags).  */
 					u64 out_res_offset_in_wim;
-					u64 out_res_size_in_wim;
-					u64 out_res_uncompressed_size;
 				};
 			};
 
 			/* Links blobs being written to the WIM.  */
 			struct list_head write_blobs_list;
 
-			union {
-				/* Metadata for this blob in the WIM being
-				 * written.  */
-				struct wim_reshdr out_reshdr;
+			/* Links blobs for writing blob table.  */
+			struct list_head blob_table_list;
+		};
 
+		/* Fields used temporarily during extraction.  */
+		struct {
+			/* This is an array of references to the streams being
+			 * extracted that use this blob.  out_refcnt tracks the
+			 * number of slots filled.  */
+			union {
+				struct blob_extraction_target inline_blob_extraction_targets[3];
 				struct {
-					/* Name under which this blob is being
-					 * sorted; used only when sorting blobs
-					 * for solid compression.  */
-					utf16lechar *solid_sort_name;
-					size_t solid_sort_name_nbytes;
+					struct blob_extraction_target *blob_extraction_targets;
+					u32 alloc_blob_extraction_targets;
 				};
 			};
-		};
 
-		/* Used temporarily during extraction.  This is an array of
-		 * references to the streams being extracted that use this blob.
-		 * out_refcnt tracks the number of slots filled.  */
-		union {
-			struct blob_extraction_target inline_blob_extraction_targets[3];
-			struct {
-				struct blob_extraction_target *blob_extraction_targets;
-				u32 alloc_blob_extraction_targets;
-			};
+			/* Links blobs being extracted.  */
+			struct list_head extraction_list;
 		};
 	};
-
-	/* Temporary list fields.  */
-	union {
-		/* Links blobs for writing blob table.  */
-		struct list_head blob_table_list;
-
-		/* Links blobs being extracted.  */
-		struct list_head extraction_list;
-
-		/* Links blobs being exported.  */
-		struct list_head export_blob_list;
-	};
 };
 
 extern struct blob_table *
@@ -271,6 +297,11 @@ free_blob_table(struct blob_table *table);
 extern int
 read_blob_table(WIMStruct *wim);
 
+extern int
+for_each_raw_blob_table_resource(void *buf, size_t size, u32 wim_version,
+				 int (*visitor)(struct wim_reshdr *, void *),
+				 void *ctx);
+
 extern int
 write_blob_table_from_blob_list(struct list_head *blob_list,
 				struct filedes *out_fd,
@@ -383,6 +414,8 @@ blob_is_in_file(const struct blob_descriptor *blob)
 	return blob->blob_location == BLOB_IN_FILE_ON_DISK
 #ifdef __WIN32__
 	    || blob->blob_location == BLOB_IN_WINDOWS_FILE
+#else
+	    || blob->blob_location == BLOB_IN_UNIX_FILE
 #endif
 	   ;
 }
@@ -390,18 +423,48 @@ blob_is_in_file(const struct blob_descriptor *blob)
 #ifdef __WIN32__
 extern const wchar_t *
 get_windows_file_path(const struct windows_file *file);
+#else
+extern struct unix_file *
+clone_unix_file(const struct unix_file *file);
+
+extern void
+free_unix_file(struct unix_file *file);
+
+extern int
+cmp_unix_files(const struct unix_file *file1, const struct unix_file *file2);
+
+extern char *
+get_unix_file_path(const struct unix_file *file);
+
 #endif
 
+/* Get the path to the file containing the data of the blob, which must be
+ * located in a file (see blob_is_in_file()).  The path may need to be built,
+ * so this can return NULL if out of memory.  Release the path with
+ * blob_put_file_path() when done.  */
 static inline const tchar *
-blob_file_path(const struct blob_descriptor *blob)
+blob_get_file_path(const struct blob_descriptor *blob)
 {
 #ifdef __WIN32__
 	if (blob->blob_location == BLOB_IN_WINDOWS_FILE)
 		return get_windows_file_path(blob->windows_file);
+#else
+	if (blob->blob_location == BLOB_IN_UNIX_FILE)
+		return get_unix_file_path(blob->unix_file);
 #endif
 	return blob->file_on_disk;
 }
 
+/* Release a path acquired with blob_get_file_path().  */
+static inline void
+blob_put_file_path(const struct blob_descriptor *blob, const tchar *path)
+{
+#ifndef __WIN32__
+	if (blob->blob_location == BLOB_IN_UNIX_FILE)
+		FREE((void *)path);
+#endif
+}
+
 extern struct blob_descriptor *
 new_blob_from_data_buffer(const void *buffer, size_t size,
 			  struct blob_table *blob_table);
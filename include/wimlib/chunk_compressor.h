@@ -20,6 +20,12 @@ struct chunk_compressor {
 	u32 out_chunk_size;
 	unsigned num_threads;
 
+	/* Number of bytes of uncompressed data, among the chunks retrieved so
+	 * far with ->get_compression_result(), that were stored uncompressed
+	 * without trying to compress them because chunk_is_incompressible()
+	 * said so.  */
+	u64 skipped_bytes;
+
 	/* Free the chunk compressor.  */
 	void (*destroy)(struct chunk_compressor *);
 
@@ -74,4 +80,12 @@ int
 new_serial_chunk_compressor(int out_ctype, u32 out_chunk_size,
 			    struct chunk_compressor **compressor_ret);
 
+/* Detection of incompressible chunks, implemented in compress.c  */
+
+unsigned int
+get_incompressible_chunk_threshold(void);
+
+bool
+chunk_is_incompressible(const void *chunk, size_t size, unsigned int threshold);
+
 #endif /* _WIMLIB_CHUNK_COMPRESSOR_H  */
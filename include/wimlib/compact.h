@@ -0,0 +1,13 @@
+#ifndef _WIMLIB_COMPACT_H
+#define _WIMLIB_COMPACT_H
+
+#include "wimlib/types.h"
+
+extern int
+compact_wim_file(WIMStruct *wim, int write_flags);
+
+extern int
+finish_interrupted_compaction(WIMStruct *wim, int open_flags,
+			      bool *finished_ret);
+
+#endif /* _WIMLIB_COMPACT_H */
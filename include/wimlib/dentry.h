@@ -179,6 +179,10 @@ dentry_get_next_ci_match(struct wim_dentry *dentry,
 extern void
 calculate_subdir_offsets(struct wim_dentry *root, u64 *subdir_offset_p);
 
+extern bool
+calculate_subdir_offsets_in_place(struct wim_dentry *root,
+				  u64 *subdir_offset_p, u64 old_len);
+
 extern int
 dentry_set_name(struct wim_dentry *dentry, const tchar *name);
 
@@ -189,6 +193,10 @@ dentry_set_name_utf16le(struct wim_dentry *dentry, const utf16lechar *name,
 extern struct wim_dentry *
 get_dentry(WIMStruct *wim, const tchar *path, CASE_SENSITIVITY_TYPE case_type);
 
+extern struct wim_dentry *
+get_dentry_in_tree(struct wim_dentry *root, const tchar *path,
+		   CASE_SENSITIVITY_TYPE case_type);
+
 extern struct wim_dentry *
 get_dentry_child_with_name(const struct wim_dentry *dentry, const tchar *name,
 			   CASE_SENSITIVITY_TYPE case_type);
@@ -245,7 +253,8 @@ read_dentry_tree(const u8 *buf, size_t buf_len,
 		 u64 root_offset, struct wim_dentry **root_ret);
 
 extern u8 *
-write_dentry_tree(struct wim_dentry *root, u8 *p);
+write_dentry_tree(struct wim_dentry *root, u8 *buf, u8 *p,
+		  unsigned num_threads);
 
 static inline bool
 dentry_is_root(const struct wim_dentry *dentry)
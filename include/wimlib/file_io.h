@@ -36,6 +36,12 @@ filedes_seek(struct filedes *fd, off_t offset);
 extern bool
 filedes_is_seekable(struct filedes *fd);
 
+extern void
+filedes_writeback(struct filedes *fd, off_t prev_start, off_t start, off_t end);
+
+extern int
+filedes_sync_data(struct filedes *fd);
+
 static inline void filedes_init(struct filedes *fd, int raw_fd)
 {
 	fd->fd = raw_fd;
@@ -122,7 +122,7 @@ struct wim_inode {
 	struct hlist_node i_hlist_node;
 
 	/* Number of dentries that are aliases for this inode.  */
-	u32 i_nlink : 30;
+	u32 i_nlink : 29;
 
 	/* Flag used by some code to mark this inode as visited.  It will be 0
 	 * by default, and it always must be cleared after use.  */
@@ -131,6 +131,10 @@ struct wim_inode {
 	/* Cached value  */
 	u32 i_can_externally_back : 1;
 
+	/* (Extraction only) Set if the inode's data is already present in
+	 * the target and won't be extracted again  */
+	u32 i_data_unchanged : 1;
+
 	/* If not NULL, a pointer to the extra data that was read from the
 	 * dentry.  This should be a series of tagged items, each of which
 	 * represents a bit of extra metadata, such as the file's object ID.
@@ -47,6 +47,12 @@ struct wim_image_metadata {
 	 * with blob_location==BLOB_NONEXISTENT.  */
 	struct blob_descriptor *metadata_blob;
 
+	/* If this image was modified after being read from a WIM file, then
+	 * this is a blob descriptor for the metadata resource it was read from,
+	 * so that the compressed chunks that are still the same can be reused
+	 * when the image is written.  Otherwise NULL.  */
+	struct blob_descriptor *prev_metadata_blob;
+
 	/* Linked list of 'struct wim_inode's for this image, or an empty list
 	 * if this image is completely empty or is not currently loaded.  */
 	struct hlist_head inode_list;
@@ -111,6 +117,10 @@ is_image_unchanged_from_wim(const struct wim_image_metadata *imd,
 static inline void
 mark_image_dirty(struct wim_image_metadata *imd)
 {
+	if (!is_image_dirty(imd)) {
+		free_blob_descriptor(imd->prev_metadata_blob);
+		imd->prev_metadata_blob = clone_blob_descriptor(imd->metadata_blob);
+	}
 	blob_release_location(imd->metadata_blob);
 	imd->stats_outdated = true;
 }
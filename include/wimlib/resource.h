@@ -49,12 +49,30 @@ struct wim_resource_descriptor {
 	/* Temporary flag.  */
 	u32 raw_copy_ok : 1;
 
+	/* Temporary flag: set once it has been decided whether this solid
+	 * resource can be copied in raw form, in which case @raw_copy_ok holds
+	 * the decision and @raw_copy_needed_size is valid.  */
+	u32 raw_copy_checked : 1;
+
 	/* Compression type of this resource.  */
-	u32 compression_type : 22;
+	u32 compression_type : 21;
 
 	/* Compression chunk size of this resource.  Irrelevant if the resource
 	 * is uncompressed.  */
 	u32 chunk_size;
+
+	/* Temporary field: the total uncompressed size of the chunks of this
+	 * solid resource that hold data being written.  See
+	 * map_needed_solid_chunks().  */
+	u64 raw_copy_needed_size;
+
+	/* For solid resources only: the offset of each compressed chunk,
+	 * relative to the end of the chunk table.  This is computed from the
+	 * alternate chunk table (which stores compressed sizes, not offsets)
+	 * the first time data is read from the resource, then cached here so
+	 * that later reads can seek directly to the chunks they need.  NULL if
+	 * not loaded yet.  */
+	u64 *solid_chunk_offsets;
 };
 
 /* On-disk version of a WIM resource header.  */
@@ -128,6 +146,9 @@ wim_reshdr_to_desc_and_blob(const struct wim_reshdr *reshdr, WIMStruct *wim,
 			    struct wim_resource_descriptor *rdesc,
 			    struct blob_descriptor *blob);
 
+extern void
+free_wim_resource_descriptor(struct wim_resource_descriptor *rdesc);
+
 extern void
 get_wim_reshdr(const struct wim_reshdr_disk *disk_reshdr,
 	       struct wim_reshdr *reshdr);
@@ -189,6 +210,18 @@ extern int
 wim_reshdr_to_hash(const struct wim_reshdr *reshdr, WIMStruct *wim,
 		   u8 hash[SHA1_HASH_SIZE]);
 
+extern void
+free_thread_read_ctx(void);
+
+extern void
+free_decompressor_pool(void);
+
+extern void
+free_large_chunk_buf_pool(void);
+
+extern void
+free_blob_cache(void);
+
 extern int
 skip_wim_resource(const struct wim_resource_descriptor *rdesc);
 
@@ -211,6 +244,25 @@ consume_chunk(const struct consume_chunk_callback *cb,
 	return (*cb->func)(chunk, size, cb->ctx);
 }
 
+/*
+ * Callback function for read_raw_wim_chunks().  Called for each chunk with the
+ * chunk's data exactly as stored in the WIM file, passing 'ctx' as the last
+ * argument.  If 'csize == usize', the chunk is stored uncompressed.  Must
+ * return 0 on success, or a positive wimlib error code on failure.
+ */
+struct consume_raw_chunk_callback {
+	int (*func)(const void *cchunk, u32 csize, u32 usize, void *ctx);
+	void *ctx;
+};
+
+/* Pass a raw chunk to the specified consume_raw_chunk callback */
+static inline int
+consume_raw_chunk(const struct consume_raw_chunk_callback *cb,
+		  const void *cchunk, u32 csize, u32 usize)
+{
+	return (*cb->func)(cchunk, csize, usize, cb->ctx);
+}
+
 /* Callback functions for reading blobs  */
 struct read_blob_callbacks {
 
@@ -274,6 +326,15 @@ call_end_blob(struct blob_descriptor *blob, int status,
 #define COMPUTE_MISSING_BLOB_HASHES	0x2
 #define BLOB_LIST_ALREADY_SORTED	0x4
 
+extern int
+read_blob_range(const struct blob_descriptor *blob, u64 offset, u64 size,
+		const struct consume_chunk_callback *cb);
+
+extern int
+read_raw_wim_chunks(const struct wim_resource_descriptor *rdesc,
+		    u64 first_chunk, u64 num_chunks,
+		    const struct consume_raw_chunk_callback *cb);
+
 extern int
 read_blob_list(struct list_head *blob_list, size_t list_head_offset,
 	       const struct read_blob_callbacks *cbs, int flags);
@@ -304,7 +365,8 @@ extern int
 read_metadata_resource(struct wim_image_metadata *imd);
 
 extern int
-write_metadata_resource(WIMStruct *wim, int image, int write_resource_flags);
+write_metadata_resource(WIMStruct *wim, int image, int write_resource_flags,
+			unsigned num_threads);
 
 /* Definitions specific to pipable WIM resources.  */
 
@@ -96,20 +96,6 @@ struct WIMStruct {
 	 * Otherwise, this field is invalid (!filedes_valid(&out_fd)).  */
 	struct filedes out_fd;
 
-	/*
-	 * This is the cached decompressor for this WIM file, or NULL if no
-	 * decompressor is cached yet.  Normally, all the compressed data in a
-	 * WIM file has the same compression type and chunk size, so the same
-	 * decompressor can be used for all data --- and that decompressor will
-	 * be cached here.  However, if we do encounter any data with a
-	 * different compression type or chunk size (this is possible in solid
-	 * resources), then this cached decompressor will be replaced with a new
-	 * one.
-	 */
-	struct wimlib_decompressor *decompressor;
-	u8 decompressor_ctype;
-	u32 decompressor_max_block_size;
-
 	/* Temporary field; use sparingly  */
 	void *private;
 
@@ -123,6 +109,17 @@ struct WIMStruct {
 	 * with WIMLIB_WRITE_FLAG_UNSAFE_COMPACT  */
 	u8 being_compacted : 1;
 
+	/* 1 if the WIM was opened with WIMLIB_OPEN_FLAG_CONCURRENT_READS.  The
+	 * metadata of all images is then loaded when the WIM is opened and is
+	 * never unloaded, so that it can be shared by concurrent readers.  */
+	u8 concurrent_reads : 1;
+
+	/* Number identifying the contents of the WIM file backing this
+	 * WIMStruct, used to key caches of data read from it.  It is unique
+	 * among all WIMStructs in the process and is changed whenever existing
+	 * resources in the file may have been moved or overwritten.  */
+	u64 data_serial;
+
 	/* If this WIM is backed by a file, then this is the compression type
 	 * for non-solid resources in that file.  */
 	u8 compression_type;
@@ -207,12 +204,21 @@ select_wim_image(WIMStruct *wim, int image);
 extern void
 deselect_current_wim_image(WIMStruct *wim);
 
+extern int
+pin_wim_image(WIMStruct *wim, int image);
+
+extern void
+unpin_wim_image(WIMStruct *wim, struct wim_image_metadata *imd);
+
 extern int
 for_image(WIMStruct *wim, int image, int (*visitor)(WIMStruct *));
 
 extern int
 wim_checksum_unhashed_blobs(WIMStruct *wim);
 
+extern void
+wim_new_data_serial(WIMStruct *wim);
+
 extern int
 delete_wim_image(WIMStruct *wim, int image);
 
@@ -28,7 +28,10 @@
 	WIMLIB_WRITE_FLAG_SOLID				| \
 	WIMLIB_WRITE_FLAG_SEND_DONE_WITH_FILE_MESSAGES	| \
 	WIMLIB_WRITE_FLAG_NO_SOLID_SORT			| \
-	WIMLIB_WRITE_FLAG_UNSAFE_COMPACT)
+	WIMLIB_WRITE_FLAG_UNSAFE_COMPACT		| \
+	WIMLIB_WRITE_FLAG_SOLID_RANDOM_ACCESS		| \
+	WIMLIB_WRITE_FLAG_COMPACT			| \
+	WIMLIB_WRITE_FLAG_SYNC_BEFORE_HEADER)
 
 #if defined(HAVE_SYS_FILE_H) && defined(HAVE_FLOCK)
 extern int
@@ -47,6 +50,7 @@ unlock_wim_for_append(WIMStruct *wim)
 }
 #endif
 
+struct blob_descriptor;
 struct filedes;
 struct list_head;
 struct wim_reshdr;
@@ -71,6 +75,25 @@ write_wim_resource_from_buffer(const void *buf,
 			       u32 out_chunk_size,
 			       struct wim_reshdr *out_reshdr,
 			       u8 *hash_ret,
-			       int write_resource_flags);
+			       int write_resource_flags,
+			       unsigned num_threads);
+
+bool
+can_reuse_resource_chunks(const struct blob_descriptor *old_blob,
+			  int out_ctype, u32 out_chunk_size,
+			  int write_resource_flags);
+
+int
+write_wim_resource_from_buffer_reusing_chunks(const void *buf,
+					      size_t buf_size,
+					      bool is_metadata,
+					      const struct blob_descriptor *old_blob,
+					      struct filedes *out_fd,
+					      int out_ctype,
+					      u32 out_chunk_size,
+					      struct wim_reshdr *out_reshdr,
+					      u8 *hash_ret,
+					      int write_resource_flags,
+					      unsigned num_threads);
 
 #endif /* _WIMLIB_WRITE_H */
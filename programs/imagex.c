@@ -113,6 +113,7 @@ enum {
 	CMD_APPLY,
 	CMD_CAPTURE,
 	CMD_DELETE,
+	CMD_DIFF,
 	CMD_DIR,
 	CMD_EXPORT,
 	CMD_EXTRACT,
@@ -167,6 +168,7 @@ enum {
 	IMAGEX_CHECK_OPTION,
 	IMAGEX_CHUNK_SIZE_OPTION,
 	IMAGEX_COMMAND_OPTION,
+	IMAGEX_COMMANDS_OPTION,
 	IMAGEX_COMMIT_OPTION,
 	IMAGEX_COMPACT_OPTION,
 	IMAGEX_COMPRESS_OPTION,
@@ -181,8 +183,10 @@ enum {
 	IMAGEX_FLAGS_OPTION,
 	IMAGEX_FORCE_OPTION,
 	IMAGEX_HEADER_OPTION,
+	IMAGEX_IGNORE_TIMESTAMPS_OPTION,
 	IMAGEX_IMAGE_PROPERTY_OPTION,
 	IMAGEX_INCLUDE_INTEGRITY_OPTION,
+	IMAGEX_INCREMENTAL_OPTION,
 	IMAGEX_INCLUDE_INVALID_NAMES_OPTION,
 	IMAGEX_LAZY_OPTION,
 	IMAGEX_METADATA_OPTION,
@@ -205,11 +209,14 @@ enum {
 	IMAGEX_RECURSIVE_OPTION,
 	IMAGEX_REF_OPTION,
 	IMAGEX_RPFIX_OPTION,
+	IMAGEX_SAFE_COMPACT_OPTION,
+	IMAGEX_SINGLE_PASS_OPTION,
 	IMAGEX_SNAPSHOT_OPTION,
 	IMAGEX_SOFT_OPTION,
 	IMAGEX_SOLID_CHUNK_SIZE_OPTION,
 	IMAGEX_SOLID_COMPRESS_OPTION,
 	IMAGEX_SOLID_OPTION,
+	IMAGEX_SOLID_RANDOM_ACCESS_OPTION,
 	IMAGEX_SOURCE_LIST_OPTION,
 	IMAGEX_STAGING_DIR_OPTION,
 	IMAGEX_STREAMS_INTERFACE_OPTION,
@@ -239,6 +246,8 @@ static const struct option apply_options[] = {
 	{T("include-invalid-names"), no_argument,       NULL, IMAGEX_INCLUDE_INVALID_NAMES_OPTION},
 	{T("wimboot"),     no_argument,       NULL, IMAGEX_WIMBOOT_OPTION},
 	{T("compact"),     required_argument, NULL, IMAGEX_COMPACT_OPTION},
+	{T("incremental"), no_argument,       NULL, IMAGEX_INCREMENTAL_OPTION},
+	{T("single-pass"), no_argument,       NULL, IMAGEX_SINGLE_PASS_OPTION},
 	{NULL, 0, NULL, 0},
 };
 
@@ -254,6 +263,7 @@ static const struct option capture_or_append_options[] = {
 	{T("solid-compress"),required_argument, NULL, IMAGEX_SOLID_COMPRESS_OPTION},
 	{T("solid-chunk-size"),required_argument, NULL, IMAGEX_SOLID_CHUNK_SIZE_OPTION},
 	{T("no-solid-sort"), no_argument,     NULL, IMAGEX_NO_SOLID_SORT_OPTION},
+	{T("solid-random-access"), no_argument, NULL, IMAGEX_SOLID_RANDOM_ACCESS_OPTION},
 	{T("config"),      required_argument, NULL, IMAGEX_CONFIG_OPTION},
 	{T("dereference"), no_argument,       NULL, IMAGEX_DEREFERENCE_OPTION},
 	{T("flags"),       required_argument, NULL, IMAGEX_FLAGS_OPTION},
@@ -274,6 +284,7 @@ static const struct option capture_or_append_options[] = {
 	{T("delta-from"),  required_argument, NULL, IMAGEX_DELTA_FROM_OPTION},
 	{T("wimboot"),     no_argument,       NULL, IMAGEX_WIMBOOT_OPTION},
 	{T("unsafe-compact"), no_argument,    NULL, IMAGEX_UNSAFE_COMPACT_OPTION},
+	{T("safe-compact"),   no_argument,    NULL, IMAGEX_SAFE_COMPACT_OPTION},
 	{T("snapshot"),    no_argument,       NULL, IMAGEX_SNAPSHOT_OPTION},
 	{T("create"),      no_argument,       NULL, IMAGEX_CREATE_OPTION},
 	{NULL, 0, NULL, 0},
@@ -284,6 +295,13 @@ static const struct option delete_options[] = {
 	{T("include-integrity"), no_argument, NULL, IMAGEX_INCLUDE_INTEGRITY_OPTION},
 	{T("soft"),  no_argument, NULL, IMAGEX_SOFT_OPTION},
 	{T("unsafe-compact"), no_argument, NULL, IMAGEX_UNSAFE_COMPACT_OPTION},
+	{T("safe-compact"), no_argument, NULL, IMAGEX_SAFE_COMPACT_OPTION},
+	{NULL, 0, NULL, 0},
+};
+
+static const struct option diff_options[] = {
+	{T("commands"),  required_argument, NULL, IMAGEX_COMMANDS_OPTION},
+	{T("ignore-timestamps"), no_argument, NULL, IMAGEX_IGNORE_TIMESTAMPS_OPTION},
 	{NULL, 0, NULL, 0},
 };
 
@@ -308,6 +326,7 @@ static const struct option export_options[] = {
 	{T("solid-compress"),required_argument, NULL, IMAGEX_SOLID_COMPRESS_OPTION},
 	{T("solid-chunk-size"),required_argument, NULL, IMAGEX_SOLID_CHUNK_SIZE_OPTION},
 	{T("no-solid-sort"), no_argument,     NULL, IMAGEX_NO_SOLID_SORT_OPTION},
+	{T("solid-random-access"), no_argument, NULL, IMAGEX_SOLID_RANDOM_ACCESS_OPTION},
 	{T("ref"),         required_argument, NULL, IMAGEX_REF_OPTION},
 	{T("threads"),     required_argument, NULL, IMAGEX_THREADS_OPTION},
 	{T("rebuild"),     no_argument,       NULL, IMAGEX_REBUILD_OPTION},
@@ -315,6 +334,7 @@ static const struct option export_options[] = {
 	{T("not-pipable"), no_argument,       NULL, IMAGEX_NOT_PIPABLE_OPTION},
 	{T("wimboot"),     no_argument,       NULL, IMAGEX_WIMBOOT_OPTION},
 	{T("unsafe-compact"), no_argument,    NULL, IMAGEX_UNSAFE_COMPACT_OPTION},
+	{T("safe-compact"),   no_argument,    NULL, IMAGEX_SAFE_COMPACT_OPTION},
 	{NULL, 0, NULL, 0},
 };
 
@@ -385,10 +405,12 @@ static const struct option optimize_options[] = {
 	{T("solid-compress"),required_argument, NULL, IMAGEX_SOLID_COMPRESS_OPTION},
 	{T("solid-chunk-size"),required_argument, NULL, IMAGEX_SOLID_CHUNK_SIZE_OPTION},
 	{T("no-solid-sort"), no_argument,     NULL, IMAGEX_NO_SOLID_SORT_OPTION},
+	{T("solid-random-access"), no_argument, NULL, IMAGEX_SOLID_RANDOM_ACCESS_OPTION},
 	{T("threads"),     required_argument, NULL, IMAGEX_THREADS_OPTION},
 	{T("pipable"),     no_argument,       NULL, IMAGEX_PIPABLE_OPTION},
 	{T("not-pipable"), no_argument,       NULL, IMAGEX_NOT_PIPABLE_OPTION},
 	{T("unsafe-compact"), no_argument,    NULL, IMAGEX_UNSAFE_COMPACT_OPTION},
+	{T("safe-compact"),   no_argument,    NULL, IMAGEX_SAFE_COMPACT_OPTION},
 	{NULL, 0, NULL, 0},
 };
 
@@ -438,6 +460,7 @@ static const struct option update_options[] = {
 	{T("strict-acls"), no_argument,       NULL, IMAGEX_STRICT_ACLS_OPTION},
 	{T("no-replace"),  no_argument,       NULL, IMAGEX_NO_REPLACE_OPTION},
 	{T("unsafe-compact"), no_argument,    NULL, IMAGEX_UNSAFE_COMPACT_OPTION},
+	{T("safe-compact"),   no_argument,    NULL, IMAGEX_SAFE_COMPACT_OPTION},
 
 	{NULL, 0, NULL, 0},
 };
@@ -1199,8 +1222,17 @@ imagex_progress_func(enum wimlib_progress_msg msg,
 			info->write_streams.total_bytes >> unit_shift,
 			unit_name,
 			percent_done);
-		if (info->write_streams.completed_bytes >= info->write_streams.total_bytes)
+		if (info->write_streams.completed_bytes >= info->write_streams.total_bytes) {
 			imagex_printf(T("\n"));
+			if (info->write_streams.skipped_compression_bytes) {
+				unit_shift = get_unit(info->write_streams.skipped_compression_bytes,
+						      &unit_name);
+				imagex_printf(T("Stored %"PRIu64" %"TS" of incompressible "
+						"data without compressing it\n"),
+					      info->write_streams.skipped_compression_bytes >> unit_shift,
+					      unit_name);
+			}
+		}
 		break;
 	case WIMLIB_PROGRESS_MSG_SCAN_BEGIN:
 		imagex_printf(T("Scanning \"%"TS"\""), info->scan.source);
@@ -1277,6 +1309,13 @@ imagex_progress_func(enum wimlib_progress_msg msg,
 			imagex_printf(T("\n"));
 		break;
 	case WIMLIB_PROGRESS_MSG_EXTRACT_IMAGE_BEGIN:
+		if (info->extract.image == (uint32_t)WIMLIB_ALL_IMAGES) {
+			imagex_printf(T("Applying all images from \"%"TS"\" "
+					"to directory \"%"TS"\"\n"),
+				info->extract.wimfile_name,
+				info->extract.target);
+			break;
+		}
 		imagex_printf(T("Applying image %d (\"%"TS"\") from \"%"TS"\" "
 			  "to %"TS" \"%"TS"\"\n"),
 			info->extract.image,
@@ -1733,6 +1772,12 @@ imagex_apply(int argc, tchar **argv, int cmd)
 			if (ret)
 				goto out_free_refglobs;
 			break;
+		case IMAGEX_INCREMENTAL_OPTION:
+			extract_flags |= WIMLIB_EXTRACT_FLAG_INCREMENTAL;
+			break;
+		case IMAGEX_SINGLE_PASS_OPTION:
+			extract_flags |= WIMLIB_EXTRACT_FLAG_SINGLE_PASS;
+			break;
 		default:
 			goto out_usage;
 		}
@@ -1951,6 +1996,9 @@ imagex_capture_or_append(int argc, tchar **argv, int cmd)
 		case IMAGEX_NO_SOLID_SORT_OPTION:
 			write_flags |= WIMLIB_WRITE_FLAG_NO_SOLID_SORT;
 			break;
+		case IMAGEX_SOLID_RANDOM_ACCESS_OPTION:
+			write_flags |= WIMLIB_WRITE_FLAG_SOLID_RANDOM_ACCESS;
+			break;
 		case IMAGEX_FLAGS_OPTION: {
 			tchar *p = alloca((6 + tstrlen(optarg) + 1) * sizeof(tchar));
 			tsprintf(p, T("FLAGS=%"TS), optarg);
@@ -2036,6 +2084,9 @@ imagex_capture_or_append(int argc, tchar **argv, int cmd)
 		case IMAGEX_UNSAFE_COMPACT_OPTION:
 			write_flags |= WIMLIB_WRITE_FLAG_UNSAFE_COMPACT;
 			break;
+		case IMAGEX_SAFE_COMPACT_OPTION:
+			write_flags |= WIMLIB_WRITE_FLAG_COMPACT;
+			break;
 		case IMAGEX_SNAPSHOT_OPTION:
 			add_flags |= WIMLIB_ADD_FLAG_SNAPSHOT;
 			break;
@@ -2126,6 +2177,11 @@ imagex_capture_or_append(int argc, tchar **argv, int cmd)
 		goto out_err;
 	}
 
+	if ((write_flags & WIMLIB_WRITE_FLAG_COMPACT) && !appending) {
+		imagex_error(T("'--safe-compact' is only valid for append!"));
+		goto out_err;
+	}
+
 	/* If template image was specified using --update-of=IMAGE rather
 	 * than --update-of=WIMFILE:IMAGE, set the default WIMFILE.  */
 	if (template_image_name_or_num && !template_wimfile) {
@@ -2488,6 +2544,9 @@ imagex_delete(int argc, tchar **argv, int cmd)
 		case IMAGEX_UNSAFE_COMPACT_OPTION:
 			write_flags |= WIMLIB_WRITE_FLAG_UNSAFE_COMPACT;
 			break;
+		case IMAGEX_SAFE_COMPACT_OPTION:
+			write_flags |= WIMLIB_WRITE_FLAG_COMPACT;
+			break;
 		default:
 			goto out_usage;
 		}
@@ -2539,6 +2598,197 @@ out_usage:
 	goto out;
 }
 
+struct print_diff_options {
+	/* If not NULL, print wimupdate commands that add files from this
+	 * directory rather than a list of changes.  */
+	const tchar *source;
+};
+
+static const struct {
+	uint32_t flag;
+	const tchar *name;
+} diff_changed_flags[] = {
+	{WIMLIB_DIFF_CHANGED_TYPE,	 T("type")},
+	{WIMLIB_DIFF_CHANGED_DATA,	 T("data")},
+	{WIMLIB_DIFF_CHANGED_ATTRIBUTES, T("attributes")},
+	{WIMLIB_DIFF_CHANGED_SECURITY,	 T("security")},
+	{WIMLIB_DIFF_CHANGED_TIMESTAMPS, T("timestamps")},
+	{WIMLIB_DIFF_CHANGED_OTHER,	 T("other")},
+};
+
+/* Return a quote character with which @str can be written as an argument in a
+ * wimupdate command, or 0 if there is none.  */
+static tchar
+update_command_quote_char(const tchar *str)
+{
+	if (!tstrchr(str, T('"')))
+		return T('"');
+	if (!tstrchr(str, T('\'')))
+		return T('\'');
+	return 0;
+}
+
+static int
+print_diff_update_commands(const struct wimlib_diff_entry *entry,
+			   const tchar *source)
+{
+	tchar q1 = update_command_quote_char(entry->path);
+	tchar q2 = update_command_quote_char(source);
+
+	if (!q1 || !q2) {
+		imagex_error(T("\"%"TS"\" cannot be quoted in an update "
+			       "command"), entry->path);
+		return -1;
+	}
+
+	if (entry->change == WIMLIB_DIFF_MODIFIED &&
+	    (entry->new_attributes & WIMLIB_FILE_ATTRIBUTE_DIRECTORY) &&
+	    !(entry->changed & WIMLIB_DIFF_CHANGED_TYPE))
+	{
+		/* Adding over an existing directory would not update its own
+		 * metadata, so there is no command for this.  */
+		tprintf(T("# directory metadata changed: %"TS"\n"), entry->path);
+		return 0;
+	}
+
+	if (entry->change == WIMLIB_DIFF_DELETED ||
+	    (entry->changed & WIMLIB_DIFF_CHANGED_TYPE))
+		tprintf(T("delete --force --recursive %c%"TS"%c\n"),
+			q1, entry->path, q1);
+
+	if (entry->change != WIMLIB_DIFF_DELETED) {
+		tprintf(T("add %c%"TS"%"TS"%c %c%"TS"%c\n"),
+			q2, source, entry->path, q2, q1, entry->path, q1);
+	}
+	return 0;
+}
+
+static int
+print_diff_entry(const struct wimlib_diff_entry *entry, void *_options)
+{
+	const struct print_diff_options *options = _options;
+	const tchar *sep = T(" (");
+
+	if (options->source)
+		return print_diff_update_commands(entry, options->source);
+
+	switch (entry->change) {
+	case WIMLIB_DIFF_ADDED:
+		tprintf(T("A %"TS), entry->path);
+		break;
+	case WIMLIB_DIFF_DELETED:
+		tprintf(T("D %"TS), entry->path);
+		break;
+	default:
+		tprintf(T("M %"TS), entry->path);
+		for (size_t i = 0; i < ARRAY_LEN(diff_changed_flags); i++) {
+			if (entry->changed & diff_changed_flags[i].flag) {
+				tprintf(T("%"TS"%"TS), sep,
+					diff_changed_flags[i].name);
+				sep = T(", ");
+			}
+		}
+		tputchar(T(')'));
+		break;
+	}
+	tputchar(T('\n'));
+	return 0;
+}
+
+/* Compare two images, which may be in the same WIM file or in different WIM
+ * files.  */
+static int
+imagex_diff(int argc, tchar **argv, int cmd)
+{
+	int c;
+	int diff_flags = 0;
+	struct print_diff_options options = {
+		.source = NULL,
+	};
+	const tchar *old_wimfile, *old_image_str;
+	const tchar *new_wimfile, *new_image_str;
+	WIMStruct *old_wim = NULL;
+	WIMStruct *new_wim = NULL;
+	int old_image, new_image;
+	int ret;
+
+	for_opt(c, diff_options) {
+		switch (c) {
+		case IMAGEX_COMMANDS_OPTION:
+			options.source = optarg;
+			break;
+		case IMAGEX_IGNORE_TIMESTAMPS_OPTION:
+			diff_flags |= WIMLIB_DIFF_FLAG_IGNORE_TIMESTAMPS;
+			break;
+		default:
+			goto out_usage;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 3 && argc != 4) {
+		if (argc < 1)
+			imagex_error(T("Must specify a WIM file"));
+		else if (argc < 3)
+			imagex_error(T("Must specify two images"));
+		else
+			imagex_error(T("Too many arguments"));
+		goto out_usage;
+	}
+
+	old_wimfile = argv[0];
+	old_image_str = argv[1];
+	new_wimfile = (argc == 4) ? argv[2] : old_wimfile;
+	new_image_str = argv[argc - 1];
+
+	ret = wimlib_open_wim_with_progress(old_wimfile, 0, &old_wim,
+					    imagex_progress_func, NULL);
+	if (ret)
+		goto out;
+
+	if (argc == 4) {
+		ret = wimlib_open_wim_with_progress(new_wimfile, 0, &new_wim,
+						    imagex_progress_func, NULL);
+		if (ret)
+			goto out_wimlib_free;
+	} else {
+		new_wim = old_wim;
+	}
+
+	old_image = wimlib_resolve_image(old_wim, old_image_str);
+	ret = verify_image_exists_and_is_single(old_image, old_image_str,
+						old_wimfile);
+	if (ret)
+		goto out_wimlib_free;
+
+	new_image = wimlib_resolve_image(new_wim, new_image_str);
+	ret = verify_image_exists_and_is_single(new_image, new_image_str,
+						new_wimfile);
+	if (ret)
+		goto out_wimlib_free;
+
+	ret = wimlib_diff_images(old_wim, old_image, new_wim, new_image,
+				 diff_flags, print_diff_entry, &options);
+	if (ret == WIMLIB_ERR_METADATA_NOT_FOUND) {
+		struct wimlib_wim_info info;
+
+		wimlib_get_wim_info(old_wim, &info);
+		do_metadata_not_found_warning(old_wimfile, &info);
+	}
+out_wimlib_free:
+	if (new_wim != old_wim)
+		wimlib_free(new_wim);
+	wimlib_free(old_wim);
+out:
+	return ret;
+
+out_usage:
+	usage(CMD_DIFF, stderr);
+	ret = -1;
+	goto out;
+}
+
 struct print_dentry_options {
 	bool detailed;
 };
@@ -2962,6 +3212,9 @@ imagex_export(int argc, tchar **argv, int cmd)
 		case IMAGEX_NO_SOLID_SORT_OPTION:
 			write_flags |= WIMLIB_WRITE_FLAG_NO_SOLID_SORT;
 			break;
+		case IMAGEX_SOLID_RANDOM_ACCESS_OPTION:
+			write_flags |= WIMLIB_WRITE_FLAG_SOLID_RANDOM_ACCESS;
+			break;
 		case IMAGEX_CHUNK_SIZE_OPTION:
 			chunk_size = parse_chunk_size(optarg);
 			if (chunk_size == UINT32_MAX)
@@ -3002,6 +3255,9 @@ imagex_export(int argc, tchar **argv, int cmd)
 		case IMAGEX_UNSAFE_COMPACT_OPTION:
 			write_flags |= WIMLIB_WRITE_FLAG_UNSAFE_COMPACT;
 			break;
+		case IMAGEX_SAFE_COMPACT_OPTION:
+			write_flags |= WIMLIB_WRITE_FLAG_COMPACT;
+			break;
 		default:
 			goto out_usage;
 		}
@@ -3098,6 +3354,13 @@ imagex_export(int argc, tchar **argv, int cmd)
 			goto out_free_src_wim;
 		}
 
+		if (write_flags & WIMLIB_WRITE_FLAG_COMPACT) {
+			imagex_error(T("'--safe-compact' is only valid when "
+				       "exporting to an existing WIM file!"));
+			ret = -1;
+			goto out_free_src_wim;
+		}
+
 		/* dest_wimfile is not an existing file, so create a new WIM. */
 
 		if (compression_type == WIMLIB_COMPRESSION_TYPE_INVALID) {
@@ -3881,6 +4144,9 @@ imagex_optimize(int argc, tchar **argv, int cmd)
 		case IMAGEX_NO_SOLID_SORT_OPTION:
 			write_flags |= WIMLIB_WRITE_FLAG_NO_SOLID_SORT;
 			break;
+		case IMAGEX_SOLID_RANDOM_ACCESS_OPTION:
+			write_flags |= WIMLIB_WRITE_FLAG_SOLID_RANDOM_ACCESS;
+			break;
 		case IMAGEX_THREADS_OPTION:
 			num_threads = parse_num_threads(optarg);
 			if (num_threads == UINT_MAX)
@@ -3895,6 +4161,9 @@ imagex_optimize(int argc, tchar **argv, int cmd)
 		case IMAGEX_UNSAFE_COMPACT_OPTION:
 			write_flags |= WIMLIB_WRITE_FLAG_UNSAFE_COMPACT;
 			break;
+		case IMAGEX_SAFE_COMPACT_OPTION:
+			write_flags |= WIMLIB_WRITE_FLAG_COMPACT;
+			break;
 		default:
 			goto out_usage;
 		}
@@ -4199,6 +4468,9 @@ imagex_update(int argc, tchar **argv, int cmd)
 		case IMAGEX_UNSAFE_COMPACT_OPTION:
 			write_flags |= WIMLIB_WRITE_FLAG_UNSAFE_COMPACT;
 			break;
+		case IMAGEX_SAFE_COMPACT_OPTION:
+			write_flags |= WIMLIB_WRITE_FLAG_COMPACT;
+			break;
 		default:
 			goto out_usage;
 		}
@@ -4417,6 +4689,7 @@ static const struct imagex_command imagex_commands[] = {
 	[CMD_APPLY]    = {T("apply"),    imagex_apply},
 	[CMD_CAPTURE]  = {T("capture"),  imagex_capture_or_append},
 	[CMD_DELETE]   = {T("delete"),   imagex_delete},
+	[CMD_DIFF]     = {T("diff"),     imagex_diff},
 	[CMD_DIR ]     = {T("dir"),      imagex_dir},
 	[CMD_EXPORT]   = {T("export"),   imagex_export},
 	[CMD_EXTRACT]  = {T("extract"),  imagex_extract},
@@ -4469,7 +4742,7 @@ T(
 "                    [--check] [--ref=\"GLOB\"] [--no-acls] [--strict-acls]\n"
 "                    [--no-attributes] [--rpfix] [--norpfix]\n"
 "                    [--include-invalid-names] [--wimboot] [--unix-data]\n"
-"                    [--compact=FORMAT]\n"
+"                    [--compact=FORMAT] [--incremental] [--single-pass]\n"
 ),
 [CMD_CAPTURE] =
 T(
@@ -4485,6 +4758,11 @@ T(
 T(
 "    %"TS" WIMFILE IMAGE [--check] [--soft]\n"
 ),
+[CMD_DIFF] =
+T(
+"    %"TS" WIMFILE OLD_IMAGE [NEW_WIMFILE] NEW_IMAGE\n"
+"                    [--ignore-timestamps] [--commands=SOURCE_DIR]\n"
+),
 [CMD_DIR] =
 T(
 "    %"TS" WIMFILE [IMAGE] [--path=PATH] [--detailed]\n"
@@ -135,6 +135,12 @@ clone_blob_descriptor(const struct blob_descriptor *old)
 	case BLOB_IN_WINDOWS_FILE:
 		new->windows_file = clone_windows_file(old->windows_file);
 		break;
+#else
+	case BLOB_IN_UNIX_FILE:
+		new->unix_file = clone_unix_file(old->unix_file);
+		if (!new->unix_file)
+			goto out_free;
+		break;
 #endif
 	case BLOB_IN_ATTACHED_BUFFER:
 		new->attached_buffer = memdup(old->attached_buffer, old->size);
@@ -168,7 +174,7 @@ blob_release_location(struct blob_descriptor *blob)
 		list_del(&blob->rdesc_node);
 		if (list_empty(&rdesc->blob_list)) {
 			wim_decrement_refcnt(rdesc->wim);
-			FREE(rdesc);
+			free_wim_resource_descriptor(rdesc);
 		}
 		break;
 	}
@@ -187,6 +193,10 @@ blob_release_location(struct blob_descriptor *blob)
 	case BLOB_IN_WINDOWS_FILE:
 		free_windows_file(blob->windows_file);
 		break;
+#else
+	case BLOB_IN_UNIX_FILE:
+		free_unix_file(blob->unix_file);
+		break;
 #endif
 #ifdef WITH_NTFS_3G
 	case BLOB_IN_NTFS_VOLUME:
@@ -464,6 +474,9 @@ cmp_blobs_by_sequential_order(const void *p1, const void *p2)
 #ifdef __WIN32__
 	case BLOB_IN_WINDOWS_FILE:
 		return cmp_windows_files(blob1->windows_file, blob2->windows_file);
+#else
+	case BLOB_IN_UNIX_FILE:
+		return cmp_unix_files(blob1->unix_file, blob2->unix_file);
 #endif
 #ifdef WITH_NTFS_3G
 	case BLOB_IN_NTFS_VOLUME:
@@ -750,7 +763,7 @@ free_solid_rdescs(struct wim_resource_descriptor **rdescs, size_t num_rdescs)
 		for (size_t i = 0; i < num_rdescs; i++) {
 			if (list_empty(&rdescs[i]->blob_list)) {
 				rdescs[i]->wim->refcnt--;
-				FREE(rdescs[i]);
+				free_wim_resource_descriptor(rdescs[i]);
 			}
 		}
 		FREE(rdescs);
@@ -1121,6 +1134,41 @@ out_free_buf:
 	return ret;
 }
 
+/*
+ * Call @visitor on the resource header of each resource referenced by the
+ * on-disk blob table @buf, which is @size bytes long.  Entries for
+ * blobs in solid resources are skipped, since their offsets are relative to the
+ * solid resource; the solid resources themselves are visited through their
+ * resource entries.  Any changes the visitor makes to a resource header are
+ * written back into the buffer.
+ */
+int
+for_each_raw_blob_table_resource(void *buf, size_t size, u32 wim_version,
+				 int (*visitor)(struct wim_reshdr *, void *),
+				 void *ctx)
+{
+	struct blob_descriptor_disk *entries = buf;
+	size_t num_entries = size / sizeof(struct blob_descriptor_disk);
+
+	for (size_t i = 0; i < num_entries; i++) {
+		struct wim_reshdr reshdr;
+		int ret;
+
+		get_wim_reshdr(&entries[i].reshdr, &reshdr);
+
+		if (wim_version != WIM_VERSION_DEFAULT &&
+		    (reshdr.flags & WIM_RESHDR_FLAG_SOLID) &&
+		    reshdr.uncompressed_size != SOLID_RESOURCE_MAGIC_NUMBER)
+			continue;
+
+		ret = visitor(&reshdr, ctx);
+		if (ret)
+			return ret;
+		put_wim_reshdr(&reshdr, &entries[i].reshdr);
+	}
+	return 0;
+}
+
 static void
 write_blob_descriptor(struct blob_descriptor_disk *disk_entry,
 		      const struct wim_reshdr *out_reshdr,
@@ -1186,7 +1234,7 @@ write_blob_table_from_blob_list(struct list_head *blob_list,
 			if (blob->out_res_offset_in_wim != prev_res_offset_in_wim) {
 				/* Put the resource entry for solid resource  */
 				tmp_reshdr.offset_in_wim = blob->out_res_offset_in_wim;
-				tmp_reshdr.size_in_wim = blob->out_res_size_in_wim;
+				tmp_reshdr.size_in_wim = blob->out_reshdr.size_in_wim;
 				tmp_reshdr.uncompressed_size = SOLID_RESOURCE_MAGIC_NUMBER;
 				tmp_reshdr.flags = WIM_RESHDR_FLAG_SOLID;
 
@@ -1196,10 +1244,12 @@ write_blob_table_from_blob_list(struct list_head *blob_list,
 				logical_offset += prev_uncompressed_size;
 
 				prev_res_offset_in_wim = blob->out_res_offset_in_wim;
-				prev_uncompressed_size = blob->out_res_uncompressed_size;
+				prev_uncompressed_size = blob->out_reshdr.uncompressed_size;
 			}
 			tmp_reshdr = blob->out_reshdr;
 			tmp_reshdr.offset_in_wim += logical_offset;
+			tmp_reshdr.size_in_wim = blob->size;
+			tmp_reshdr.uncompressed_size = 0;
 			write_blob_descriptor(table_buf_ptr++, &tmp_reshdr,
 					      part_number, blob->out_refcnt, blob->hash);
 		} else {
@@ -1220,7 +1270,8 @@ write_blob_table_from_blob_list(struct list_head *blob_list,
 					     0,
 					     out_reshdr,
 					     NULL,
-					     write_resource_flags);
+					     write_resource_flags,
+					     1);
 	FREE(table_buf);
 	return ret;
 }
@@ -0,0 +1,1190 @@
+/*
+ * compact.c
+ *
+ * Crash-safe in-place compaction of WIM files (WIMLIB_WRITE_FLAG_COMPACT).
+ *
+ * The WIM file is first updated by a normal in-place append, so that it is
+ * valid and its blob table lists exactly the resources that must be kept.
+ * Then those resources are shifted towards the beginning of the file to fill
+ * the holes, and a new blob table and new XML data are written after them.
+ *
+ * Before anything in the WIM file is overwritten, the complete plan is written
+ * to a journal file next to the WIM file: the list of moves, the new blob table
+ * and XML data (the "tail"), and the new WIM header.  While data is being
+ * moved, checkpoints in the journal record how far the moves have progressed.
+ * If the compaction is interrupted, then the WIM file is left with
+ * WIM_HDR_FLAG_WRITE_IN_PROGRESS set, and the next time it is opened with
+ * write access, the compaction is resumed from the last checkpoint.
+ *
+ * Data only ever moves towards lower offsets, and the moves are done in order
+ * of increasing offset, so the data moved by the early moves is never needed
+ * again by the later moves.  However, a move must not be repeated after its
+ * source has been partially overwritten.  So before anything is written over
+ * the source of a move that is not yet recorded as done, the WIM file is synced
+ * and a checkpoint is written.  A resource that only moves a short distance
+ * would need a checkpoint every few bytes, so such data is instead first saved
+ * into a staging area in the journal, which makes it safe to overwrite its
+ * source right away.
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wimlib/assert.h"
+#include "wimlib/blob_table.h"
+#include "wimlib/compact.h"
+#include "wimlib/endianness.h"
+#include "wimlib/error.h"
+#include "wimlib/file_io.h"
+#include "wimlib/header.h"
+#include "wimlib/integrity.h"
+#include "wimlib/paths.h"
+#include "wimlib/resource.h"
+#include "wimlib/sha1.h"
+#include "wimlib/util.h"
+#include "wimlib/wim.h"
+#include "wimlib/write.h"
+#include "wimlib/xml.h"
+
+/* Suffix appended to the path of the WIM file to get the path of the journal  */
+#define JOURNAL_SUFFIX		T(".compact")
+
+#define JOURNAL_MAGIC		"WLCOMPJ"
+#define JOURNAL_VERSION		1
+
+/* The WIM file needs a new integrity table after the compaction.  */
+#define JOURNAL_FLAG_INTEGRITY	0x00000001
+
+/* Layout of the journal file.  The moves are stored at JOURNAL_DATA_OFFSET,
+ * immediately followed by the tail.  The staging area begins at the next
+ * multiple of JOURNAL_ALIGN.  */
+#define JOURNAL_CHECKPOINTS_OFFSET	512
+#define JOURNAL_ORIG_HDR_OFFSET		1024
+#define JOURNAL_FINAL_HDR_OFFSET	1280
+#define JOURNAL_DATA_OFFSET		1536
+#define JOURNAL_ALIGN			4096
+
+/* Maximum amount of data moved at a time; this is also the size of the staging
+ * area.  */
+#define COMPACT_STEP_SIZE		(8 << 20)
+
+/* If less than this much data can be moved directly after a checkpoint, then
+ * stage the data in the journal instead.  */
+#define COMPACT_MIN_DIRECT_SIZE		(1 << 20)
+
+struct journal_header_disk {
+	u8 magic[8];
+	le32 version;
+	le32 flags;
+	le64 num_moves;
+
+	/* Offset and size of the new blob table and XML data in the WIM file */
+	le64 tail_offset;
+	le64 tail_size;
+
+	/* SHA-1 message digest of the above fields and of the journal from
+	 * JOURNAL_ORIG_HDR_OFFSET through the end of the tail  */
+	u8 hash[SHA1_HASH_SIZE];
+} _packed_attribute;
+
+struct journal_move_disk {
+	le64 src;
+	le64 dst;
+	le64 size;
+} _packed_attribute;
+
+/*
+ * A checkpoint records that the moves have been done up to position @done.  If
+ * @staged_size is nonzero, then the data for the following @staged_size bytes of
+ * moves has been saved in the staging area and may have been partially written
+ * to its destination.  There are two checkpoint slots which are used
+ * alternately, so the previous checkpoint stays intact while the next one is
+ * being written.
+ */
+struct journal_checkpoint_disk {
+	le64 seq;
+	le64 done;
+	le64 staged_size;
+	u8 staged_hash[SHA1_HASH_SIZE];
+	u8 hash[SHA1_HASH_SIZE];
+} _packed_attribute;
+
+/* A contiguous range of data to be moved to a lower offset in the WIM file  */
+struct compact_move {
+	u64 src;
+	u64 dst;
+	u64 size;
+
+	/* Position of the first byte of this move in the sequence of all moves
+	 */
+	u64 pos;
+};
+
+struct compaction {
+	struct filedes *wim_fd;
+	const tchar *wim_filename;
+	struct filedes journal_fd;
+	const tchar *journal_path;
+	u32 flags;
+
+	struct compact_move *moves;
+	size_t num_moves;
+	u64 total_size;
+
+	u64 tail_offset;
+	u64 tail_size;
+
+	/* The most recent checkpoint  */
+	u64 seq;
+	u64 done;
+	bool staged;
+
+	/* Buffer of size COMPACT_STEP_SIZE  */
+	u8 *buf;
+};
+
+/* A resource listed in the blob table, and where it will end up  */
+struct compact_extent {
+	u64 offset;
+	u64 size;
+	u64 new_offset;
+};
+
+struct extent_list {
+	struct compact_extent *extents;
+	size_t num_extents;
+	size_t num_alloc;
+};
+
+#define JOURNAL_PATH_LEN(wim_filename) \
+	(tstrlen(wim_filename) + ARRAY_LEN(JOURNAL_SUFFIX))
+
+static void
+get_journal_path(const tchar *wim_filename, tchar *path)
+{
+	size_t len = tstrlen(wim_filename);
+
+	tmemcpy(path, wim_filename, len);
+	tmemcpy(path + len, JOURNAL_SUFFIX, ARRAY_LEN(JOURNAL_SUFFIX));
+}
+
+static u64
+journal_tail_offset(const struct compaction *c)
+{
+	return JOURNAL_DATA_OFFSET +
+		c->num_moves * sizeof(struct journal_move_disk);
+}
+
+static u64
+journal_staging_offset(const struct compaction *c)
+{
+	return ALIGN(journal_tail_offset(c) + c->tail_size, JOURNAL_ALIGN);
+}
+
+static int
+sync_file(struct filedes *fd, const tchar *path)
+{
+	if (fsync(fd->fd)) {
+		ERROR_WITH_ERRNO("Error syncing data to \"%"TS"\"", path);
+		return WIMLIB_ERR_WRITE;
+	}
+	return 0;
+}
+
+/* Make the creation of the file at @path durable by syncing the directory that
+ * contains it.  */
+static int
+sync_parent_directory(const tchar *path)
+{
+#ifdef __WIN32__
+	/* Not possible, nor needed, on Windows.  */
+	return 0;
+#else
+	size_t dir_len = path_basename(path) - path;
+	char dir[dir_len + 2];
+	int fd;
+	int ret = 0;
+
+	if (dir_len == 0) {
+		strcpy(dir, ".");
+	} else {
+		memcpy(dir, path, dir_len);
+		dir[dir_len] = '\0';
+	}
+	fd = open(dir, O_RDONLY);
+	if (fd < 0) {
+		ERROR_WITH_ERRNO("Can't open directory \"%s\"", dir);
+		return WIMLIB_ERR_OPEN;
+	}
+	if (fsync(fd)) {
+		ERROR_WITH_ERRNO("Error syncing directory \"%s\"", dir);
+		ret = WIMLIB_ERR_WRITE;
+	}
+	close(fd);
+	return ret;
+#endif
+}
+
+#ifdef ENABLE_TEST_SUPPORT
+/* For testing resumption, the environment variable
+ * WIMLIB_TEST_COMPACT_INTERRUPT can be set to a number of checkpoints after
+ * which the compaction fails as if the process had crashed.  */
+static bool
+simulate_crash(const struct compaction *c)
+{
+	const tchar *s = tgetenv(T("WIMLIB_TEST_COMPACT_INTERRUPT"));
+
+	if (!s || c->seq < tstrtoul(s, NULL, 10))
+		return false;
+	ERROR("Simulating a crash during the compaction of \"%"TS"\"",
+	      c->wim_filename);
+	return true;
+}
+#else
+static inline bool
+simulate_crash(const struct compaction *c)
+{
+	return false;
+}
+#endif
+
+/* Return the index of the move containing position @pos.  */
+static size_t
+find_move(const struct compaction *c, u64 pos)
+{
+	size_t l = 0;
+	size_t r = c->num_moves;
+
+	while (r - l > 1) {
+		size_t m = l + (r - l) / 2;
+
+		if (c->moves[m].pos <= pos)
+			l = m;
+		else
+			r = m;
+	}
+	return l;
+}
+
+/* Return the offset in the WIM file of the source of the byte at position
+ * @pos, or UINT64_MAX if @pos is past the end of the moves.  */
+static u64
+src_offset(const struct compaction *c, u64 pos)
+{
+	const struct compact_move *m;
+
+	if (pos >= c->total_size)
+		return UINT64_MAX;
+	m = &c->moves[find_move(c, pos)];
+	return m->src + (pos - m->pos);
+}
+
+/* Return how many of the @max bytes of moves beginning at position @pos can be
+ * done without writing at or past offset @limit in the WIM file.  */
+static u64
+direct_move_size(const struct compaction *c, u64 pos, u64 max, u64 limit)
+{
+	u64 size = 0;
+
+	for (size_t i = find_move(c, pos); size < max; i++) {
+		const struct compact_move *m = &c->moves[i];
+		u64 offset = pos + size - m->pos;
+		u64 n = min(m->size - offset, max - size);
+		u64 dst = m->dst + offset;
+
+		if (dst + n > limit) {
+			if (dst < limit)
+				size += limit - dst;
+			break;
+		}
+		size += n;
+	}
+	return size;
+}
+
+/* Read the sources (or write the destinations, if @write) of the @size bytes
+ * of moves beginning at position @pos from (or to) c->buf.  */
+static int
+transfer_move_data(struct compaction *c, u64 pos, u64 size, bool write)
+{
+	u8 *p = c->buf;
+	int ret;
+
+	for (size_t i = find_move(c, pos); size != 0; i++) {
+		const struct compact_move *m = &c->moves[i];
+		u64 offset = pos - m->pos;
+		u64 n = min(m->size - offset, size);
+
+		if (write) {
+			ret = full_pwrite(c->wim_fd, p, n, m->dst + offset);
+			if (ret) {
+				ERROR_WITH_ERRNO("Error writing to \"%"TS"\"",
+						 c->wim_filename);
+				return ret;
+			}
+		} else {
+			ret = full_pread(c->wim_fd, p, n, m->src + offset);
+			if (ret) {
+				ERROR_WITH_ERRNO("Error reading from \"%"TS"\"",
+						 c->wim_filename);
+				return ret;
+			}
+		}
+		p += n;
+		pos += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/* Record that the moves are done up to position @done, optionally staging the
+ * following @staged_size bytes of moves, which must be in c->buf.  */
+static int
+write_checkpoint(struct compaction *c, u64 done, u64 staged_size)
+{
+	struct journal_checkpoint_disk cp;
+	int ret;
+
+	if (simulate_crash(c))
+		return WIMLIB_ERR_WRITE;
+
+	/* The data must be on disk before it is recorded as moved.  */
+	ret = sync_file(c->wim_fd, c->wim_filename);
+	if (ret)
+		return ret;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.seq = cpu_to_le64(++c->seq);
+	cp.done = cpu_to_le64(done);
+	cp.staged_size = cpu_to_le64(staged_size);
+	if (staged_size) {
+		sha1_buffer(c->buf, staged_size, cp.staged_hash);
+		ret = full_pwrite(&c->journal_fd, c->buf, staged_size,
+				  journal_staging_offset(c));
+		if (ret)
+			goto write_error;
+	}
+	sha1_buffer(&cp, offsetof(struct journal_checkpoint_disk, hash), cp.hash);
+	ret = full_pwrite(&c->journal_fd, &cp, sizeof(cp),
+			  JOURNAL_CHECKPOINTS_OFFSET + (c->seq & 1) * sizeof(cp));
+	if (ret)
+		goto write_error;
+	ret = sync_file(&c->journal_fd, c->journal_path);
+	if (ret)
+		return ret;
+	c->done = done;
+	c->staged = (staged_size != 0);
+	return 0;
+
+write_error:
+	ERROR_WITH_ERRNO("Error writing to \"%"TS"\"", c->journal_path);
+	return ret;
+}
+
+/* Do the moves from position @pos onwards.  c->done and c->staged must
+ * describe the most recent checkpoint.  */
+static int
+do_moves(struct compaction *c, u64 pos)
+{
+	/* Writes below @limit cannot overwrite the source of any move that
+	 * isn't recorded as done.  */
+	u64 limit = src_offset(c, c->done);
+	int ret;
+
+	while (pos < c->total_size) {
+		u64 size = min((u64)COMPACT_STEP_SIZE, c->total_size - pos);
+		u64 direct = direct_move_size(c, pos, size, limit);
+		bool stage = false;
+
+		if (direct < size) {
+			/* Record the progress, which raises the limit.  The
+			 * staging area may only be reused when the current
+			 * checkpoint doesn't refer to it.  */
+			if (pos != c->done || c->staged) {
+				ret = write_checkpoint(c, pos, 0);
+				if (ret)
+					return ret;
+				limit = src_offset(c, pos);
+				direct = direct_move_size(c, pos, size, limit);
+			}
+			if (direct >= COMPACT_MIN_DIRECT_SIZE)
+				size = min(size, direct);
+			else if (direct < size)
+				stage = true;
+		}
+
+		ret = transfer_move_data(c, pos, size, false);
+		if (ret)
+			return ret;
+		if (stage) {
+			ret = write_checkpoint(c, pos, size);
+			if (ret)
+				return ret;
+		}
+		ret = transfer_move_data(c, pos, size, true);
+		if (ret)
+			return ret;
+		pos += size;
+	}
+
+	if (c->done != c->total_size || c->staged)
+		return write_checkpoint(c, c->total_size, 0);
+	return 0;
+}
+
+/*
+ * After all moves are done, write the tail and the new header to the WIM file,
+ * truncate it, and delete the journal.  The tail must be on disk before the
+ * header that points to it, and the journal may only be deleted once the WIM
+ * file is complete on disk.  Until then, the compaction can be finished again
+ * from the journal.
+ */
+static int
+finish_compaction(struct compaction *c)
+{
+	u64 tail_end = c->tail_offset + c->tail_size;
+	u8 hdr[WIM_HEADER_DISK_SIZE];
+	int ret;
+
+	if (simulate_crash(c))
+		return WIMLIB_ERR_WRITE;
+
+	for (u64 offset = 0; offset < c->tail_size; ) {
+		u64 n = min((u64)COMPACT_STEP_SIZE, c->tail_size - offset);
+
+		ret = full_pread(&c->journal_fd, c->buf, n,
+				 journal_tail_offset(c) + offset);
+		if (ret)
+			goto read_error;
+		ret = full_pwrite(c->wim_fd, c->buf, n, c->tail_offset + offset);
+		if (ret)
+			goto write_error;
+		offset += n;
+	}
+	ret = sync_file(c->wim_fd, c->wim_filename);
+	if (ret)
+		return ret;
+
+	ret = full_pread(&c->journal_fd, hdr, sizeof(hdr),
+			 JOURNAL_FINAL_HDR_OFFSET);
+	if (ret)
+		goto read_error;
+	ret = full_pwrite(c->wim_fd, hdr, sizeof(hdr), 0);
+	if (ret)
+		goto write_error;
+
+	if (ftruncate(c->wim_fd->fd, tail_end) &&
+	    errno != EINVAL) /* allow untruncatable files, e.g. block devices */
+	{
+		ERROR_WITH_ERRNO("Failed to truncate \"%"TS"\"",
+				 c->wim_filename);
+		return WIMLIB_ERR_WRITE;
+	}
+	ret = sync_file(c->wim_fd, c->wim_filename);
+	if (ret)
+		return ret;
+
+	filedes_close(&c->journal_fd);
+	filedes_invalidate(&c->journal_fd);
+	if (tunlink(c->journal_path))
+		WARNING_WITH_ERRNO("Failed to delete \"%"TS"\"", c->journal_path);
+	return 0;
+
+read_error:
+	ERROR_WITH_ERRNO("Error reading from \"%"TS"\"", c->journal_path);
+	return ret;
+
+write_error:
+	ERROR_WITH_ERRNO("Error writing to \"%"TS"\"", c->wim_filename);
+	return ret;
+}
+
+/* Append a new integrity table to the compacted WIM file open at wim->out_fd,
+ * whose header is wim->out_hdr.  */
+static int
+add_integrity_table(WIMStruct *wim, u64 end)
+{
+	int ret;
+
+	if (filedes_seek(&wim->out_fd, end) == -1) {
+		ERROR_WITH_ERRNO("Can't seek to end of WIM");
+		return WIMLIB_ERR_WRITE;
+	}
+	ret = write_integrity_table(wim,
+				    wim->out_hdr.blob_table_reshdr.offset_in_wim +
+				    wim->out_hdr.blob_table_reshdr.size_in_wim,
+				    0, NULL);
+	if (ret)
+		return ret;
+	ret = write_wim_header(&wim->out_hdr, &wim->out_fd, 0);
+	if (ret)
+		return ret;
+	return sync_file(&wim->out_fd, wim->filename);
+}
+
+/* Compute the SHA-1 message digest that protects the journal's contents.  */
+static int
+hash_journal(struct compaction *c, const struct journal_header_disk *jhdr,
+	     u8 hash[SHA1_HASH_SIZE])
+{
+	u64 end = journal_tail_offset(c) + c->tail_size;
+	SHA_CTX ctx;
+	int ret;
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, jhdr, offsetof(struct journal_header_disk, hash));
+	for (u64 offset = JOURNAL_ORIG_HDR_OFFSET; offset < end; ) {
+		u64 n = min((u64)COMPACT_STEP_SIZE, end - offset);
+
+		ret = full_pread(&c->journal_fd, c->buf, n, offset);
+		if (ret)
+			return ret;
+		sha1_update(&ctx, c->buf, n);
+		offset += n;
+	}
+	sha1_final(hash, &ctx);
+	return 0;
+}
+
+static int
+add_extent(struct wim_reshdr *reshdr, void *_list)
+{
+	struct extent_list *list = _list;
+
+	if (reshdr->size_in_wim == 0)
+		return 0;
+
+	if (list->num_extents == list->num_alloc) {
+		size_t num_alloc = max(list->num_alloc * 2, 64);
+		struct compact_extent *extents;
+
+		extents = REALLOC(list->extents,
+				  num_alloc * sizeof(list->extents[0]));
+		if (!extents)
+			return WIMLIB_ERR_NOMEM;
+		list->extents = extents;
+		list->num_alloc = num_alloc;
+	}
+	list->extents[list->num_extents++] = (struct compact_extent) {
+		.offset = reshdr->offset_in_wim,
+		.size = reshdr->size_in_wim,
+	};
+	return 0;
+}
+
+static int
+cmp_extents_by_offset(const void *p1, const void *p2)
+{
+	const struct compact_extent *e1 = p1, *e2 = p2;
+
+	return cmp_u64(e1->offset, e2->offset);
+}
+
+static int
+relocate_reshdr(struct wim_reshdr *reshdr, void *_list)
+{
+	const struct extent_list *list = _list;
+	const struct compact_extent key = { .offset = reshdr->offset_in_wim };
+	const struct compact_extent *e;
+
+	if (reshdr->size_in_wim == 0)
+		return 0;
+
+	e = bsearch(&key, list->extents, list->num_extents,
+		    sizeof(list->extents[0]), cmp_extents_by_offset);
+	if (!e || e->size != reshdr->size_in_wim)
+		return WIMLIB_ERR_COMPACTION_NOT_POSSIBLE;
+	reshdr->offset_in_wim = e->new_offset;
+	return 0;
+}
+
+/*
+ * Plan the compaction of the resources in @list, which must end before
+ * @data_end.  Set the new offset of each resource, set up the moves, and set
+ * the offset of the tail.
+ */
+static int
+plan_compaction(struct compaction *c, struct extent_list *list, u64 data_end)
+{
+	struct compact_extent *extents;
+	size_t n = 0;
+	u64 dst = WIM_HEADER_DISK_SIZE;
+
+	qsort(list->extents, list->num_extents, sizeof(list->extents[0]),
+	      cmp_extents_by_offset);
+
+	/* Merge duplicate entries, and make sure that no resources overlap
+	 * each other or the header, blob table, or XML data.  */
+	extents = list->extents;
+	for (size_t i = 0; i < list->num_extents; i++) {
+		if (n != 0 && extents[i].offset == extents[n - 1].offset &&
+		    extents[i].size == extents[n - 1].size)
+			continue;
+		if (extents[i].offset < (n ? extents[n - 1].offset +
+					      extents[n - 1].size :
+					      WIM_HEADER_DISK_SIZE) ||
+		    extents[i].offset + extents[i].size > data_end)
+		{
+			WARNING("WIM file contains overlapping or misplaced "
+				"resources!  Compaction is not possible.");
+			return WIMLIB_ERR_COMPACTION_NOT_POSSIBLE;
+		}
+		extents[n++] = extents[i];
+	}
+	list->num_extents = n;
+
+	c->moves = MALLOC(max(n, 1) * sizeof(c->moves[0]));
+	if (!c->moves)
+		return WIMLIB_ERR_NOMEM;
+
+	/* Pack the resources together, in order.  Resources that are already
+	 * in place don't need to be moved, and adjacent resources that move by
+	 * the same distance are moved together.  */
+	for (size_t i = 0; i < n; i++) {
+		struct compact_extent *e = &extents[i];
+		struct compact_move *prev = c->num_moves ?
+					    &c->moves[c->num_moves - 1] : NULL;
+
+		e->new_offset = dst;
+		if (e->offset != dst) {
+			if (prev && prev->src + prev->size == e->offset &&
+			    prev->dst + prev->size == dst)
+			{
+				prev->size += e->size;
+			} else {
+				c->moves[c->num_moves++] = (struct compact_move) {
+					.src = e->offset,
+					.dst = dst,
+					.size = e->size,
+					.pos = c->total_size,
+				};
+			}
+			c->total_size += e->size;
+		}
+		dst += e->size;
+	}
+	c->tail_offset = dst;
+	return 0;
+}
+
+/* Write the moves to the journal.  */
+static int
+write_journal_moves(struct compaction *c)
+{
+	const size_t per_step = COMPACT_STEP_SIZE / sizeof(struct journal_move_disk);
+	struct journal_move_disk *disk_moves = (void *)c->buf;
+	int ret;
+
+	for (size_t i = 0; i < c->num_moves; i += per_step) {
+		size_t n = min(c->num_moves - i, per_step);
+
+		for (size_t j = 0; j < n; j++) {
+			disk_moves[j].src = cpu_to_le64(c->moves[i + j].src);
+			disk_moves[j].dst = cpu_to_le64(c->moves[i + j].dst);
+			disk_moves[j].size = cpu_to_le64(c->moves[i + j].size);
+		}
+		ret = full_pwrite(&c->journal_fd, disk_moves,
+				  n * sizeof(disk_moves[0]),
+				  JOURNAL_DATA_OFFSET + i * sizeof(disk_moves[0]));
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* Read the moves from the journal.  */
+static int
+read_journal_moves(struct compaction *c)
+{
+	const size_t per_step = COMPACT_STEP_SIZE / sizeof(struct journal_move_disk);
+	const struct journal_move_disk *disk_moves = (const void *)c->buf;
+	int ret;
+
+	c->moves = MALLOC(max(c->num_moves, 1) * sizeof(c->moves[0]));
+	if (!c->moves)
+		return WIMLIB_ERR_NOMEM;
+
+	for (size_t i = 0; i < c->num_moves; i += per_step) {
+		size_t n = min(c->num_moves - i, per_step);
+
+		ret = full_pread(&c->journal_fd, c->buf,
+				 n * sizeof(disk_moves[0]),
+				 JOURNAL_DATA_OFFSET + i * sizeof(disk_moves[0]));
+		if (ret)
+			return ret;
+		for (size_t j = 0; j < n; j++) {
+			struct compact_move *m = &c->moves[i + j];
+
+			m->src = le64_to_cpu(disk_moves[j].src);
+			m->dst = le64_to_cpu(disk_moves[j].dst);
+			m->size = le64_to_cpu(disk_moves[j].size);
+			m->pos = c->total_size;
+			c->total_size += m->size;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write the journal for a compaction that has been planned, except for the
+ * first checkpoint.  The new blob table is @blob_table, and the new header
+ * (whose blob table offset and boot metadata entry must already be set) is
+ * @hdr.  The new XML data is generated here.
+ */
+static int
+write_journal(WIMStruct *wim, struct compaction *c,
+	      const void *blob_table, u64 blob_table_size,
+	      struct wim_header *hdr, const u8 orig_hdr[WIM_HEADER_DISK_SIZE])
+{
+	struct journal_header_disk jhdr;
+	struct filedes wim_fd;
+	int ret;
+
+	ret = full_pwrite(&c->journal_fd, orig_hdr, WIM_HEADER_DISK_SIZE,
+			  JOURNAL_ORIG_HDR_OFFSET);
+	if (ret)
+		goto write_error;
+
+	ret = write_journal_moves(c);
+	if (ret)
+		goto write_error;
+
+	ret = full_pwrite(&c->journal_fd, blob_table, blob_table_size,
+			  journal_tail_offset(c));
+	if (ret)
+		goto write_error;
+
+	/* The XML data is written with the same code that normally writes it
+	 * to the WIM file, so point wim->out_fd at the journal temporarily.  */
+	if (filedes_seek(&c->journal_fd,
+			 journal_tail_offset(c) + blob_table_size) == -1)
+	{
+		ret = WIMLIB_ERR_WRITE;
+		goto write_error;
+	}
+	wim_fd = wim->out_fd;
+	wim->out_fd = c->journal_fd;
+	ret = write_wim_xml_data(wim, WIMLIB_ALL_IMAGES,
+				 c->tail_offset + blob_table_size,
+				 &hdr->xml_data_reshdr, 0);
+	c->journal_fd = wim->out_fd;
+	wim->out_fd = wim_fd;
+	if (ret)
+		return ret;
+	hdr->xml_data_reshdr.offset_in_wim = c->tail_offset + blob_table_size;
+	c->tail_size = blob_table_size + hdr->xml_data_reshdr.size_in_wim;
+
+	ret = write_wim_header(hdr, &c->journal_fd, JOURNAL_FINAL_HDR_OFFSET);
+	if (ret)
+		return ret;
+
+	memset(&jhdr, 0, sizeof(jhdr));
+	memcpy(jhdr.magic, JOURNAL_MAGIC, sizeof(jhdr.magic));
+	jhdr.version = cpu_to_le32(JOURNAL_VERSION);
+	jhdr.flags = cpu_to_le32(c->flags);
+	jhdr.num_moves = cpu_to_le64(c->num_moves);
+	jhdr.tail_offset = cpu_to_le64(c->tail_offset);
+	jhdr.tail_size = cpu_to_le64(c->tail_size);
+	ret = hash_journal(c, &jhdr, jhdr.hash);
+	if (ret) {
+		ERROR_WITH_ERRNO("Error reading from \"%"TS"\"",
+				 c->journal_path);
+		return ret;
+	}
+	ret = full_pwrite(&c->journal_fd, &jhdr, sizeof(jhdr), 0);
+	if (ret)
+		goto write_error;
+	return 0;
+
+write_error:
+	ERROR_WITH_ERRNO("Error writing to \"%"TS"\"", c->journal_path);
+	return ret;
+}
+
+/*
+ * Compact the WIM file of @wim in place, in a way that can be resumed if it is
+ * interrupted.  This must be called right after the WIM file was updated by an
+ * in-place append, while it's still locked; wim->out_hdr must be the header
+ * that was written.  @write_flags may contain WIMLIB_WRITE_FLAG_CHECK_INTEGRITY
+ * and WIMLIB_WRITE_FLAG_FSYNC.
+ *
+ * Returns WIMLIB_ERR_COMPACTION_NOT_POSSIBLE, without changing the WIM file,
+ * if its layout doesn't allow it to be compacted.
+ */
+int
+compact_wim_file(WIMStruct *wim, int write_flags)
+{
+	tchar journal_path[JOURNAL_PATH_LEN(wim->filename)];
+	struct compaction c = {
+		.wim_fd = &wim->out_fd,
+		.wim_filename = wim->filename,
+		.journal_path = journal_path,
+	};
+	struct extent_list list = { 0 };
+	struct wim_header hdr = wim->out_hdr;
+	u8 orig_hdr[WIM_HEADER_DISK_SIZE];
+	void *blob_table = NULL;
+	u64 blob_table_size = hdr.blob_table_reshdr.uncompressed_size;
+	u64 data_end;
+	bool hdr_flag_set = false;
+	bool moving = false;
+	int raw_fd;
+	int ret;
+
+	get_journal_path(wim->filename, journal_path);
+	filedes_invalidate(&c.journal_fd);
+
+	raw_fd = topen(wim->filename, O_RDWR | O_BINARY);
+	if (raw_fd < 0) {
+		ERROR_WITH_ERRNO("Failed to open \"%"TS"\" for writing",
+				 wim->filename);
+		return WIMLIB_ERR_OPEN;
+	}
+	filedes_init(&wim->out_fd, raw_fd);
+
+	ret = WIMLIB_ERR_NOMEM;
+	c.buf = MALLOC(COMPACT_STEP_SIZE);
+	if (!c.buf)
+		goto out;
+
+	/* Find the resources that must be kept, and decide where to put them.
+	 */
+	ret = wim_reshdr_to_data(&hdr.blob_table_reshdr, wim, &blob_table);
+	if (ret)
+		goto out;
+	ret = for_each_raw_blob_table_resource(blob_table, blob_table_size,
+					       hdr.wim_version, add_extent,
+					       &list);
+	if (ret)
+		goto out;
+	data_end = min(hdr.blob_table_reshdr.offset_in_wim,
+		       hdr.xml_data_reshdr.offset_in_wim);
+	ret = plan_compaction(&c, &list, data_end);
+	if (ret)
+		goto out;
+
+	/* Prepare the new blob table and header.  */
+	ret = for_each_raw_blob_table_resource(blob_table, blob_table_size,
+					       hdr.wim_version, relocate_reshdr,
+					       &list);
+	if (ret)
+		goto out;
+	ret = relocate_reshdr(&hdr.boot_metadata_reshdr, &list);
+	if (ret)
+		goto out;
+	hdr.blob_table_reshdr.offset_in_wim = c.tail_offset;
+	zero_reshdr(&hdr.integrity_table_reshdr);
+	hdr.flags &= ~WIM_HDR_FLAG_WRITE_IN_PROGRESS;
+	if (write_flags & WIMLIB_WRITE_FLAG_CHECK_INTEGRITY)
+		c.flags |= JOURNAL_FLAG_INTEGRITY;
+
+	/* Mark the WIM file as being written.  The journal records the header
+	 * in this state, which is how it is recognized as belonging to the WIM
+	 * file if the compaction is interrupted.  */
+	ret = write_wim_header_flags(wim->out_hdr.flags |
+				     WIM_HDR_FLAG_WRITE_IN_PROGRESS,
+				     &wim->out_fd);
+	if (ret) {
+		ERROR_WITH_ERRNO("Error updating WIM header flags");
+		goto out;
+	}
+	hdr_flag_set = true;
+	ret = full_pread(&wim->out_fd, orig_hdr, sizeof(orig_hdr), 0);
+	if (ret) {
+		ERROR_WITH_ERRNO("Error reading header of \"%"TS"\"",
+				 wim->filename);
+		goto out;
+	}
+
+	raw_fd = topen(journal_path, O_RDWR | O_CREAT | O_TRUNC | O_BINARY,
+		       0644);
+	if (raw_fd < 0) {
+		ERROR_WITH_ERRNO("Failed to create \"%"TS"\"", journal_path);
+		ret = WIMLIB_ERR_OPEN;
+		goto out;
+	}
+	filedes_init(&c.journal_fd, raw_fd);
+
+	ret = write_journal(wim, &c, blob_table, blob_table_size, &hdr,
+			    orig_hdr);
+	if (ret)
+		goto out;
+
+	/* The journal must still be found after a crash.  */
+	ret = sync_parent_directory(journal_path);
+	if (ret)
+		goto out;
+
+	/* The first checkpoint also makes the journal and the header flag
+	 * durable.  From here on, the compaction can only go forwards.  */
+	ret = write_checkpoint(&c, 0, 0);
+	if (ret)
+		goto out;
+	moving = true;
+
+	ret = do_moves(&c, 0);
+	if (ret)
+		goto out;
+	ret = finish_compaction(&c);
+	if (ret)
+		goto out;
+
+	wim->out_hdr = hdr;
+	if (c.flags & JOURNAL_FLAG_INTEGRITY) {
+		ret = add_integrity_table(wim, c.tail_offset + c.tail_size);
+		if (ret)
+			goto out;
+	}
+	ret = 0;
+out:
+	if (ret && moving) {
+		ERROR("The compaction of \"%"TS"\" was interrupted.  It will be "
+		      "finished\n"
+		      "        the next time the WIM file is opened for "
+		      "writing.", wim->filename);
+	} else if (ret && hdr_flag_set) {
+		(void)write_wim_header_flags(wim->out_hdr.flags, &wim->out_fd);
+		if (filedes_valid(&c.journal_fd)) {
+			filedes_close(&c.journal_fd);
+			filedes_invalidate(&c.journal_fd);
+			tunlink(journal_path);
+		}
+	}
+	if (moving)
+		wim_new_data_serial(wim);
+	if (filedes_valid(&c.journal_fd))
+		filedes_close(&c.journal_fd);
+	filedes_close(&wim->out_fd);
+	filedes_invalidate(&wim->out_fd);
+	FREE(c.moves);
+	FREE(list.extents);
+	FREE(blob_table);
+	FREE(c.buf);
+	return ret;
+}
+
+/* Load the most recent valid checkpoint from the journal, and redo the writes
+ * of any data it staged.  Return the position from which to continue.  */
+static int
+load_checkpoint(struct compaction *c, u64 *pos_ret)
+{
+	struct journal_checkpoint_disk cps[2];
+	const struct journal_checkpoint_disk *cp = NULL;
+	u8 hash[SHA1_HASH_SIZE];
+	u64 staged_size;
+	int ret;
+
+	ret = full_pread(&c->journal_fd, cps, sizeof(cps),
+			 JOURNAL_CHECKPOINTS_OFFSET);
+	if (ret)
+		return ret;
+
+	for (int i = 0; i < 2; i++) {
+		sha1_buffer(&cps[i],
+			    offsetof(struct journal_checkpoint_disk, hash), hash);
+		if (hashes_equal(hash, cps[i].hash) &&
+		    le64_to_cpu(cps[i].done) <= c->total_size &&
+		    (!cp || le64_to_cpu(cps[i].seq) > le64_to_cpu(cp->seq)))
+			cp = &cps[i];
+	}
+
+	/* No valid checkpoint means the first one was never completed, so
+	 * nothing has been moved yet.  */
+	*pos_ret = 0;
+	if (!cp)
+		return 0;
+
+	c->seq = le64_to_cpu(cp->seq);
+	c->done = le64_to_cpu(cp->done);
+	*pos_ret = c->done;
+
+	/* If the staged data didn't make it to the journal intact, then its
+	 * writes to the WIM file were never started.  */
+	staged_size = le64_to_cpu(cp->staged_size);
+	if (staged_size == 0 || staged_size > COMPACT_STEP_SIZE ||
+	    staged_size > c->total_size - c->done)
+		return 0;
+	ret = full_pread(&c->journal_fd, c->buf, staged_size,
+			 journal_staging_offset(c));
+	if (ret)
+		return ret;
+	sha1_buffer(c->buf, staged_size, hash);
+	if (!hashes_equal(hash, cp->staged_hash))
+		return 0;
+
+	c->staged = true;
+	ret = transfer_move_data(c, c->done, staged_size, true);
+	if (ret)
+		return ret;
+	*pos_ret += staged_size;
+	return 0;
+}
+
+/*
+ * Called when opening a WIM file that has WIM_HDR_FLAG_WRITE_IN_PROGRESS set.
+ * If the flag was left set by an interrupted compaction, then finish the
+ * compaction (if the WIM file is being opened with write access) and set
+ * *finished_ret to true.  Otherwise, or if there is no journal or it doesn't
+ * belong to the WIM file in its current state, do nothing.
+ */
+int
+finish_interrupted_compaction(WIMStruct *wim, int open_flags,
+			      bool *finished_ret)
+{
+	tchar journal_path[JOURNAL_PATH_LEN(wim->filename)];
+	struct compaction c = {
+		.wim_fd = &wim->out_fd,
+		.wim_filename = wim->filename,
+		.journal_path = journal_path,
+	};
+	struct journal_header_disk jhdr;
+	u8 hash[SHA1_HASH_SIZE];
+	u8 journal_hdr[WIM_HEADER_DISK_SIZE];
+	u8 wim_hdr[WIM_HEADER_DISK_SIZE];
+	u64 pos;
+	int raw_fd;
+	int ret;
+
+	*finished_ret = false;
+	get_journal_path(wim->filename, journal_path);
+
+	raw_fd = topen(journal_path, O_RDWR | O_BINARY);
+	if (raw_fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		ERROR_WITH_ERRNO("Can't open \"%"TS"\"", journal_path);
+		return WIMLIB_ERR_OPEN;
+	}
+	filedes_init(&c.journal_fd, raw_fd);
+
+	ret = WIMLIB_ERR_NOMEM;
+	c.buf = MALLOC(COMPACT_STEP_SIZE);
+	if (!c.buf)
+		goto out;
+
+	/* Validate the journal, and make sure that it belongs to the WIM file
+	 * in its current state.  */
+	ret = full_pread(&c.journal_fd, &jhdr, sizeof(jhdr), 0);
+	if (ret)
+		goto invalid;
+	if (memcmp(jhdr.magic, JOURNAL_MAGIC, sizeof(jhdr.magic)) ||
+	    le32_to_cpu(jhdr.version) != JOURNAL_VERSION)
+		goto invalid;
+	c.flags = le32_to_cpu(jhdr.flags);
+	c.num_moves = le64_to_cpu(jhdr.num_moves);
+	c.tail_offset = le64_to_cpu(jhdr.tail_offset);
+	c.tail_size = le64_to_cpu(jhdr.tail_size);
+	if (c.num_moves > SIZE_MAX / sizeof(struct compact_move))
+		goto invalid;
+	ret = hash_journal(&c, &jhdr, hash);
+	if (ret || !hashes_equal(hash, jhdr.hash))
+		goto invalid;
+
+	ret = full_pread(&c.journal_fd, journal_hdr, sizeof(journal_hdr),
+			 JOURNAL_ORIG_HDR_OFFSET);
+	if (ret)
+		goto invalid;
+	ret = full_pread(&wim->in_fd, wim_hdr, sizeof(wim_hdr), 0);
+	if (ret) {
+		ERROR_WITH_ERRNO("Error reading header of \"%"TS"\"",
+				 wim->filename);
+		goto out;
+	}
+	if (memcmp(journal_hdr, wim_hdr, sizeof(wim_hdr)))
+		goto invalid;
+
+	/* A compaction that is still running holds the lock.  */
+	ret = lock_wim_for_append(wim);
+	if (ret) {
+		ERROR("\"%"TS"\" is being compacted by another process",
+		      wim->filename);
+		goto out;
+	}
+
+	if (!(open_flags & WIMLIB_OPEN_FLAG_WRITE_ACCESS)) {
+		ERROR("The compaction of \"%"TS"\" was interrupted.  Open it\n"
+		      "        with write access to finish the compaction.",
+		      wim->filename);
+		ret = WIMLIB_ERR_WIM_IS_INCOMPLETE;
+		goto out_unlock;
+	}
+
+	raw_fd = topen(wim->filename, O_RDWR | O_BINARY);
+	if (raw_fd < 0) {
+		ERROR_WITH_ERRNO("Failed to open \"%"TS"\" for writing",
+				 wim->filename);
+		ret = WIMLIB_ERR_OPEN;
+		goto out_unlock;
+	}
+	filedes_init(&wim->out_fd, raw_fd);
+
+	ret = read_journal_moves(&c);
+	if (ret)
+		goto out_close_wim;
+	ret = load_checkpoint(&c, &pos);
+	if (ret)
+		goto out_close_wim;
+	ret = do_moves(&c, pos);
+	if (ret)
+		goto out_close_wim;
+	ret = finish_compaction(&c);
+	if (ret)
+		goto out_close_wim;
+
+	WARNING("Finished the interrupted compaction of \"%"TS"\"",
+		wim->filename);
+	*finished_ret = true;
+
+	if (c.flags & JOURNAL_FLAG_INTEGRITY) {
+		if (filedes_seek(&wim->in_fd, 0) == -1) {
+			ERROR_WITH_ERRNO("Can't seek to beginning of \"%"TS"\"",
+					 wim->filename);
+			ret = WIMLIB_ERR_READ;
+			goto out_close_wim;
+		}
+		ret = read_wim_header(wim, &wim->out_hdr);
+		if (ret)
+			goto out_close_wim;
+		ret = add_integrity_table(wim, c.tail_offset + c.tail_size);
+	}
+out_close_wim:
+	filedes_close(&wim->out_fd);
+	filedes_invalidate(&wim->out_fd);
+out_unlock:
+	unlock_wim_for_append(wim);
+out:
+	if (filedes_valid(&c.journal_fd))
+		filedes_close(&c.journal_fd);
+	FREE(c.moves);
+	FREE(c.buf);
+	return ret;
+
+invalid:
+	WARNING("Ignoring \"%"TS"\", which is not a valid compaction "
+		"journal for\n"
+		"          the WIM file in its current state", journal_path);
+	ret = 0;
+	goto out;
+}
@@ -27,8 +27,12 @@
 #endif
 
 #include "wimlib.h"
+#include "wimlib/bitops.h"
+#include "wimlib/chunk_compressor.h"
 #include "wimlib/error.h"
 #include "wimlib/compressor_ops.h"
+#include "wimlib/lz_hash.h"
+#include "wimlib/unaligned.h"
 #include "wimlib/util.h"
 
 struct wimlib_compressor {
@@ -188,3 +192,137 @@ wimlib_free_compressor(struct wimlib_compressor *c)
 		FREE(c);
 	}
 }
+
+/*
+ * Detection of incompressible chunks
+ *
+ * Before a chunk is compressed for a WIM resource, chunk_is_incompressible()
+ * looks at a sample of it to guess whether compression would gain anything.  A
+ * chunk is considered incompressible if its sample has a nearly uniform byte
+ * distribution (high order-0 entropy), so that neither Huffman nor range coding
+ * could shrink it, and also contains almost no repeated 4-byte sequences, so
+ * that LZ77 matches couldn't either.  Such chunks, which are typical of JPEGs,
+ * archives, and media files, are then stored uncompressed without running the
+ * compressor on them, which would otherwise burn the full compression time for
+ * no gain.
+ */
+
+#define DEFAULT_INCOMPRESSIBLE_THRESHOLD	99
+
+/* The sample consists of evenly spaced windows of PROBE_WINDOW_SIZE bytes
+ * each: at least PROBE_MIN_WINDOWS of them, and more for large chunks so that
+ * one window is taken from every PROBE_BYTES_PER_WINDOW bytes.  Only a large
+ * enough compressible region can thus be missed by the sample.  */
+#define PROBE_WINDOW_SIZE	1024
+#define PROBE_MIN_WINDOWS	16
+#define PROBE_BYTES_PER_WINDOW	16384
+
+/* Chunks larger than this are always compressed.  Such chunks are normally
+ * those of solid resources, which mix the data of many files, so even a small
+ * compressible fraction can be worth much more than the time saved.  */
+#define PROBE_MAX_CHUNK_SIZE	(1 << 21)
+
+#define PROBE_HASH_ORDER	12
+
+static unsigned int incompressible_threshold = DEFAULT_INCOMPRESSIBLE_THRESHOLD;
+
+/* Return log2(@v), where @v > 0, in fixed point with 16 fractional bits.  */
+static u32
+log2_fixed16(u32 v)
+{
+	unsigned ilog = bsr32(v);
+	u64 m = ((u64)v << 30) >> ilog;	/* v / 2^ilog in [1, 2), Q2.30 */
+	u32 res = ilog << 16;
+
+	for (int bit = 15; bit >= 0; bit--) {
+		m = (m * m) >> 30;
+		if (m >= (u64)2 << 30) {
+			m >>= 1;
+			res |= (u32)1 << bit;
+		}
+	}
+	return res;
+}
+
+/* Return the threshold for chunk_is_incompressible() that was configured with
+ * wimlib_set_incompressible_chunk_threshold().  */
+unsigned int
+get_incompressible_chunk_threshold(void)
+{
+	return incompressible_threshold;
+}
+
+/*
+ * Guess whether compressing the @size bytes at @chunk would be a waste of time.
+ * @threshold is the minimum estimated compressed size, as a percentage of the
+ * original size, for which the chunk is considered incompressible; values above
+ * 100 disable the check.
+ */
+bool
+chunk_is_incompressible(const void *chunk, size_t size, unsigned int threshold)
+{
+	const u8 *data = chunk;
+	u32 freqs[256] = { 0 };
+	u32 hash_tab[1 << PROBE_HASH_ORDER] = { 0 };
+	size_t num_windows, stride, window_size;
+	u32 num_sampled = 0, num_repeats = 0;
+	u64 sum, entropy;
+
+	if (threshold > 100 || size < 4 || size > PROBE_MAX_CHUNK_SIZE)
+		return false;
+
+	if (size <= PROBE_MIN_WINDOWS * PROBE_WINDOW_SIZE) {
+		num_windows = 1;
+		window_size = size;
+		stride = 0;
+	} else {
+		num_windows = max(PROBE_MIN_WINDOWS,
+				  size / PROBE_BYTES_PER_WINDOW);
+		window_size = PROBE_WINDOW_SIZE;
+		stride = (size - PROBE_WINDOW_SIZE) / (num_windows - 1);
+	}
+
+	for (size_t w = 0; w < num_windows; w++) {
+		const size_t start = w * stride;
+		const size_t end = start + window_size;
+
+		for (size_t i = start; i < end; i++)
+			freqs[data[i]]++;
+
+		/* Count positions at which a 4-byte sequence that already
+		 * occurred in the sample starts.  The hash table holds the last
+		 * position + 1 for each hash bucket.  */
+		for (size_t i = start; i + 4 <= end; i++) {
+			u32 seq = load_u32_unaligned(&data[i]);
+			u32 *entry = &hash_tab[lz_hash(seq, PROBE_HASH_ORDER)];
+
+			if (*entry && load_u32_unaligned(&data[*entry - 1]) == seq)
+				num_repeats++;
+			*entry = i + 1;
+		}
+		num_sampled += window_size;
+	}
+
+	/* Any noticeable amount of repetition means LZ77 can do something.  */
+	if (num_repeats > num_sampled / 64)
+		return false;
+
+	/* entropy = log2(n) - sum(freq * log2(freq)) / n, in bits per byte  */
+	sum = 0;
+	for (int i = 0; i < 256; i++)
+		if (freqs[i])
+			sum += (u64)freqs[i] * log2_fixed16(freqs[i]);
+	entropy = (u64)num_sampled * log2_fixed16(num_sampled) - sum;
+
+	/* Compare entropy / (8 bits per byte) with the threshold percentage  */
+	return entropy * 100 >= (u64)threshold * num_sampled * (8 << 16);
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI void
+wimlib_set_incompressible_chunk_threshold(unsigned int threshold)
+{
+	if (threshold == 0)
+		threshold = DEFAULT_INCOMPRESSIBLE_THRESHOLD;
+	incompressible_threshold = threshold;
+}
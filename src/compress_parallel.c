@@ -51,6 +51,7 @@ struct compressor_thread_data {
 	struct message_queue *chunks_to_compress_queue;
 	struct message_queue *compressed_chunks_queue;
 	struct wimlib_compressor *compressor;
+	unsigned int incompressible_threshold;
 };
 
 #define MAX_CHUNKS_PER_MSG 16
@@ -60,6 +61,7 @@ struct message {
 	u8 *compressed_chunks[MAX_CHUNKS_PER_MSG];
 	u32 uncompressed_chunk_sizes[MAX_CHUNKS_PER_MSG];
 	u32 compressed_chunk_sizes[MAX_CHUNKS_PER_MSG];
+	bool skipped_chunks[MAX_CHUNKS_PER_MSG];
 	size_t num_filled_chunks;
 	size_t num_alloc_chunks;
 	struct list_head list;
@@ -210,11 +212,20 @@ allocate_messages(size_t count, size_t chunks_per_msg, u32 out_chunk_size)
 }
 
 static void
-compress_chunks(struct message *msg, struct wimlib_compressor *compressor)
+compress_chunks(struct message *msg, struct wimlib_compressor *compressor,
+		unsigned int incompressible_threshold)
 {
 
 	for (size_t i = 0; i < msg->num_filled_chunks; i++) {
 		wimlib_assert(msg->uncompressed_chunk_sizes[i] != 0);
+		msg->skipped_chunks[i] =
+			chunk_is_incompressible(msg->uncompressed_chunks[i],
+						msg->uncompressed_chunk_sizes[i],
+						incompressible_threshold);
+		if (msg->skipped_chunks[i]) {
+			msg->compressed_chunk_sizes[i] = 0;
+			continue;
+		}
 		msg->compressed_chunk_sizes[i] =
 			wimlib_compress(msg->uncompressed_chunks[i],
 					msg->uncompressed_chunk_sizes[i],
@@ -231,7 +242,8 @@ compressor_thread_proc(void *arg)
 	struct message *msg;
 
 	while ((msg = message_queue_get(params->chunks_to_compress_queue)) != NULL) {
-		compress_chunks(msg, params->compressor);
+		compress_chunks(msg, params->compressor,
+				params->incompressible_threshold);
 		message_queue_put(params->compressed_chunks_queue, msg);
 	}
 	return NULL;
@@ -349,6 +361,8 @@ parallel_chunk_compressor_get_compression_result(struct chunk_compressor *_ctx,
 		*csize_ret = msg->uncompressed_chunk_sizes[ctx->next_chunk_idx];
 	}
 	*usize_ret = msg->uncompressed_chunk_sizes[ctx->next_chunk_idx];
+	if (msg->skipped_chunks[ctx->next_chunk_idx])
+		ctx->base.skipped_bytes += *usize_ret;
 
 	if (++ctx->next_chunk_idx == msg->num_filled_chunks) {
 		list_del(&msg->submission_list);
@@ -466,6 +480,8 @@ new_parallel_chunk_compressor(int out_ctype, u32 out_chunk_size,
 
 		dat->chunks_to_compress_queue = &ctx->chunks_to_compress_queue;
 		dat->compressed_chunks_queue = &ctx->compressed_chunks_queue;
+		dat->incompressible_threshold =
+			get_incompressible_chunk_threshold();
 		ret = wimlib_create_compressor(out_ctype, out_chunk_size,
 					       WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE,
 					       &dat->compressor);
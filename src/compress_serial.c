@@ -35,6 +35,7 @@
 struct serial_chunk_compressor {
 	struct chunk_compressor base;
 	struct wimlib_compressor *compressor;
+	unsigned int incompressible_threshold;
 	u8 *udata;
 	u8 *cdata;
 	u32 usize;
@@ -76,8 +77,14 @@ serial_chunk_compressor_signal_chunk_filled(struct chunk_compressor *_ctx, u32 u
 	wimlib_assert(usize <= ctx->base.out_chunk_size);
 
 	ctx->usize = usize;
-	csize = wimlib_compress(ctx->udata, usize, ctx->cdata, usize - 1,
-				ctx->compressor);
+	if (chunk_is_incompressible(ctx->udata, usize,
+				    ctx->incompressible_threshold)) {
+		ctx->base.skipped_bytes += usize;
+		csize = 0;
+	} else {
+		csize = wimlib_compress(ctx->udata, usize, ctx->cdata,
+					usize - 1, ctx->compressor);
+	}
 	if (csize) {
 		ctx->result_data = ctx->cdata;
 		ctx->result_size = csize;
@@ -125,6 +132,7 @@ new_serial_chunk_compressor(int out_ctype, u32 out_chunk_size,
 	ctx->base.get_chunk_buffer = serial_chunk_compressor_get_chunk_buffer;
 	ctx->base.signal_chunk_filled = serial_chunk_compressor_signal_chunk_filled;
 	ctx->base.get_compression_result = serial_chunk_compressor_get_compression_result;
+	ctx->incompressible_threshold = get_incompressible_chunk_threshold();
 
 	ret = wimlib_create_compressor(out_ctype, out_chunk_size,
 				       WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE,
@@ -60,6 +60,8 @@
 #endif
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
 
 #include "wimlib/assert.h"
 #include "wimlib/dentry.h"
@@ -572,6 +574,172 @@ calculate_subdir_offsets(struct wim_dentry *root, u64 *subdir_offset_p)
 	for_dentry_in_tree(root, dentry_calculate_subdir_offset, subdir_offset_p);
 }
 
+struct dir_array {
+	struct wim_dentry **dirs;
+	size_t num_dirs;
+	size_t capacity;
+};
+
+static int
+dir_array_append(struct dir_array *array, struct wim_dentry *dentry)
+{
+	if (array->num_dirs == array->capacity) {
+		size_t new_capacity = max(array->capacity * 2, 64);
+		struct wim_dentry **new_dirs;
+
+		new_dirs = REALLOC(array->dirs,
+				   new_capacity * sizeof(array->dirs[0]));
+		if (!new_dirs)
+			return WIMLIB_ERR_NOMEM;
+		array->dirs = new_dirs;
+		array->capacity = new_capacity;
+	}
+	array->dirs[array->num_dirs++] = dentry;
+	return 0;
+}
+
+static int
+append_directory(struct wim_dentry *dentry, void *_array)
+{
+	if (!dentry_is_directory(dentry)) {
+		dentry->d_subdir_offset = 0;
+		return 0;
+	}
+	return dir_array_append(_array, dentry);
+}
+
+/* Return the length of the child dentries of @dir in the metadata resource,
+ * including the end-of-directory entry.  */
+static u64
+dir_children_length(const struct wim_dentry *dir)
+{
+	const struct wim_dentry *child;
+	u64 len = 8;
+
+	for_dentry_child(child, dir)
+		len += dentry_out_total_length(child);
+	return len;
+}
+
+/* Where the children of a directory go in the metadata resource.  */
+struct dir_placement {
+	struct wim_dentry *dir;
+	u64 offset;
+	u64 len;
+};
+
+#define NO_SUBDIR_OFFSET (~(u64)0)
+
+static int
+cmp_dir_placements(const void *p1, const void *p2)
+{
+	const struct dir_placement *pl1 = p1;
+	const struct dir_placement *pl2 = p2;
+
+	return cmp_u64(pl1->offset, pl2->offset);
+}
+
+/*
+ * Like calculate_subdir_offsets(), but keep the children of each directory at
+ * the offset they had in the metadata resource, @old_len bytes long, that the
+ * dentry tree was read from, where possible.  The children of new directories,
+ * and of directories that no longer fit in their old place, go after all the
+ * others.  This way, a small change to a large dentry tree changes only a few
+ * regions of the new metadata resource, and most of the compressed chunks of
+ * the old metadata resource can be reused.  Space left unused by the layout is
+ * not written by write_dentry_tree(), so the caller must zero it.
+ *
+ * Returns true if the subdir offsets were calculated, or false if the layout
+ * would waste too much space or memory couldn't be allocated.  In the latter
+ * case, the caller should use calculate_subdir_offsets() instead.
+ */
+bool
+calculate_subdir_offsets_in_place(struct wim_dentry *root,
+				  u64 *subdir_offset_p, u64 old_len)
+{
+	struct dir_array array = {};
+	struct dir_placement *placements = NULL;
+	const u64 start = *subdir_offset_p;
+	u64 compact_end = start;
+	u64 end = start;
+	u64 total_end;
+	bool ok = false;
+
+	if (for_dentry_in_tree(root, append_directory, &array))
+		goto out;
+
+	placements = MALLOC(array.num_dirs * sizeof(placements[0]));
+	if (!placements)
+		goto out;
+
+	for (size_t i = 0; i < array.num_dirs; i++) {
+		struct wim_dentry *dir = array.dirs[i];
+		u64 offset = dir->d_subdir_offset;
+
+		/* The old subdir offset is only a hint.  It may be garbage if
+		 * the dentry was on a temporary list, or 0 if it is new.  */
+		if (offset < start || offset >= old_len || (offset & 7))
+			offset = NO_SUBDIR_OFFSET;
+
+		placements[i].dir = dir;
+		placements[i].offset = offset;
+		placements[i].len = dir_children_length(dir);
+		compact_end += placements[i].len;
+	}
+
+	/* Keep each directory's children at their old offset if they don't
+	 * overlap the previous directory's children and still fit before the
+	 * next directory's children.  */
+	qsort(placements, array.num_dirs, sizeof(placements[0]),
+	      cmp_dir_placements);
+	for (size_t i = 0; i < array.num_dirs; i++) {
+		struct dir_placement *pl = &placements[i];
+		u64 limit = NO_SUBDIR_OFFSET;
+
+		if (i + 1 < array.num_dirs)
+			limit = placements[i + 1].offset;
+
+		if (pl->offset != NO_SUBDIR_OFFSET && pl->offset >= end &&
+		    pl->offset + pl->len <= limit)
+			end = pl->offset + pl->len;
+		else
+			pl->offset = NO_SUBDIR_OFFSET;
+	}
+
+	/* Put the rest at the end, in tree order.  But give up if the layout
+	 * would be much larger than the compact one.  */
+	total_end = end;
+	for (size_t i = 0; i < array.num_dirs; i++)
+		if (placements[i].offset == NO_SUBDIR_OFFSET)
+			total_end += placements[i].len;
+	if (total_end > compact_end + compact_end / 4)
+		goto out;
+
+	for (size_t i = 0; i < array.num_dirs; i++) {
+		struct dir_placement *pl = &placements[i];
+
+		if (pl->offset == NO_SUBDIR_OFFSET)
+			pl->dir->d_subdir_offset = 0;
+		else
+			pl->dir->d_subdir_offset = pl->offset;
+	}
+	for (size_t i = 0; i < array.num_dirs; i++) {
+		struct wim_dentry *dir = array.dirs[i];
+
+		if (dir->d_subdir_offset == 0) {
+			dir->d_subdir_offset = end;
+			end += dir_children_length(dir);
+		}
+	}
+	wimlib_assert(end == total_end);
+	*subdir_offset_p = end;
+	ok = true;
+out:
+	FREE(placements);
+	FREE(array.dirs);
+	return ok;
+}
+
 static int
 dentry_compare_names(const struct wim_dentry *d1, const struct wim_dentry *d2,
 		     bool ignore_case)
@@ -713,10 +881,10 @@ get_dentry_child_with_name(const struct wim_dentry *dir, const tchar *name,
 	return child;
 }
 
-/* This is the UTF-16LE version of get_dentry(), currently private to this file
- * because no one needs it besides get_dentry().  */
+/* This is the UTF-16LE version of get_dentry_in_tree(), currently private to
+ * this file because no one needs it besides get_dentry_in_tree().  */
 static struct wim_dentry *
-get_dentry_utf16le(WIMStruct *wim, const utf16lechar *path,
+get_dentry_utf16le(struct wim_dentry *root, const utf16lechar *path,
 		   CASE_SENSITIVITY_TYPE case_type)
 {
 	struct wim_dentry *cur_dentry;
@@ -725,7 +893,7 @@ get_dentry_utf16le(WIMStruct *wim, const utf16lechar *path,
 	/* Start with the root directory of the image.  Note: this will be NULL
 	 * if an image has been added directly with wimlib_add_empty_image() but
 	 * no files have been added yet; in that case we fail with ENOENT.  */
-	cur_dentry = wim_get_current_root_dentry(wim);
+	cur_dentry = root;
 
 	name_start = path;
 	for (;;) {
@@ -818,6 +986,17 @@ get_dentry_utf16le(WIMStruct *wim, const utf16lechar *path,
  */
 struct wim_dentry *
 get_dentry(WIMStruct *wim, const tchar *path, CASE_SENSITIVITY_TYPE case_type)
+{
+	return get_dentry_in_tree(wim_get_current_root_dentry(wim), path,
+				  case_type);
+}
+
+/* Like get_dentry(), but search the dentry tree rooted at @root (which may be
+ * NULL) rather than the currently selected image.  This doesn't access the
+ * WIMStruct, so it may be used on an image that isn't selected.  */
+struct wim_dentry *
+get_dentry_in_tree(struct wim_dentry *root, const tchar *path,
+		   CASE_SENSITIVITY_TYPE case_type)
 {
 	int ret;
 	const utf16lechar *path_utf16le;
@@ -826,7 +1005,7 @@ get_dentry(WIMStruct *wim, const tchar *path, CASE_SENSITIVITY_TYPE case_type)
 	ret = tstr_get_utf16le(path, &path_utf16le);
 	if (ret)
 		return NULL;
-	dentry = get_dentry_utf16le(wim, path_utf16le, case_type);
+	dentry = get_dentry_utf16le(root, path_utf16le, case_type);
 	tstr_put_utf16le(path_utf16le);
 	return dentry;
 }
@@ -1825,22 +2004,129 @@ write_dentry(const struct wim_dentry * restrict dentry, u8 * restrict p)
 	return p;
 }
 
+/* Write the child dentries of @dir, followed by an end-of-directory entry, to
+ * @p.  Returns a pointer to the byte following the last written.  */
+static u8 *
+write_dir_dentries(const struct wim_dentry *dir, u8 *p)
+{
+	const struct wim_dentry *child;
+
+	/* write child dentries */
+	for_dentry_child(child, dir)
+		p = write_dentry(child, p);
+
+	/* write end of directory entry */
+	*(u64*)p = 0;
+	p += 8;
+	return p;
+}
+
+/*
+ * Since calculate_subdir_offsets() has already assigned every directory the
+ * offset at which its children go, the children of different directories can
+ * be written independently.  So, for large dentry trees, the directories are
+ * split into contiguous ranges that are written by separate threads.
+ */
+
+/* Minimum number of directories per thread when writing in parallel  */
+#define MIN_DIRS_PER_WRITE_THREAD	4096
+
+/* Maximum number of threads to use for writing a dentry tree  */
+#define MAX_WRITE_DENTRY_THREADS	16
+
 static int
-write_dir_dentries(struct wim_dentry *dir, void *_pp)
+append_dir(struct wim_dentry *dentry, void *_array)
 {
-	if (dir->d_subdir_offset != 0) {
-		u8 **pp = _pp;
-		u8 *p = *pp;
-		struct wim_dentry *child;
+	if (dentry->d_subdir_offset == 0)
+		return 0;
+	return dir_array_append(_array, dentry);
+}
 
-		/* write child dentries */
-		for_dentry_child(child, dir)
-			p = write_dentry(child, p);
+struct write_dentries_thread_ctx {
+	pthread_t thread;
+	u8 *buf;
+	struct wim_dentry **dirs;
+	size_t num_dirs;
+	u8 *end;
+};
 
-		/* write end of directory entry */
-		*(u64*)p = 0;
-		p += 8;
-		*pp = p;
+static void *
+write_dentries_thread_proc(void *_ctx)
+{
+	struct write_dentries_thread_ctx *ctx = _ctx;
+
+	for (size_t i = 0; i < ctx->num_dirs; i++) {
+		u8 *end = write_dir_dentries(ctx->dirs[i],
+					     ctx->buf + ctx->dirs[i]->d_subdir_offset);
+		ctx->end = max(ctx->end, end);
+	}
+	return NULL;
+}
+
+/* Try to write the child dentries of all directories in @root's tree using up
+ * to @num_threads threads (0 means the number of available CPUs).  Returns a pointer to the byte following the last written,
+ * or NULL if the tree was not written (it is too small, or memory allocation
+ * failed).  */
+static u8 *
+write_dentry_tree_parallel(struct wim_dentry *root, u8 *buf,
+			   unsigned num_threads)
+{
+	struct dir_array array = {};
+	struct write_dentries_thread_ctx ctxs[MAX_WRITE_DENTRY_THREADS];
+	size_t dirs_per_thread;
+	size_t next_dir = 0;
+	u8 *end = NULL;
+
+	if (for_dentry_in_tree(root, append_dir, &array))
+		goto out;
+
+	if (num_threads == 0)
+		num_threads = get_available_cpus();
+	num_threads = min(num_threads, MAX_WRITE_DENTRY_THREADS);
+	num_threads = min(num_threads,
+			  array.num_dirs / MIN_DIRS_PER_WRITE_THREAD);
+	if (num_threads <= 1)
+		goto out;
+
+	dirs_per_thread = DIV_ROUND_UP(array.num_dirs, num_threads);
+	for (unsigned i = 0; i < num_threads; i++) {
+		ctxs[i].buf = buf;
+		ctxs[i].dirs = &array.dirs[next_dir];
+		ctxs[i].num_dirs = min(dirs_per_thread,
+				       array.num_dirs - next_dir);
+		ctxs[i].end = buf;
+		next_dir += ctxs[i].num_dirs;
+		/* Thread 0 is the current thread.  If a thread can't be
+		 * created, then the current thread does its work instead.  */
+		if (i == 0 || pthread_create(&ctxs[i].thread, NULL,
+					     write_dentries_thread_proc,
+					     &ctxs[i]))
+			ctxs[i].thread = pthread_self();
+	}
+	for (unsigned i = 0; i < num_threads; i++)
+		if (pthread_equal(ctxs[i].thread, pthread_self()))
+			write_dentries_thread_proc(&ctxs[i]);
+	for (unsigned i = 0; i < num_threads; i++)
+		if (!pthread_equal(ctxs[i].thread, pthread_self()))
+			pthread_join(ctxs[i].thread, NULL);
+
+	end = buf;
+	for (unsigned i = 0; i < num_threads; i++)
+		end = max(end, ctxs[i].end);
+out:
+	FREE(array.dirs);
+	return end;
+}
+
+static int
+write_dir_dentries_cb(struct wim_dentry *dir, void *_ctx)
+{
+	if (dir->d_subdir_offset != 0) {
+		struct write_dentries_thread_ctx *ctx = _ctx;
+		u8 *end = write_dir_dentries(dir,
+					     ctx->buf + dir->d_subdir_offset);
+
+		ctx->end = max(ctx->end, end);
 	}
 	return 0;
 }
@@ -1853,22 +2139,42 @@ write_dir_dentries(struct wim_dentry *dir, void *_pp)
  *	called.  This cannot be NULL; if the dentry tree is empty, the caller is
  *	expected to first generate a dummy root directory.
  *
+ * @buf:
+ *	Pointer to the start of the metadata resource buffer, which the subdir
+ *	offsets are relative to.
+ *
  * @p:
- *	Pointer to a buffer with enough space for the dentry tree.  This size
- *	must have been obtained by calculate_subdir_offsets().
+ *	Pointer into @buf at which to write the root dentry.  There must be
+ *	enough space for the dentry tree.  This size must have been obtained by
+ *	calculate_subdir_offsets() or calculate_subdir_offsets_in_place().
+ *
+ * @num_threads:
+ *	Maximum number of threads to use, or 0 to use the number of available
+ *	CPUs.
  *
  * Returns a pointer to the byte following the last written.
  */
 u8 *
-write_dentry_tree(struct wim_dentry *root, u8 *p)
+write_dentry_tree(struct wim_dentry *root, u8 *buf, u8 *p,
+		  unsigned num_threads)
 {
+	u8 *end;
+
 	/* write root dentry and end-of-directory entry following it */
 	p = write_dentry(root, p);
 	*(u64*)p = 0;
 	p += 8;
 
 	/* write the rest of the dentry tree */
-	for_dentry_in_tree(root, write_dir_dentries, &p);
-
-	return p;
+	end = write_dentry_tree_parallel(root, buf, num_threads);
+	if (!end) {
+		struct write_dentries_thread_ctx ctx = {
+			.buf = buf,
+			.end = p,
+		};
+
+		for_dentry_in_tree(root, write_dir_dentries_cb, &ctx);
+		end = ctx.end;
+	}
+	return max(end, p);
 }
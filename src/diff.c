@@ -0,0 +1,312 @@
+/*
+ * diff.c
+ *
+ * API to compare the directory trees of two WIM images.
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "wimlib.h"
+#include "wimlib/dentry.h"
+#include "wimlib/encoding.h"
+#include "wimlib/inode.h"
+#include "wimlib/metadata.h"
+#include "wimlib/security.h"
+#include "wimlib/sha1.h"
+#include "wimlib/util.h"
+#include "wimlib/wim.h"
+
+struct diff_ctx {
+	const struct wim_security_data *old_sd;
+	const struct wim_security_data *new_sd;
+	int diff_flags;
+	wimlib_diff_images_callback_t cb;
+	void *user_ctx;
+};
+
+/* Compare two dentries by name in the same order in which for_dentry_child()
+ * visits them: ignoring case first, then case-sensitively.  */
+static int
+collate_names(const struct wim_dentry *d1, const struct wim_dentry *d2)
+{
+	int res;
+
+	res = cmp_utf16le_strings(d1->d_name, d1->d_name_nbytes / 2,
+				  d2->d_name, d2->d_name_nbytes / 2, true);
+	if (res)
+		return res;
+	return cmp_utf16le_strings(d1->d_name, d1->d_name_nbytes / 2,
+				   d2->d_name, d2->d_name_nbytes / 2, false);
+}
+
+/* Returns %true iff every nonempty stream of @inode has a stream of the same
+ * type and name with the same contents in @other.  */
+static bool
+streams_contained_in(const struct wim_inode *inode,
+		     const struct wim_inode *other)
+{
+	for (unsigned i = 0; i < inode->i_num_streams; i++) {
+		const struct wim_inode_stream *strm = &inode->i_streams[i];
+		const struct wim_inode_stream *other_strm;
+		const u8 *hash = stream_hash(strm);
+
+		other_strm = inode_get_stream(other, strm->stream_type,
+					      strm->stream_name);
+		if (!other_strm) {
+			if (!is_zero_hash(hash))
+				return false;
+			continue;
+		}
+		if (!hashes_equal(hash, stream_hash(other_strm)))
+			return false;
+	}
+	return true;
+}
+
+static bool
+security_descriptors_equal(const struct wim_inode *old_inode,
+			   const struct wim_inode *new_inode,
+			   const struct diff_ctx *ctx)
+{
+	s32 old_id = old_inode->i_security_id;
+	s32 new_id = new_inode->i_security_id;
+
+	if (old_id < 0 || new_id < 0)
+		return old_id < 0 && new_id < 0;
+
+	return ctx->old_sd->sizes[old_id] == ctx->new_sd->sizes[new_id] &&
+		!memcmp(ctx->old_sd->descriptors[old_id],
+			ctx->new_sd->descriptors[new_id],
+			ctx->old_sd->sizes[old_id]);
+}
+
+static bool
+extra_data_equal(const struct wim_inode *old_inode,
+		 const struct wim_inode *new_inode)
+{
+	size_t old_size = old_inode->i_extra ? old_inode->i_extra->size : 0;
+	size_t new_size = new_inode->i_extra ? new_inode->i_extra->size : 0;
+
+	return old_size == new_size &&
+		(old_size == 0 || !memcmp(old_inode->i_extra->data,
+					  new_inode->i_extra->data, old_size));
+}
+
+/* Return the WIMLIB_DIFF_CHANGED_* flags describing how @new_dentry differs
+ * from @old_dentry.  Directory contents are not considered.  */
+static u32
+compare_dentries(const struct wim_dentry *old_dentry,
+		 const struct wim_dentry *new_dentry,
+		 const struct diff_ctx *ctx)
+{
+	const struct wim_inode *old_inode = old_dentry->d_inode;
+	const struct wim_inode *new_inode = new_dentry->d_inode;
+	u32 changed = 0;
+
+	if (inode_is_directory(old_inode) != inode_is_directory(new_inode))
+		return WIMLIB_DIFF_CHANGED_TYPE;
+
+	if (!streams_contained_in(old_inode, new_inode) ||
+	    !streams_contained_in(new_inode, old_inode))
+		changed |= WIMLIB_DIFF_CHANGED_DATA;
+
+	if (old_inode->i_attributes != new_inode->i_attributes ||
+	    ((old_inode->i_attributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+	     old_inode->i_reparse_tag != new_inode->i_reparse_tag))
+		changed |= WIMLIB_DIFF_CHANGED_ATTRIBUTES;
+
+	if (!security_descriptors_equal(old_inode, new_inode, ctx))
+		changed |= WIMLIB_DIFF_CHANGED_SECURITY;
+
+	if (old_inode->i_creation_time != new_inode->i_creation_time ||
+	    old_inode->i_last_write_time != new_inode->i_last_write_time)
+		changed |= WIMLIB_DIFF_CHANGED_TIMESTAMPS;
+
+	if (old_dentry->d_short_name_nbytes != new_dentry->d_short_name_nbytes ||
+	    (old_dentry->d_short_name_nbytes &&
+	     memcmp(old_dentry->d_short_name, new_dentry->d_short_name,
+		    old_dentry->d_short_name_nbytes)) ||
+	    !extra_data_equal(old_inode, new_inode))
+		changed |= WIMLIB_DIFF_CHANGED_OTHER;
+
+	if (ctx->diff_flags & WIMLIB_DIFF_FLAG_IGNORE_TIMESTAMPS)
+		changed &= ~WIMLIB_DIFF_CHANGED_TIMESTAMPS;
+
+	return changed;
+}
+
+static int
+report_change(struct wim_dentry *old_dentry, struct wim_dentry *new_dentry,
+	      int change, u32 changed, const struct diff_ctx *ctx)
+{
+	struct wim_dentry *dentry = new_dentry ? new_dentry : old_dentry;
+	struct wimlib_diff_entry entry = {
+		.change = change,
+		.changed = changed,
+	};
+	int ret;
+
+	ret = calculate_dentry_full_path(dentry);
+	if (ret)
+		return ret;
+	entry.path = dentry->d_full_path;
+	if (old_dentry)
+		entry.old_attributes = old_dentry->d_inode->i_attributes;
+	if (new_dentry)
+		entry.new_attributes = new_dentry->d_inode->i_attributes;
+
+	ret = (*ctx->cb)(&entry, ctx->user_ctx);
+	FREE(dentry->d_full_path);
+	dentry->d_full_path = NULL;
+	return ret;
+}
+
+static int
+diff_dentries(struct wim_dentry *old_dentry, struct wim_dentry *new_dentry,
+	      const struct diff_ctx *ctx);
+
+/* Walk the children of two directories together in collation order.  Either
+ * directory may be NULL, which is treated like an empty directory.  */
+static int
+diff_children(const struct wim_dentry *old_dir,
+	      const struct wim_dentry *new_dir, const struct diff_ctx *ctx)
+{
+	struct avl_tree_node *old_node = NULL, *new_node = NULL;
+	int ret;
+
+	if (old_dir)
+		old_node = avl_tree_first_in_order(old_dir->d_inode->i_children);
+	if (new_dir)
+		new_node = avl_tree_first_in_order(new_dir->d_inode->i_children);
+
+	while (old_node || new_node) {
+		struct wim_dentry *old_child = NULL, *new_child = NULL;
+		int res;
+
+		if (!old_node)
+			res = 1;
+		else if (!new_node)
+			res = -1;
+		else
+			res = collate_names(avl_tree_entry(old_node,
+							   struct wim_dentry,
+							   d_index_node),
+					    avl_tree_entry(new_node,
+							   struct wim_dentry,
+							   d_index_node));
+		if (res <= 0) {
+			old_child = avl_tree_entry(old_node, struct wim_dentry,
+						   d_index_node);
+			old_node = avl_tree_next_in_order(old_node);
+		}
+		if (res >= 0) {
+			new_child = avl_tree_entry(new_node, struct wim_dentry,
+						   d_index_node);
+			new_node = avl_tree_next_in_order(new_node);
+		}
+		ret = diff_dentries(old_child, new_child, ctx);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int
+diff_dentries(struct wim_dentry *old_dentry, struct wim_dentry *new_dentry,
+	      const struct diff_ctx *ctx)
+{
+	u32 changed;
+	int ret;
+
+	if (!new_dentry)
+		return report_change(old_dentry, NULL, WIMLIB_DIFF_DELETED, 0, ctx);
+	if (!old_dentry)
+		return report_change(NULL, new_dentry, WIMLIB_DIFF_ADDED, 0, ctx);
+
+	changed = compare_dentries(old_dentry, new_dentry, ctx);
+	if (changed) {
+		ret = report_change(old_dentry, new_dentry,
+				    WIMLIB_DIFF_MODIFIED, changed, ctx);
+		if (ret)
+			return ret;
+	}
+	if (changed & WIMLIB_DIFF_CHANGED_TYPE ||
+	    !inode_is_directory(new_dentry->d_inode))
+		return 0;
+	return diff_children(old_dentry, new_dentry, ctx);
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI int
+wimlib_diff_images(WIMStruct *old_wim, int old_image,
+		   WIMStruct *new_wim, int new_image, int diff_flags,
+		   wimlib_diff_images_callback_t cb, void *user_ctx)
+{
+	struct wim_image_metadata *old_imd, *new_imd;
+	struct diff_ctx ctx;
+	int ret;
+
+	if (diff_flags & ~WIMLIB_DIFF_FLAG_IGNORE_TIMESTAMPS)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	if (old_image < 1 || old_image > old_wim->hdr.image_count ||
+	    new_image < 1 || new_image > new_wim->hdr.image_count)
+		return WIMLIB_ERR_INVALID_IMAGE;
+
+	/* Streams added to an image in memory may not have been checksummed
+	 * yet.  This is the only case in which file data is read.  */
+	ret = wim_checksum_unhashed_blobs(old_wim);
+	if (ret)
+		return ret;
+	if (new_wim != old_wim) {
+		ret = wim_checksum_unhashed_blobs(new_wim);
+		if (ret)
+			return ret;
+	}
+
+	ret = pin_wim_image(old_wim, old_image);
+	if (ret)
+		return ret;
+	old_imd = old_wim->image_metadata[old_image - 1];
+
+	ret = pin_wim_image(new_wim, new_image);
+	if (ret)
+		goto out_unpin_old;
+	new_imd = new_wim->image_metadata[new_image - 1];
+
+	ctx.old_sd = old_imd->security_data;
+	ctx.new_sd = new_imd->security_data;
+	ctx.diff_flags = diff_flags;
+	ctx.cb = cb;
+	ctx.user_ctx = user_ctx;
+
+	/* An empty image has no root directory at all.  */
+	if (old_imd->root_dentry && new_imd->root_dentry)
+		ret = diff_dentries(old_imd->root_dentry, new_imd->root_dentry,
+				    &ctx);
+	else
+		ret = diff_children(old_imd->root_dentry, new_imd->root_dentry,
+				    &ctx);
+
+	unpin_wim_image(new_wim, new_imd);
+out_unpin_old:
+	unpin_wim_image(old_wim, old_imd);
+	return ret;
+}
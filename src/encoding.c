@@ -23,6 +23,9 @@
 
 #include <errno.h>
 #include <string.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 #include "wimlib/encoding.h"
 #include "wimlib/endianness.h"
@@ -259,10 +262,125 @@ convert_string(const u8 * const in, const size_t in_nbytes,
 	return 0;
 }
 
+/*
+ * Most filenames are entirely ASCII, and for ASCII strings the conversion
+ * between UTF-8 and UTF-16LE is just widening or narrowing each byte.  The
+ * following functions detect and convert ASCII strings 16 bytes at a time when
+ * SSE2 is available.  Strings containing any non-ASCII character are handled
+ * by convert_string() instead.
+ */
+
+/* Return true if the UTF-8 string @in of size @n is entirely ASCII.  */
+static forceinline bool
+utf8_is_ascii(const u8 *in, size_t n)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&in[i]);
+		if (_mm_movemask_epi8(v))
+			return false;
+	}
+#endif
+	for (; i < n; i++)
+		if (in[i] >= 0x80)
+			return false;
+	return true;
+}
+
+/* Return true if the UTF-16LE string @in of size @n bytes (must be even) is
+ * entirely ASCII.  */
+static forceinline bool
+utf16le_is_ascii(const u8 *in, size_t n)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i non_ascii_bits = _mm_set1_epi16((s16)0xFF80);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&in[i]);
+		v = _mm_and_si128(v, non_ascii_bits);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_setzero_si128()))
+		    != 0xFFFF)
+			return false;
+	}
+#endif
+	for (; i < n; i += 2)
+		if (get_unaligned_le16(&in[i]) >= 0x80)
+			return false;
+	return true;
+}
+
+/* Convert the ASCII string @in of size @n from UTF-8 to UTF-16LE.  */
+static int
+ascii_utf8_to_utf16le(const u8 *in, size_t n,
+		      u8 **out_ret, size_t *out_nbytes_ret)
+{
+	u8 *out = MALLOC(2 * n + 2);
+	size_t i = 0;
+
+	if (unlikely(!out))
+		return WIMLIB_ERR_NOMEM;
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&in[i]);
+		__m128i zero = _mm_setzero_si128();
+
+		_mm_storeu_si128((__m128i *)&out[2 * i],
+				 _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i *)&out[2 * i + 16],
+				 _mm_unpackhi_epi8(v, zero));
+	}
+#endif
+	for (; i < n; i++)
+		put_unaligned_le16(in[i], &out[2 * i]);
+	put_unaligned_le16(0, &out[2 * n]);
+
+	*out_ret = out;
+	if (out_nbytes_ret)
+		*out_nbytes_ret = 2 * n;
+	return 0;
+}
+
+/* Convert the ASCII string @in of size @n bytes from UTF-16LE to UTF-8.  */
+static int
+ascii_utf16le_to_utf8(const u8 *in, size_t n,
+		      u8 **out_ret, size_t *out_nbytes_ret)
+{
+	u8 *out = MALLOC(n / 2 + 1);
+	size_t i = 0;
+
+	if (unlikely(!out))
+		return WIMLIB_ERR_NOMEM;
+#ifdef __SSE2__
+	for (; i + 32 <= n; i += 32) {
+		__m128i v1 = _mm_loadu_si128((const __m128i *)&in[i]);
+		__m128i v2 = _mm_loadu_si128((const __m128i *)&in[i + 16]);
+
+		_mm_storeu_si128((__m128i *)&out[i / 2],
+				 _mm_packus_epi16(v1, v2));
+	}
+#endif
+	for (; i < n; i += 2)
+		out[i / 2] = get_unaligned_le16(&in[i]);
+	out[n / 2] = 0;
+
+	*out_ret = out;
+	if (out_nbytes_ret)
+		*out_nbytes_ret = n / 2;
+	return 0;
+}
+
 int
 utf8_to_utf16le(const char *in, size_t in_nbytes,
 		utf16lechar **out_ret, size_t *out_nbytes_ret)
 {
+	if (utf8_is_ascii((const u8 *)in, in_nbytes))
+		return ascii_utf8_to_utf16le((const u8 *)in, in_nbytes,
+					     (u8 **)out_ret, out_nbytes_ret);
+
 	return convert_string((const u8 *)in, in_nbytes,
 			      (u8 **)out_ret, out_nbytes_ret,
 			      WIMLIB_ERR_INVALID_UTF8_STRING,
@@ -273,6 +391,10 @@ int
 utf16le_to_utf8(const utf16lechar *in, size_t in_nbytes,
 		char **out_ret, size_t *out_nbytes_ret)
 {
+	if (in_nbytes % 2 == 0 && utf16le_is_ascii((const u8 *)in, in_nbytes))
+		return ascii_utf16le_to_utf8((const u8 *)in, in_nbytes,
+					     (u8 **)out_ret, out_nbytes_ret);
+
 	return convert_string((const u8 *)in, in_nbytes,
 			      (u8 **)out_ret, out_nbytes_ret,
 			      WIMLIB_ERR_INVALID_UTF16_STRING,
@@ -378,16 +500,59 @@ cmp_utf16le_strings(const utf16lechar *s1, size_t n1,
 		    bool ignore_case)
 {
 	size_t n = min(n1, n2);
+	size_t i = 0;
+
+#ifdef __SSE2__
+	/* Skip over equal characters 8 at a time.  For case-insensitive
+	 * comparisons, this is done only while both strings are ASCII, in
+	 * which case upcasing just means mapping 'a'-'z' to 'A'-'Z'.  The
+	 * scalar loops below take over from the first block that contains a
+	 * difference or a non-ASCII character.  */
+	if (ignore_case) {
+		const __m128i non_ascii_bits = _mm_set1_epi16((s16)0xFF80);
+		const __m128i before_a = _mm_set1_epi16('a' - 1);
+		const __m128i after_z = _mm_set1_epi16('z' + 1);
+		const __m128i case_bit = _mm_set1_epi16(0x20);
+
+		for (; i + 8 <= n; i += 8) {
+			__m128i v1 = _mm_loadu_si128((const __m128i *)&s1[i]);
+			__m128i v2 = _mm_loadu_si128((const __m128i *)&s2[i]);
+			__m128i lower1, lower2;
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(
+				    _mm_and_si128(_mm_or_si128(v1, v2),
+						  non_ascii_bits),
+				    _mm_setzero_si128())) != 0xFFFF)
+				break;
+			lower1 = _mm_and_si128(_mm_cmpgt_epi16(v1, before_a),
+					       _mm_cmplt_epi16(v1, after_z));
+			lower2 = _mm_and_si128(_mm_cmpgt_epi16(v2, before_a),
+					       _mm_cmplt_epi16(v2, after_z));
+			v1 = _mm_sub_epi16(v1, _mm_and_si128(lower1, case_bit));
+			v2 = _mm_sub_epi16(v2, _mm_and_si128(lower2, case_bit));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(v1, v2)) != 0xFFFF)
+				break;
+		}
+	} else {
+		for (; i + 8 <= n; i += 8) {
+			__m128i v1 = _mm_loadu_si128((const __m128i *)&s1[i]);
+			__m128i v2 = _mm_loadu_si128((const __m128i *)&s2[i]);
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(v1, v2)) != 0xFFFF)
+				break;
+		}
+	}
+#endif /* __SSE2__ */
 
 	if (ignore_case) {
-		for (size_t i = 0; i < n; i++) {
+		for (; i < n; i++) {
 			u16 c1 = upcase[le16_to_cpu(s1[i])];
 			u16 c2 = upcase[le16_to_cpu(s2[i])];
 			if (c1 != c2)
 				return (c1 < c2) ? -1 : 1;
 		}
 	} else {
-		for (size_t i = 0; i < n; i++) {
+		for (; i < n; i++) {
 			u16 c1 = le16_to_cpu(s1[i]);
 			u16 c2 = le16_to_cpu(s2[i]);
 			if (c1 != c2)
@@ -68,6 +68,7 @@
 
 #define WIMLIB_EXTRACT_FLAG_FROM_PIPE   0x80000000
 #define WIMLIB_EXTRACT_FLAG_IMAGEMODE   0x40000000
+#define WIMLIB_EXTRACT_FLAG_ALL_IMAGES  0x20000000
 
 /* Keep in sync with wimlib.h  */
 #define WIMLIB_EXTRACT_MASK_PUBLIC				\
@@ -88,10 +89,12 @@
 	 WIMLIB_EXTRACT_FLAG_NO_ATTRIBUTES		|	\
 	 WIMLIB_EXTRACT_FLAG_NO_PRESERVE_DIR_STRUCTURE  |	\
 	 WIMLIB_EXTRACT_FLAG_WIMBOOT			|	\
+	 WIMLIB_EXTRACT_FLAG_SINGLE_PASS		|	\
 	 WIMLIB_EXTRACT_FLAG_COMPACT_XPRESS4K		|	\
 	 WIMLIB_EXTRACT_FLAG_COMPACT_XPRESS8K		|	\
 	 WIMLIB_EXTRACT_FLAG_COMPACT_XPRESS16K		|	\
-	 WIMLIB_EXTRACT_FLAG_COMPACT_LZX			\
+	 WIMLIB_EXTRACT_FLAG_COMPACT_LZX		|	\
+	 WIMLIB_EXTRACT_FLAG_INCREMENTAL			\
 	 )
 
 /* Send WIMLIB_PROGRESS_MSG_EXTRACT_FILE_STRUCTURE or
@@ -425,7 +428,7 @@ begin_extract_blob(struct blob_descriptor *blob, void *_ctx)
 {
 	struct apply_ctx *ctx = _ctx;
 
-	if (unlikely(blob->out_refcnt > MAX_OPEN_FILES))
+	if (unlikely((u64)blob->out_refcnt * ctx->num_targets > MAX_OPEN_FILES))
 		return create_temporary_file(&ctx->tmpfile_fd, &ctx->tmpfile_name);
 
 	return call_begin_blob(blob, ctx->saved_cbs);
@@ -442,9 +445,10 @@ extract_chunk(const struct blob_descriptor *blob, u64 offset,
 
 	if (likely(ctx->supported_features.hard_links)) {
 		progress->extract.completed_bytes +=
-			(u64)size * blob->out_refcnt;
+			(u64)size * blob->out_refcnt * ctx->num_targets;
 		if (last)
-			progress->extract.completed_streams += blob->out_refcnt;
+			progress->extract.completed_streams +=
+				(u64)blob->out_refcnt * ctx->num_targets;
 	} else {
 		const struct blob_extraction_target *targets =
 			blob_extraction_targets(blob);
@@ -453,9 +457,11 @@ extract_chunk(const struct blob_descriptor *blob, u64 offset,
 			const struct wim_dentry *dentry;
 
 			inode_for_each_extraction_alias(dentry, inode) {
-				progress->extract.completed_bytes += size;
+				progress->extract.completed_bytes +=
+					(u64)size * ctx->num_targets;
 				if (last)
-					progress->extract.completed_streams++;
+					progress->extract.completed_streams +=
+						ctx->num_targets;
 			}
 		}
 	}
@@ -748,8 +754,9 @@ destroy_dentry_list(struct list_head *dentry_list)
 		dentry_reset_extraction_list_node(dentry);
 		inode->i_visited = 0;
 		inode->i_can_externally_back = 0;
-		if ((void *)dentry->d_extraction_name != (void *)dentry->d_name)
-			FREE(dentry->d_extraction_name);
+		inode->i_data_unchanged = 0;
+		/* The extraction name is either an alias of d_name or owned by
+		 * the extraction name table.  */
 		dentry->d_extraction_name = NULL;
 		dentry->d_extraction_name_nchars = 0;
 	}
@@ -803,6 +810,162 @@ file_name_valid(utf16lechar *name, size_t num_chars, bool fix)
 	return true;
 }
 
+/*
+ * Extraction names are kept in a hash table keyed by the UTF-16LE name, so that
+ * each distinct name is converted and stored only once, no matter how many
+ * dentries have it.  Names like "en-US" or "amd64" can occur thousands of times
+ * in a Windows image.  Dentries point directly into the table entries, which
+ * are freed when the extraction is done.
+ */
+struct extraction_name {
+	struct hlist_node hash_node;
+	const utf16lechar *uname;
+	u16 uname_nbytes;
+	u16 tname_nchars;
+	tchar *tname;
+};
+
+static u32
+hash_utf16le_name(const utf16lechar *name, size_t nbytes)
+{
+	u64 hash = 0;
+
+	for (size_t i = 0; i < nbytes / sizeof(utf16lechar); i++)
+		hash = hash_u64(hash + le16_to_cpu(name[i]) + 1);
+	return hash >> 32;
+}
+
+static int
+init_extraction_name_table(struct apply_ctx *ctx)
+{
+	ctx->name_table_capacity = 1024;
+	ctx->name_table = CALLOC(ctx->name_table_capacity,
+				 sizeof(ctx->name_table[0]));
+	if (!ctx->name_table)
+		return WIMLIB_ERR_NOMEM;
+	ctx->name_table_filled = 0;
+	INIT_HLIST_HEAD(&ctx->extra_names);
+	return 0;
+}
+
+static void
+free_extraction_names(struct hlist_head *head)
+{
+	struct extraction_name *ename;
+	struct hlist_node *tmp;
+
+	hlist_for_each_entry_safe(ename, tmp, head, hash_node) {
+		FREE(ename->tname);
+		FREE(ename);
+	}
+}
+
+static void
+destroy_extraction_name_table(struct apply_ctx *ctx)
+{
+	if (!ctx->name_table)
+		return;
+	for (size_t i = 0; i < ctx->name_table_capacity; i++)
+		free_extraction_names(&ctx->name_table[i]);
+	free_extraction_names(&ctx->extra_names);
+	FREE(ctx->name_table);
+	ctx->name_table = NULL;
+}
+
+/* Double the capacity of the extraction name table.  */
+static void
+enlarge_extraction_name_table(struct apply_ctx *ctx)
+{
+	const size_t old_capacity = ctx->name_table_capacity;
+	const size_t new_capacity = old_capacity * 2;
+	struct hlist_head *old_array = ctx->name_table;
+	struct hlist_head *new_array;
+	struct extraction_name *ename;
+	struct hlist_node *tmp;
+
+	new_array = CALLOC(new_capacity, sizeof(struct hlist_head));
+	if (!new_array)
+		return;
+	for (size_t i = 0; i < old_capacity; i++) {
+		hlist_for_each_entry_safe(ename, tmp, &old_array[i], hash_node) {
+			u32 hash = hash_utf16le_name(ename->uname,
+						     ename->uname_nbytes);
+			hlist_add_head(&ename->hash_node,
+				       &new_array[hash & (new_capacity - 1)]);
+		}
+	}
+	ctx->name_table = new_array;
+	ctx->name_table_capacity = new_capacity;
+	FREE(old_array);
+}
+
+/* Allocate a new extraction name entry that takes ownership of @tname.  */
+static struct extraction_name *
+new_extraction_name(tchar *tname, size_t tname_nchars)
+{
+	struct extraction_name *ename = MALLOC(sizeof(*ename));
+
+	if (!ename) {
+		FREE(tname);
+		return NULL;
+	}
+	ename->uname = NULL;
+	ename->uname_nbytes = 0;
+	ename->tname = tname;
+	ename->tname_nchars = tname_nchars;
+	return ename;
+}
+
+/* Set the extraction name of @dentry to its WIM name converted to tchars,
+ * reusing the converted name from the table if another dentry with the same
+ * name was already seen.  */
+static int
+dentry_set_interned_extraction_name(struct wim_dentry *dentry,
+				    struct apply_ctx *ctx)
+{
+#if TCHAR_IS_UTF16LE
+	/* No conversion needed.  */
+	dentry->d_extraction_name = dentry->d_name;
+	dentry->d_extraction_name_nchars = dentry->d_name_nbytes /
+					   sizeof(utf16lechar);
+	return 0;
+#else
+	const u32 hash = hash_utf16le_name(dentry->d_name,
+					   dentry->d_name_nbytes);
+	struct hlist_head *bucket;
+	struct extraction_name *ename;
+	tchar *tname;
+	size_t tname_nbytes;
+	int ret;
+
+	bucket = &ctx->name_table[hash & (ctx->name_table_capacity - 1)];
+	hlist_for_each_entry(ename, bucket, hash_node) {
+		if (ename->uname_nbytes == dentry->d_name_nbytes &&
+		    !memcmp(ename->uname, dentry->d_name,
+			    dentry->d_name_nbytes))
+			goto out;
+	}
+
+	ret = utf16le_to_tstr(dentry->d_name, dentry->d_name_nbytes,
+			      &tname, &tname_nbytes);
+	if (ret)
+		return ret;
+
+	ename = new_extraction_name(tname, tname_nbytes / sizeof(tchar));
+	if (!ename)
+		return WIMLIB_ERR_NOMEM;
+	ename->uname = dentry->d_name;
+	ename->uname_nbytes = dentry->d_name_nbytes;
+	hlist_add_head(&ename->hash_node, bucket);
+	if (++ctx->name_table_filled > ctx->name_table_capacity)
+		enlarge_extraction_name_table(ctx);
+out:
+	dentry->d_extraction_name = ename->tname;
+	dentry->d_extraction_name_nchars = ename->tname_nchars;
+	return 0;
+#endif /* !TCHAR_IS_UTF16LE */
+}
+
 static int
 dentry_calculate_extraction_name(struct wim_dentry *dentry,
 				 struct apply_ctx *ctx)
@@ -847,13 +1010,7 @@ dentry_calculate_extraction_name(struct wim_dentry *dentry,
 	}
 
 	if (file_name_valid(dentry->d_name, dentry->d_name_nbytes / 2, false)) {
-		size_t nbytes = 0;
-		ret = utf16le_get_tstr(dentry->d_name,
-				       dentry->d_name_nbytes,
-				       (const tchar **)&dentry->d_extraction_name,
-				       &nbytes);
-		dentry->d_extraction_name_nchars = nbytes / sizeof(tchar);
-		return ret;
+		return dentry_set_interned_extraction_name(dentry, ctx);
 	} else {
 		if (ctx->extract_flags & WIMLIB_EXTRACT_FLAG_REPLACE_INVALID_FILENAMES)
 		{
@@ -898,9 +1055,19 @@ out_replace:
 
 		utf16le_put_tstr(tchar_name);
 
-		dentry->d_extraction_name = TSTRDUP(fixed_name);
-		if (!dentry->d_extraction_name)
+		/* Each replacement name is unique, so it isn't hashed; it is
+		 * only kept in the table to be freed with the other names.  */
+		struct extraction_name *ename;
+		tchar *tname = TSTRDUP(fixed_name);
+
+		if (!tname)
+			return WIMLIB_ERR_NOMEM;
+		ename = new_extraction_name(tname, fixed_name_num_chars);
+		if (!ename)
 			return WIMLIB_ERR_NOMEM;
+		hlist_add_head(&ename->hash_node, &ctx->extra_names);
+
+		dentry->d_extraction_name = ename->tname;
 		dentry->d_extraction_name_nchars = fixed_name_num_chars;
 	}
 	return 0;
@@ -1097,6 +1264,8 @@ ref_stream_if_needed(struct wim_dentry *dentry, struct wim_inode *inode,
 			 * - backend needs to create the file as UNIX symlink
 			 * - backend will extract the stream as externally
 			 *   backed from the WIM archive itself
+			 * - the file is already present and unchanged in the
+			 *   target (incremental extraction)
 			 */
 			if (ctx->apply_ops->will_back_from_wim) {
 				int ret = (*ctx->apply_ops->will_back_from_wim)(dentry, ctx);
@@ -1107,6 +1276,15 @@ ref_stream_if_needed(struct wim_dentry *dentry, struct wim_inode *inode,
 			} else {
 				need_stream = true;
 			}
+			if (need_stream &&
+			    (ctx->extract_flags & WIMLIB_EXTRACT_FLAG_INCREMENTAL))
+			{
+				int ret = (*ctx->apply_ops->is_data_unchanged)(dentry, ctx);
+				if (ret > 0) /* Error?  */
+					return ret;
+				if (ret == 0) /* Unchanged?  */
+					need_stream = false;
+			}
 		}
 		break;
 	case STREAM_TYPE_REPARSE_POINT:
@@ -1437,8 +1615,10 @@ select_apply_operations(int extract_flags)
 
 static int
 extract_trees(WIMStruct *wim, struct wim_dentry **trees, size_t num_trees,
-	      const tchar *target, int extract_flags)
+	      const tchar * const *targets, size_t num_targets,
+	      int extract_flags)
 {
+	const tchar *target = targets[0];
 	const struct apply_operations *ops;
 	struct apply_ctx *ctx;
 	int ret;
@@ -1463,6 +1643,8 @@ extract_trees(WIMStruct *wim, struct wim_dentry **trees, size_t num_trees,
 		goto out;
 	}
 
+	wimlib_assert(num_targets == 1 || ops->supports_multiple_targets);
+
 	ctx = CALLOC(1, ops->context_size);
 	if (!ctx) {
 		ret = WIMLIB_ERR_NOMEM;
@@ -1472,22 +1654,32 @@ extract_trees(WIMStruct *wim, struct wim_dentry **trees, size_t num_trees,
 	ctx->wim = wim;
 	ctx->target = target;
 	ctx->target_nchars = tstrlen(target);
+	ctx->targets = targets;
+	ctx->num_targets = num_targets;
 	ctx->extract_flags = extract_flags;
 	if (ctx->wim->progfunc) {
 		ctx->progfunc = ctx->wim->progfunc;
 		ctx->progctx = ctx->wim->progctx;
-		ctx->progress.extract.image = wim->current_image;
+		if (extract_flags & WIMLIB_EXTRACT_FLAG_ALL_IMAGES) {
+			ctx->progress.extract.image = WIMLIB_ALL_IMAGES;
+		} else {
+			ctx->progress.extract.image = wim->current_image;
+			ctx->progress.extract.image_name =
+				wimlib_get_image_name(wim, wim->current_image);
+		}
 		ctx->progress.extract.extract_flags = (extract_flags &
 						       WIMLIB_EXTRACT_MASK_PUBLIC);
 		ctx->progress.extract.wimfile_name = wim->filename;
-		ctx->progress.extract.image_name = wimlib_get_image_name(wim,
-									 wim->current_image);
 		ctx->progress.extract.target = target;
 	}
 	INIT_LIST_HEAD(&ctx->blob_list);
 	filedes_invalidate(&ctx->tmpfile_fd);
 	ctx->apply_ops = ops;
 
+	ret = init_extraction_name_table(ctx);
+	if (ret)
+		goto out_cleanup;
+
 	ret = (*ops->get_supported_features)(target, &ctx->supported_features);
 	if (ret)
 		goto out_cleanup;
@@ -1522,6 +1714,10 @@ extract_trees(WIMStruct *wim, struct wim_dentry **trees, size_t num_trees,
 	if (ret)
 		goto out_cleanup;
 
+	/* Every target receives its own copy of each stream.  */
+	ctx->progress.extract.total_bytes *= num_targets;
+	ctx->progress.extract.total_streams *= num_targets;
+
 	if (extract_flags & WIMLIB_EXTRACT_FLAG_FROM_PIPE) {
 		/* When extracting from a pipe, the number of bytes of data to
 		 * extract can't be determined in the normal way (examining the
@@ -1571,6 +1767,7 @@ extract_trees(WIMStruct *wim, struct wim_dentry **trees, size_t num_trees,
 out_cleanup:
 	destroy_blob_list(&ctx->blob_list);
 	destroy_dentry_list(&dentry_list);
+	destroy_extraction_name_table(ctx);
 	FREE(ctx);
 out:
 	return ret;
@@ -1673,6 +1870,21 @@ check_extract_flags(const WIMStruct *wim, int *extract_flags_p)
 			extract_flags |= WIMLIB_EXTRACT_FLAG_RPFIX;
 	}
 
+	if (extract_flags & WIMLIB_EXTRACT_FLAG_INCREMENTAL) {
+		const struct apply_operations *ops;
+
+		/* Deleting stale files only makes sense for full images.  */
+		if (!(extract_flags & WIMLIB_EXTRACT_FLAG_IMAGEMODE))
+			return WIMLIB_ERR_INVALID_PARAM;
+
+		ops = select_apply_operations(extract_flags);
+		if (!ops->is_data_unchanged) {
+			ERROR("Incremental extraction is not supported "
+			      "in %s extraction mode!", ops->name);
+			return WIMLIB_ERR_UNSUPPORTED;
+		}
+	}
+
 	*extract_flags_p = extract_flags;
 	return 0;
 }
@@ -1731,7 +1943,8 @@ append_matched_dentries(WIMStruct *wim, const tchar *orig_pattern,
 }
 
 static int
-do_wimlib_extract_paths(WIMStruct *wim, int image, const tchar *target,
+do_wimlib_extract_paths(WIMStruct *wim, int image,
+			const tchar * const *targets, size_t num_targets,
 			const tchar * const *paths, size_t num_paths,
 			int extract_flags)
 {
@@ -1739,10 +1952,13 @@ do_wimlib_extract_paths(WIMStruct *wim, int image, const tchar *target,
 	struct wim_dentry **trees;
 	size_t num_trees;
 
-	if (wim == NULL || target == NULL || target[0] == T('\0') ||
-	    (num_paths != 0 && paths == NULL))
+	if (wim == NULL || (num_paths != 0 && paths == NULL))
 		return WIMLIB_ERR_INVALID_PARAM;
 
+	for (size_t i = 0; i < num_targets; i++)
+		if (targets[i] == NULL || targets[i][0] == T('\0'))
+			return WIMLIB_ERR_INVALID_PARAM;
+
 	ret = check_extract_flags(wim, &extract_flags);
 	if (ret)
 		return ret;
@@ -1759,9 +1975,11 @@ do_wimlib_extract_paths(WIMStruct *wim, int image, const tchar *target,
 			      WIMLIB_EXTRACT_FLAG_NO_PRESERVE_DIR_STRUCTURE)) ==
 	    (WIMLIB_EXTRACT_FLAG_NO_PRESERVE_DIR_STRUCTURE))
 	{
-		ret = mkdir_if_needed(target);
-		if (ret)
-			return ret;
+		for (size_t i = 0; i < num_targets; i++) {
+			ret = mkdir_if_needed(targets[i]);
+			if (ret)
+				return ret;
+		}
 	}
 
 	if (extract_flags & WIMLIB_EXTRACT_FLAG_GLOB_PATHS) {
@@ -1815,7 +2033,8 @@ do_wimlib_extract_paths(WIMStruct *wim, int image, const tchar *target,
 		goto out_free_trees;
 	}
 
-	ret = extract_trees(wim, trees, num_trees, target, extract_flags);
+	ret = extract_trees(wim, trees, num_trees, targets, num_targets,
+			    extract_flags);
 out_free_trees:
 	FREE(trees);
 	return ret;
@@ -1827,7 +2046,8 @@ extract_single_image(WIMStruct *wim, int image,
 {
 	const tchar *path = WIMLIB_WIM_ROOT_PATH;
 	extract_flags |= WIMLIB_EXTRACT_FLAG_IMAGEMODE;
-	return do_wimlib_extract_paths(wim, image, target, &path, 1, extract_flags);
+	return do_wimlib_extract_paths(wim, image, &target, 1, &path, 1,
+				       extract_flags);
 }
 
 static const tchar * const filename_forbidden_chars =
@@ -1849,6 +2069,72 @@ image_name_ok_as_dir(const tchar *image_name)
 		tstrlen(image_name) <= 128;
 }
 
+/*
+ * Extracts all images from the WIM to subdirectories of @target in a single
+ * pass.  The metadata of every image is loaded at the same time, and the root
+ * dentry of each image is given the name of its subdirectory as its extraction
+ * name.  This way, each blob is read and decompressed only once, even if it is
+ * needed by files in many different images.
+ */
+static int
+extract_all_images_in_one_pass(WIMStruct *wim, const tchar *target,
+			       int extract_flags)
+{
+	int image_count = wim->hdr.image_count;
+	struct wim_dentry **trees;
+	tchar (*numbered_names)[12];
+	struct wim_dentry *root;
+	const tchar *image_name;
+	int image;
+	int ret;
+
+	trees = MALLOC(image_count * sizeof(trees[0]));
+	numbered_names = MALLOC(image_count * sizeof(numbered_names[0]));
+	if (!trees || !numbered_names) {
+		ret = WIMLIB_ERR_NOMEM;
+		goto out_free;
+	}
+
+	extract_flags |= WIMLIB_EXTRACT_FLAG_IMAGEMODE |
+			 WIMLIB_EXTRACT_FLAG_ALL_IMAGES;
+	ret = check_extract_flags(wim, &extract_flags);
+	if (ret)
+		goto out_free;
+
+	ret = wim_checksum_unhashed_blobs(wim);
+	if (ret)
+		goto out_free;
+
+	for (image = 1; image <= image_count; image++) {
+		ret = pin_wim_image(wim, image);
+		if (ret)
+			goto out_unpin;
+
+		image_name = wimlib_get_image_name(wim, image);
+		if (!image_name_ok_as_dir(image_name)) {
+			tsprintf(numbered_names[image - 1], T("%d"), image);
+			image_name = numbered_names[image - 1];
+		}
+		root = wim->image_metadata[image - 1]->root_dentry;
+		root->d_extraction_name = (tchar *)image_name;
+		root->d_extraction_name_nchars = tstrlen(image_name);
+		trees[image - 1] = root;
+	}
+
+	ret = extract_trees(wim, trees, image_count, &target, 1, extract_flags);
+out_unpin:
+	while (--image >= 1) {
+		root = wim->image_metadata[image - 1]->root_dentry;
+		root->d_extraction_name = NULL;
+		root->d_extraction_name_nchars = 0;
+		unpin_wim_image(wim, wim->image_metadata[image - 1]);
+	}
+out_free:
+	FREE(numbered_names);
+	FREE(trees);
+	return ret;
+}
+
 /* Extracts all images from the WIM to the directory @target, with the images
  * placed in subdirectories named by their image names. */
 static int
@@ -1868,6 +2154,12 @@ extract_all_images(WIMStruct *wim, const tchar *target, int extract_flags)
 	ret = mkdir_if_needed(target);
 	if (ret)
 		return ret;
+
+	if ((extract_flags & WIMLIB_EXTRACT_FLAG_SINGLE_PASS) &&
+	    wim->hdr.image_count > 1 &&
+	    select_apply_operations(extract_flags)->supports_multi_image)
+		return extract_all_images_in_one_pass(wim, target, extract_flags);
+
 	tmemcpy(buf, target, output_path_len);
 	buf[output_path_len] = OS_PREFERRED_PATH_SEPARATOR;
 	for (image = 1; image <= wim->hdr.image_count; image++) {
@@ -1901,6 +2193,46 @@ do_wimlib_extract_image(WIMStruct *wim, int image, const tchar *target,
 		return extract_single_image(wim, image, target, extract_flags);
 }
 
+/*
+ * Extracts a single image to each of the directories @targets.  If the
+ * extraction backend supports it, up to MAX_OPEN_FILES targets are extracted
+ * in each pass, so each blob is only read and decompressed once per pass rather
+ * than once per target.
+ */
+static int
+extract_image_to_targets(WIMStruct *wim, int image,
+			 const tchar * const *targets, size_t num_targets,
+			 int extract_flags)
+{
+	const tchar *path = WIMLIB_WIM_ROOT_PATH;
+	size_t batch_size = 1;
+	int ret;
+
+	if (targets == NULL || num_targets == 0)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	if (extract_flags & (WIMLIB_EXTRACT_FLAG_NO_PRESERVE_DIR_STRUCTURE |
+			     WIMLIB_EXTRACT_FLAG_TO_STDOUT |
+			     WIMLIB_EXTRACT_FLAG_GLOB_PATHS))
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	if (image == WIMLIB_ALL_IMAGES)
+		return WIMLIB_ERR_INVALID_IMAGE;
+
+	extract_flags |= WIMLIB_EXTRACT_FLAG_IMAGEMODE;
+
+	if (select_apply_operations(extract_flags)->supports_multiple_targets)
+		batch_size = MAX_OPEN_FILES;
+
+	for (size_t i = 0; i < num_targets; i += batch_size) {
+		ret = do_wimlib_extract_paths(wim, image, &targets[i],
+					      min(batch_size, num_targets - i),
+					      &path, 1, extract_flags);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
 
 /****************************************************************************
  *                          Extraction API                                  *
@@ -1914,7 +2246,7 @@ wimlib_extract_paths(WIMStruct *wim, int image, const tchar *target,
 	if (extract_flags & ~WIMLIB_EXTRACT_MASK_PUBLIC)
 		return WIMLIB_ERR_INVALID_PARAM;
 
-	return do_wimlib_extract_paths(wim, image, target, paths, num_paths,
+	return do_wimlib_extract_paths(wim, image, &target, 1, paths, num_paths,
 				       extract_flags);
 }
 
@@ -2078,3 +2410,14 @@ wimlib_extract_image(WIMStruct *wim, int image, const tchar *target,
 		return WIMLIB_ERR_INVALID_PARAM;
 	return do_wimlib_extract_image(wim, image, target, extract_flags);
 }
+
+WIMLIBAPI int
+wimlib_extract_image_to_targets(WIMStruct *wim, int image,
+				const tchar * const *targets,
+				size_t num_targets, int extract_flags)
+{
+	if (extract_flags & ~WIMLIB_EXTRACT_MASK_PUBLIC)
+		return WIMLIB_ERR_INVALID_PARAM;
+	return extract_image_to_targets(wim, image, targets, num_targets,
+					extract_flags);
+}
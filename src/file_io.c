@@ -24,6 +24,7 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "wimlib/error.h"
@@ -210,3 +211,40 @@ bool filedes_is_seekable(struct filedes *fd)
 {
 	return !fd->is_pipe && lseek(fd->fd, 0, SEEK_CUR) != -1;
 }
+
+/*
+ * Start writing back the data in the range [@start, @end) of @fd to disk, then
+ * wait for the writeback of the range [@prev_start, @start), which should have
+ * been started by the previous call.  Calling this periodically while writing a
+ * large file bounds the amount of dirty data, so that a final fsync() has little
+ * left to do and doesn't stall the system's I/O all at once.
+ *
+ * This is only a hint: errors are ignored, and it does nothing where
+ * sync_file_range() isn't available.
+ */
+void
+filedes_writeback(struct filedes *fd, off_t prev_start, off_t start, off_t end)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	if (end > start)
+		sync_file_range(fd->fd, start, end - start,
+				SYNC_FILE_RANGE_WRITE);
+	if (start > prev_start)
+		sync_file_range(fd->fd, prev_start, start - prev_start,
+				SYNC_FILE_RANGE_WAIT_BEFORE |
+				SYNC_FILE_RANGE_WRITE |
+				SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+}
+
+/* Sync the data of @fd to disk, along with only the metadata needed to read it
+ * back.  Returns 0 on success or -1 with errno set on failure.  */
+int
+filedes_sync_data(struct filedes *fd)
+{
+#ifdef HAVE_FDATASYNC
+	return fdatasync(fd->fd);
+#else
+	return fsync(fd->fd);
+#endif
+}
@@ -325,7 +325,8 @@ write_integrity_table(WIMStruct *wim,
 					     0,
 					     &wim->out_hdr.integrity_table_reshdr,
 					     NULL,
-					     0);
+					     0,
+					     1);
 	FREE(new_table);
 	return ret;
 }
@@ -147,9 +147,15 @@ recalculate_security_data_length(struct wim_security_data *sd)
 	sd->total_length = ALIGN(total_length, 8);
 }
 
+/*
+ * Build the uncompressed metadata resource for the specified image.  If
+ * @old_len is nonzero, the dentry tree was read from a metadata resource of
+ * that length, and the layout of that resource is kept where possible.  Up to
+ * @num_threads threads (0 means the default number) write the dentry tree.
+ */
 static int
-prepare_metadata_resource(WIMStruct *wim, int image,
-			  u8 **buf_ret, size_t *len_ret)
+prepare_metadata_resource(WIMStruct *wim, int image, u64 old_len,
+			  unsigned num_threads, u8 **buf_ret, size_t *len_ret)
 {
 	u8 *buf;
 	u8 *p;
@@ -184,8 +190,14 @@ prepare_metadata_resource(WIMStruct *wim, int image,
 	recalculate_security_data_length(sd);
 	subdir_offset = sd->total_length + dentry_out_total_length(root) + 8;
 
-	/* Calculate the subdirectory offsets for the entire dentry tree.  */
-	calculate_subdir_offsets(root, &subdir_offset);
+	/* Calculate the subdirectory offsets for the entire dentry tree.  When
+	 * keeping the old layout, there may be unused space, which is zeroed.  */
+	if (!old_len || !calculate_subdir_offsets_in_place(root, &subdir_offset,
+							   old_len))
+	{
+		old_len = 0;
+		calculate_subdir_offsets(root, &subdir_offset);
+	}
 
 	/* Total length of the metadata resource (uncompressed).  */
 	len = subdir_offset;
@@ -193,7 +205,7 @@ prepare_metadata_resource(WIMStruct *wim, int image,
 	/* Allocate a buffer to contain the uncompressed metadata resource.  */
 	buf = NULL;
 	if (likely(len == subdir_offset))
-		buf = MALLOC(len);
+		buf = old_len ? CALLOC(1, len) : MALLOC(len);
 	if (!buf) {
 		ERROR("Failed to allocate %"PRIu64" bytes for "
 		      "metadata resource", subdir_offset);
@@ -204,10 +216,11 @@ prepare_metadata_resource(WIMStruct *wim, int image,
 	p = write_wim_security_data(sd, buf);
 
 	/* Write the dentry tree into the resource buffer.  */
-	p = write_dentry_tree(root, p);
+	p = write_dentry_tree(root, buf, p, num_threads);
 
-	/* We MUST have exactly filled the buffer; otherwise we calculated its
-	 * size incorrectly or wrote the data incorrectly.  */
+	/* The last directory written MUST end exactly at the end of the buffer;
+	 * otherwise we calculated its size incorrectly or wrote the data
+	 * incorrectly.  */
 	wimlib_assert(p - buf == len);
 
 	*buf_ret = buf;
@@ -216,31 +229,62 @@ prepare_metadata_resource(WIMStruct *wim, int image,
 }
 
 int
-write_metadata_resource(WIMStruct *wim, int image, int write_resource_flags)
+write_metadata_resource(WIMStruct *wim, int image, int write_resource_flags,
+			unsigned num_threads)
 {
 	int ret;
 	u8 *buf;
 	size_t len;
 	struct wim_image_metadata *imd;
+	const struct blob_descriptor *prev_blob;
+
+	imd = wim->image_metadata[image - 1];
 
-	ret = prepare_metadata_resource(wim, image, &buf, &len);
+	/* If the image was read from a metadata resource whose compressed
+	 * chunks can be copied, keep its layout so that after a small change
+	 * most of the chunks are the same and don't have to be compressed
+	 * again.  */
+	prev_blob = imd->prev_metadata_blob;
+	if (prev_blob && !can_reuse_resource_chunks(prev_blob,
+						    wim->out_compression_type,
+						    wim->out_chunk_size,
+						    write_resource_flags))
+		prev_blob = NULL;
+
+	ret = prepare_metadata_resource(wim, image,
+					prev_blob ? prev_blob->size : 0,
+					num_threads, &buf, &len);
 	if (ret)
 		return ret;
 
-	imd = wim->image_metadata[image - 1];
-
 	/* Write the metadata resource to the output WIM using the proper
 	 * compression type, in the process updating the blob descriptor for the
 	 * metadata resource.  */
-	ret = write_wim_resource_from_buffer(buf,
-					     len,
-					     true,
-					     &wim->out_fd,
-					     wim->out_compression_type,
-					     wim->out_chunk_size,
-					     &imd->metadata_blob->out_reshdr,
-					     imd->metadata_blob->hash,
-					     write_resource_flags);
+	if (prev_blob) {
+		ret = write_wim_resource_from_buffer_reusing_chunks(
+						buf,
+						len,
+						true,
+						prev_blob,
+						&wim->out_fd,
+						wim->out_compression_type,
+						wim->out_chunk_size,
+						&imd->metadata_blob->out_reshdr,
+						imd->metadata_blob->hash,
+						write_resource_flags,
+						num_threads);
+	} else {
+		ret = write_wim_resource_from_buffer(buf,
+						     len,
+						     true,
+						     &wim->out_fd,
+						     wim->out_compression_type,
+						     wim->out_chunk_size,
+						     &imd->metadata_blob->out_reshdr,
+						     imd->metadata_blob->hash,
+						     write_resource_flags,
+						     num_threads);
+	}
 
 	FREE(buf);
 	return ret;
@@ -0,0 +1,231 @@
+/*
+ * read_blob.c
+ *
+ * Read file data from a WIM file into memory.  This is the stable API; internal
+ * code can just use the functions in resource.c.
+ *
+ * Unlike most API functions, the functions in this file may be called
+ * concurrently on the same WIMStruct, provided that it was opened with
+ * WIMLIB_OPEN_FLAG_CONCURRENT_READS.  They therefore must not modify the
+ * WIMStruct, its blob table, or its images in that case.  Everything they need
+ * that is mutable (chunk buffers, decompressors, cached solid resource chunk
+ * tables) is handled in a thread-safe way by resource.c.
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+
+#include "wimlib.h"
+#include "wimlib/blob_table.h"
+#include "wimlib/dentry.h"
+#include "wimlib/error.h"
+#include "wimlib/inode.h"
+#include "wimlib/metadata.h"
+#include "wimlib/paths.h"
+#include "wimlib/resource.h"
+#include "wimlib/sha1.h"
+#include "wimlib/wim.h"
+
+/* Read the full data of @blob into a newly allocated buffer.  */
+static int
+read_blob_to_new_buf(const struct blob_descriptor *blob,
+		     void **buf_ret, size_t *bufsize_ret)
+{
+	int ret;
+
+	if (!blob) {
+		*buf_ret = NULL;
+		*bufsize_ret = 0;
+		return 0;
+	}
+
+	ret = read_blob_into_alloc_buf(blob, buf_ret);
+	if (ret)
+		return ret;
+	*bufsize_ret = blob->size;
+	return 0;
+}
+
+/* Look up the blob with the specified SHA-1 message digest for reading.  */
+static int
+lookup_blob_for_read(WIMStruct *wim, const u8 hash[SHA1_HASH_SIZE],
+		     const struct blob_descriptor **blob_ret)
+{
+	const struct blob_descriptor *blob;
+
+	blob = lookup_blob(wim->blob_table, hash);
+	if (!blob) {
+		if (wimlib_print_errors) {
+			tchar hashstr[SHA1_HASH_SIZE * 2 + 1];
+
+			sprint_hash(hash, hashstr);
+			ERROR("Blob not found: %"TS, hashstr);
+		}
+		return WIMLIB_ERR_RESOURCE_NOT_FOUND;
+	}
+	*blob_ret = blob;
+	return 0;
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI int
+wimlib_read_blob_into_buf(WIMStruct *wim, const u8 hash[SHA1_HASH_SIZE],
+			  void **buf_ret, size_t *bufsize_ret)
+{
+	const struct blob_descriptor *blob = NULL;
+	int ret;
+
+	if (!wim || !hash || !buf_ret || !bufsize_ret)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	if (!is_zero_hash(hash)) {
+		ret = lookup_blob_for_read(wim, hash, &blob);
+		if (ret)
+			return ret;
+	}
+	return read_blob_to_new_buf(blob, buf_ret, bufsize_ret);
+}
+
+struct read_blob_api_ctx {
+	wimlib_read_blob_callback_t cb;
+	void *user_ctx;
+};
+
+static int
+read_blob_api_cb(const void *chunk, size_t size, void *_ctx)
+{
+	const struct read_blob_api_ctx *ctx = _ctx;
+
+	return (*ctx->cb)(chunk, size, ctx->user_ctx);
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI int
+wimlib_read_blob(WIMStruct *wim, const u8 hash[SHA1_HASH_SIZE],
+		 uint64_t offset, uint64_t size,
+		 wimlib_read_blob_callback_t cb, void *user_ctx)
+{
+	const struct blob_descriptor *blob = NULL;
+	u64 blob_size = 0;
+	int ret;
+
+	if (!wim || !hash || !cb)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	if (!is_zero_hash(hash)) {
+		ret = lookup_blob_for_read(wim, hash, &blob);
+		if (ret)
+			return ret;
+		blob_size = blob->size;
+	}
+
+	if (offset > blob_size || size > blob_size - offset)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	if (!size)
+		return 0;
+
+	struct read_blob_api_ctx ctx = {
+		.cb = cb,
+		.user_ctx = user_ctx,
+	};
+	struct consume_chunk_callback chunk_cb = {
+		.func = read_blob_api_cb,
+		.ctx = &ctx,
+	};
+	return read_blob_range(blob, offset, size, &chunk_cb);
+}
+
+/*
+ * Look up the file at @path in the specified image of the WIM.  If the WIM was
+ * opened for concurrent reads, then all images are already loaded and the
+ * image's tree is searched without selecting the image.  Otherwise the image
+ * is selected as usual, loading it if needed.
+ */
+static int
+lookup_file_for_read(WIMStruct *wim, int image, const tchar *path,
+		     struct wim_dentry **dentry_ret)
+{
+	struct wim_dentry *root;
+	struct wim_dentry *dentry;
+	int ret;
+
+	if (image < 1 || image > wim->hdr.image_count)
+		return WIMLIB_ERR_INVALID_IMAGE;
+
+	if (!wim_has_metadata(wim))
+		return WIMLIB_ERR_METADATA_NOT_FOUND;
+
+	if (wim->concurrent_reads) {
+		root = wim->image_metadata[image - 1]->root_dentry;
+	} else {
+		ret = select_wim_image(wim, image);
+		if (ret)
+			return ret;
+		root = wim_get_current_root_dentry(wim);
+	}
+
+	dentry = get_dentry_in_tree(root, path, WIMLIB_CASE_PLATFORM_DEFAULT);
+	if (!dentry) {
+		ERROR_WITH_ERRNO("Can't find \"%"TS"\" in WIM image", path);
+		return WIMLIB_ERR_PATH_DOES_NOT_EXIST;
+	}
+	*dentry_ret = dentry;
+	return 0;
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI int
+wimlib_read_file_into_buf(WIMStruct *wim, int image, const tchar *path,
+			  void **buf_ret, size_t *bufsize_ret)
+{
+	struct wim_dentry *dentry;
+	const struct wim_inode *inode;
+	const struct blob_descriptor *blob;
+	int ret;
+
+	if (!wim || !path || !buf_ret || !bufsize_ret)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	ret = lookup_file_for_read(wim, image, path, &dentry);
+	if (ret)
+		return ret;
+
+	inode = dentry->d_inode;
+	if (inode->i_attributes & (FILE_ATTRIBUTE_REPARSE_POINT |
+				   FILE_ATTRIBUTE_DIRECTORY |
+				   FILE_ATTRIBUTE_ENCRYPTED))
+	{
+		ERROR("\"%"TS"\" is not a regular file", path);
+		return WIMLIB_ERR_NOT_A_REGULAR_FILE;
+	}
+
+	blob = inode_get_blob_for_unnamed_data_stream(inode, wim->blob_table);
+	if (!blob) {
+		const u8 *hash = inode_get_hash_of_unnamed_data_stream(inode);
+
+		if (!is_zero_hash(hash)) {
+			ERROR("\"%"TS"\": blob not found", path);
+			return WIMLIB_ERR_RESOURCE_NOT_FOUND;
+		}
+	}
+	return read_blob_to_new_buf(blob, buf_ret, bufsize_ret);
+}
@@ -27,10 +27,12 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "wimlib/alloca.h"
 #include "wimlib/assert.h"
+#include "wimlib/avl_tree.h"
 #include "wimlib/bitops.h"
 #include "wimlib/blob_table.h"
 #include "wimlib/endianness.h"
@@ -83,6 +85,775 @@ struct data_range {
 	u64 size;
 };
 
+/* Maximum number of idle decompressors kept in the decompressor pool.  */
+#define DECOMPRESSOR_POOL_SIZE	8
+
+/*
+ * Pool of idle decompressors, shared by all threads and keyed by compression
+ * type and maximum block size.  Each read of a compressed resource borrows a
+ * decompressor from the pool and returns it when done.  Normally all data in a
+ * WIM file uses the same compression type and chunk size, but a WIM may contain
+ * e.g. both LZX non-solid resources and LZMS solid resources; keeping several
+ * decompressors around avoids recreating them when switching between the two.
+ * Concurrent readers simply borrow different decompressors.
+ */
+static struct {
+	pthread_mutex_t lock;
+
+	/* Idle decompressors, most recently returned first  */
+	struct {
+		struct wimlib_decompressor *decompressor;
+		int ctype;
+		u32 max_block_size;
+	} idle[DECOMPRESSOR_POOL_SIZE];
+	unsigned num_idle;
+
+	struct wimlib_decompressor_pool_stats stats;
+} decompressor_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Borrow a decompressor for the specified compression type and maximum block
+ * size from the decompressor pool, creating one if none is idle.  */
+static int
+borrow_decompressor(int ctype, u32 max_block_size,
+		    struct wimlib_decompressor **decompressor_ret)
+{
+	struct wimlib_decompressor *decompressor = NULL;
+	int ret;
+
+	pthread_mutex_lock(&decompressor_pool.lock);
+	for (unsigned i = 0; i < decompressor_pool.num_idle; i++) {
+		if (decompressor_pool.idle[i].ctype == ctype &&
+		    decompressor_pool.idle[i].max_block_size == max_block_size)
+		{
+			decompressor = decompressor_pool.idle[i].decompressor;
+			memmove(&decompressor_pool.idle[i],
+				&decompressor_pool.idle[i + 1],
+				(decompressor_pool.num_idle - i - 1) *
+					sizeof(decompressor_pool.idle[0]));
+			decompressor_pool.num_idle--;
+			decompressor_pool.stats.num_reused++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&decompressor_pool.lock);
+
+	if (likely(decompressor)) {
+		*decompressor_ret = decompressor;
+		return 0;
+	}
+
+	ret = wimlib_create_decompressor(ctype, max_block_size, &decompressor);
+	if (unlikely(ret))
+		return ret;
+
+	pthread_mutex_lock(&decompressor_pool.lock);
+	decompressor_pool.stats.num_created++;
+	pthread_mutex_unlock(&decompressor_pool.lock);
+
+	*decompressor_ret = decompressor;
+	return 0;
+}
+
+/* Return a decompressor to the decompressor pool.  If the pool is full, the
+ * least recently returned decompressor is freed.  */
+static void
+return_decompressor(struct wimlib_decompressor *decompressor,
+		    int ctype, u32 max_block_size)
+{
+	struct wimlib_decompressor *evicted = NULL;
+
+	pthread_mutex_lock(&decompressor_pool.lock);
+	if (decompressor_pool.num_idle == DECOMPRESSOR_POOL_SIZE) {
+		evicted = decompressor_pool.idle[--decompressor_pool.num_idle].
+								decompressor;
+		decompressor_pool.stats.num_freed++;
+	}
+	memmove(&decompressor_pool.idle[1], &decompressor_pool.idle[0],
+		decompressor_pool.num_idle * sizeof(decompressor_pool.idle[0]));
+	decompressor_pool.idle[0].decompressor = decompressor;
+	decompressor_pool.idle[0].ctype = ctype;
+	decompressor_pool.idle[0].max_block_size = max_block_size;
+	decompressor_pool.num_idle++;
+	pthread_mutex_unlock(&decompressor_pool.lock);
+
+	wimlib_free_decompressor(evicted);
+}
+
+/* Free all idle decompressors in the decompressor pool.  */
+void
+free_decompressor_pool(void)
+{
+	pthread_mutex_lock(&decompressor_pool.lock);
+	while (decompressor_pool.num_idle) {
+		wimlib_free_decompressor(decompressor_pool.idle[
+				--decompressor_pool.num_idle].decompressor);
+		decompressor_pool.stats.num_freed++;
+	}
+	pthread_mutex_unlock(&decompressor_pool.lock);
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI void
+wimlib_get_decompressor_pool_stats(struct wimlib_decompressor_pool_stats *stats)
+{
+	pthread_mutex_lock(&decompressor_pool.lock);
+	*stats = decompressor_pool.stats;
+	stats->num_idle = decompressor_pool.num_idle;
+	pthread_mutex_unlock(&decompressor_pool.lock);
+}
+
+/*
+ * Cache of the uncompressed data of recently read blobs, shared by all threads
+ * and WIMStructs and keyed by SHA-1 message digest.  It is disabled until the
+ * application gives it a memory budget with wimlib_set_blob_cache_size().
+ *
+ * When enabled, each blob which is read in full from a compressed WIM resource
+ * is added to the cache, evicting the least recently used blobs to stay within
+ * the budget.  A later full read of a blob with the same contents, for example
+ * when the same image is exported to several WIM files or a file is extracted
+ * to several places, is then satisfied without decompressing it again.
+ */
+struct blob_cache_entry {
+	struct avl_tree_node index_node;
+
+	/* Link in blob_cache.lru_list  */
+	struct list_head lru_list;
+
+	u8 hash[SHA1_HASH_SIZE];
+	size_t size;
+
+	/* Number of readers using @data, plus 1 while the entry is in the
+	 * cache  */
+	u32 refcnt;
+
+	u8 data[];
+};
+
+/* Blobs larger than this fraction of the cache budget are not cached, so that
+ * a single large blob can't evict everything else.  */
+#define BLOB_CACHE_MAX_ENTRY_FRACTION	8
+
+static struct {
+	pthread_mutex_t lock;
+
+	/* Cached blobs indexed by SHA-1 message digest  */
+	struct avl_tree_node *index;
+
+	/* Cached blobs, most recently used first  */
+	struct list_head lru_list;
+
+	u64 max_bytes;
+
+	struct wimlib_blob_cache_stats stats;
+} blob_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.lru_list = LIST_HEAD_INIT(blob_cache.lru_list),
+};
+
+static int
+_cmp_blob_cache_entries(const struct avl_tree_node *n1,
+			const struct avl_tree_node *n2)
+{
+	return hashes_cmp(avl_tree_entry(n1, struct blob_cache_entry,
+					 index_node)->hash,
+			  avl_tree_entry(n2, struct blob_cache_entry,
+					 index_node)->hash);
+}
+
+static int
+_cmp_blob_cache_entry_with_hash(const void *hash,
+				const struct avl_tree_node *node)
+{
+	return hashes_cmp(hash, avl_tree_entry(node, struct blob_cache_entry,
+					       index_node)->hash);
+}
+
+/* Returns %true iff it is worth caching the data of @blob.  Only blobs in
+ * compressed WIM resources are cached, since only they are expensive to read
+ * again.  The cache lock must be held.  */
+static bool
+blob_is_cacheable(const struct blob_descriptor *blob)
+{
+	return blob->blob_location == BLOB_IN_WIM &&
+		!blob->unhashed &&
+		(blob->rdesc->flags & (WIM_RESHDR_FLAG_COMPRESSED |
+				       WIM_RESHDR_FLAG_SOLID)) &&
+		blob->size != 0 &&
+		blob->size <= blob_cache.max_bytes /
+				BLOB_CACHE_MAX_ENTRY_FRACTION;
+}
+
+static void
+put_blob_cache_entry_locked(struct blob_cache_entry *entry)
+{
+	if (--entry->refcnt == 0)
+		FREE(entry);
+}
+
+static void
+put_blob_cache_entry(struct blob_cache_entry *entry)
+{
+	pthread_mutex_lock(&blob_cache.lock);
+	put_blob_cache_entry_locked(entry);
+	pthread_mutex_unlock(&blob_cache.lock);
+}
+
+static void
+evict_blob_cache_entry(struct blob_cache_entry *entry)
+{
+	avl_tree_remove(&blob_cache.index, &entry->index_node);
+	list_del(&entry->lru_list);
+	blob_cache.stats.cached_bytes -= entry->size;
+	blob_cache.stats.num_cached--;
+	blob_cache.stats.num_evicted++;
+	put_blob_cache_entry_locked(entry);
+}
+
+/* Evict the least recently used blobs until the cache uses at most @max_bytes.
+ * The cache lock must be held.  */
+static void
+shrink_blob_cache(u64 max_bytes)
+{
+	while (blob_cache.stats.cached_bytes > max_bytes) {
+		evict_blob_cache_entry(list_last_entry(&blob_cache.lru_list,
+						       struct blob_cache_entry,
+						       lru_list));
+	}
+}
+
+/* Look up the data of @blob in the blob cache.  On a hit, return the entry with
+ * a reference that the caller must drop with put_blob_cache_entry().  Also
+ * return in @cacheable_ret whether @blob may be cached at all.  */
+static struct blob_cache_entry *
+lookup_blob_cache_entry(const struct blob_descriptor *blob, bool *cacheable_ret)
+{
+	struct blob_cache_entry *entry = NULL;
+	struct avl_tree_node *node;
+
+	pthread_mutex_lock(&blob_cache.lock);
+	*cacheable_ret = blob_is_cacheable(blob);
+	if (*cacheable_ret) {
+		node = avl_tree_lookup(blob_cache.index, blob->hash,
+				       _cmp_blob_cache_entry_with_hash);
+		if (node) {
+			entry = avl_tree_entry(node, struct blob_cache_entry,
+					       index_node);
+			entry->refcnt++;
+			list_move(&entry->lru_list, &blob_cache.lru_list);
+			blob_cache.stats.num_hits++;
+			blob_cache.stats.hit_bytes += entry->size;
+		}
+	}
+	pthread_mutex_unlock(&blob_cache.lock);
+	return entry;
+}
+
+/* Returns %true iff the data of @blob is currently in the blob cache.  Unlike
+ * lookup_blob_cache_entry(), this doesn't count as a hit or a miss.  */
+static bool
+blob_is_in_cache(const struct blob_descriptor *blob)
+{
+	bool in_cache;
+
+	pthread_mutex_lock(&blob_cache.lock);
+	in_cache = blob_is_cacheable(blob) &&
+		   avl_tree_lookup(blob_cache.index, blob->hash,
+				   _cmp_blob_cache_entry_with_hash) != NULL;
+	pthread_mutex_unlock(&blob_cache.lock);
+	return in_cache;
+}
+
+/* Allocate a blob cache entry into which the data of @blob can be read, or
+ * return NULL if @blob shouldn't be cached.  This is called for each cacheable
+ * blob that is actually read, so it is also where cache misses are counted;
+ * when the blobs of a solid resource are read together, only the first one is
+ * looked up in the cache.  */
+static struct blob_cache_entry *
+new_blob_cache_entry(const struct blob_descriptor *blob)
+{
+	struct blob_cache_entry *entry;
+	bool cacheable;
+
+	pthread_mutex_lock(&blob_cache.lock);
+	cacheable = blob_is_cacheable(blob);
+	if (cacheable)
+		blob_cache.stats.num_misses++;
+	pthread_mutex_unlock(&blob_cache.lock);
+
+	if (!cacheable)
+		return NULL;
+
+	/* Failing to allocate the entry isn't an error; the blob just won't be
+	 * cached.  */
+	entry = MALLOC(sizeof(*entry) + blob->size);
+	if (entry) {
+		copy_hash(entry->hash, blob->hash);
+		entry->size = blob->size;
+		entry->refcnt = 1;
+	}
+	return entry;
+}
+
+/* Add a filled-in entry to the blob cache, or free it if the cache already has
+ * the blob or no longer has room for it.  */
+static void
+insert_blob_cache_entry(struct blob_cache_entry *entry)
+{
+	pthread_mutex_lock(&blob_cache.lock);
+	if (entry->size > blob_cache.max_bytes / BLOB_CACHE_MAX_ENTRY_FRACTION ||
+	    avl_tree_insert(&blob_cache.index, &entry->index_node,
+			    _cmp_blob_cache_entries))
+	{
+		put_blob_cache_entry_locked(entry);
+	} else {
+		list_add(&entry->lru_list, &blob_cache.lru_list);
+		blob_cache.stats.cached_bytes += entry->size;
+		blob_cache.stats.num_cached++;
+		blob_cache.stats.num_inserted++;
+		shrink_blob_cache(blob_cache.max_bytes);
+	}
+	pthread_mutex_unlock(&blob_cache.lock);
+}
+
+/* Free all blobs in the blob cache.  */
+void
+free_blob_cache(void)
+{
+	pthread_mutex_lock(&blob_cache.lock);
+	shrink_blob_cache(0);
+	pthread_mutex_unlock(&blob_cache.lock);
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI void
+wimlib_set_blob_cache_size(uint64_t max_bytes)
+{
+	pthread_mutex_lock(&blob_cache.lock);
+	blob_cache.max_bytes = max_bytes;
+	shrink_blob_cache(max_bytes);
+	pthread_mutex_unlock(&blob_cache.lock);
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI void
+wimlib_get_blob_cache_stats(struct wimlib_blob_cache_stats *stats)
+{
+	pthread_mutex_lock(&blob_cache.lock);
+	*stats = blob_cache.stats;
+	stats->max_bytes = blob_cache.max_bytes;
+	pthread_mutex_unlock(&blob_cache.lock);
+}
+
+/* Largest chunk buffers, and largest chunk offsets array, that a thread keeps
+ * in its read context between reads.  This covers the chunk sizes used by
+ * non-solid resources.  Larger buffers, e.g. for the 64 MiB chunks of LZMS
+ * solid resources, are instead put into the large chunk buffer pool when the
+ * read is done, so that every thread which once read such a chunk doesn't hold
+ * on to over 128 MiB of memory.  */
+#define READ_CTX_MAX_CACHED_BUF_SIZE		(1 << 21)
+#define READ_CTX_MAX_CACHED_CHUNK_OFFSETS	(1 << 16)
+
+/* Maximum number of pairs of large chunk buffers kept in the pool  */
+#define LARGE_CHUNK_BUF_POOL_SIZE		2
+
+/*
+ * Per-thread state for reading compressed resources.  This holds the scratch
+ * buffers needed by read_compressed_wim_resource() so that, in the steady
+ * state, reads don't allocate any memory.  The buffers grow to the largest
+ * chunk size the thread has read, up to READ_CTX_MAX_CACHED_BUF_SIZE; larger
+ * buffers come from the large chunk buffer pool.
+ *
+ * The uncompressed data of the last chunk read also stays in @ubuf, and is
+ * reused if the next read needs the same chunk.  This makes a series of small
+ * reads from the same chunk, e.g. reads of consecutive ranges of a blob, only
+ * decompress that chunk once.
+ */
+struct read_ctx {
+
+	/* Buffers for the uncompressed and compressed data of one chunk; each
+	 * is @buf_size bytes.  */
+	u8 *ubuf;
+	u8 *cbuf;
+	size_t buf_size;
+
+	/* Array of chunk offsets, used for resources whose chunk table is not
+	 * cached in the resource descriptor; @num_chunk_offsets entries.  */
+	u64 *chunk_offsets;
+	size_t num_chunk_offsets;
+
+	/* If @ubuf_chunk_valid, then @ubuf holds the uncompressed data of chunk
+	 * @ubuf_chunk of the resource at offset @ubuf_res_offset in the WIM
+	 * file whose WIMStruct has data_serial @ubuf_wim_serial.  */
+	u64 ubuf_wim_serial;
+	u64 ubuf_res_offset;
+	u64 ubuf_chunk;
+	bool ubuf_chunk_valid;
+
+	/* True if a read is currently using this context  */
+	bool in_use;
+
+	/* True if this is not a thread's cached context but rather one that
+	 * must be freed as soon as the read using it is done.  */
+	bool temporary;
+};
+
+/*
+ * Pool of idle chunk buffers larger than READ_CTX_MAX_CACHED_BUF_SIZE, shared
+ * by all threads.  A read that needs such buffers takes a pair from the pool
+ * and gives it back when done, so that consecutive reads of large chunks don't
+ * allocate and free them each time, while the memory held by idle buffers stays
+ * bounded no matter how many threads have read large chunks.  A pair of buffers
+ * keeps the identity of the chunk in its uncompressed buffer, so a read that
+ * gets the pair back can still reuse that chunk.
+ */
+struct large_chunk_bufs {
+	u8 *ubuf;
+	u8 *cbuf;
+	size_t buf_size;
+	u64 ubuf_wim_serial;
+	u64 ubuf_res_offset;
+	u64 ubuf_chunk;
+	bool ubuf_chunk_valid;
+};
+
+static struct {
+	pthread_mutex_t lock;
+
+	/* Idle buffers, most recently returned first  */
+	struct large_chunk_bufs idle[LARGE_CHUNK_BUF_POOL_SIZE];
+	unsigned num_idle;
+} large_chunk_buf_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_key_t read_ctx_key;
+static pthread_once_t read_ctx_key_once = PTHREAD_ONCE_INIT;
+static bool read_ctx_key_valid;
+
+static void
+free_read_ctx(void *_ctx)
+{
+	struct read_ctx *ctx = _ctx;
+
+	FREE(ctx->ubuf);
+	FREE(ctx->cbuf);
+	FREE(ctx->chunk_offsets);
+	FREE(ctx);
+}
+
+static void
+init_read_ctx_key(void)
+{
+	read_ctx_key_valid = !pthread_key_create(&read_ctx_key, free_read_ctx);
+}
+
+/*
+ * Get a read context for the calling thread.  Normally this is the thread's
+ * cached context.  But if that is already in use, which can happen if a
+ * callback reads another resource, or if it can't be cached, then a temporary
+ * context is returned instead.  Returns NULL if out of memory.
+ */
+static struct read_ctx *
+get_read_ctx(void)
+{
+	struct read_ctx *ctx = NULL;
+
+	pthread_once(&read_ctx_key_once, init_read_ctx_key);
+
+	if (likely(read_ctx_key_valid)) {
+		ctx = pthread_getspecific(read_ctx_key);
+		if (unlikely(!ctx)) {
+			ctx = CALLOC(1, sizeof(*ctx));
+			if (ctx && pthread_setspecific(read_ctx_key, ctx)) {
+				FREE(ctx);
+				ctx = NULL;
+			}
+		}
+	}
+
+	if (unlikely(!ctx || ctx->in_use)) {
+		ctx = CALLOC(1, sizeof(*ctx));
+		if (!ctx)
+			return NULL;
+		ctx->temporary = true;
+	}
+	ctx->in_use = true;
+	return ctx;
+}
+
+/* Move the chunk buffers of the read context, which must be larger than
+ * READ_CTX_MAX_CACHED_BUF_SIZE, into the large chunk buffer pool.  If the pool
+ * is full, the least recently returned buffers are freed.  */
+static void
+return_large_chunk_bufs(struct read_ctx *ctx)
+{
+	struct large_chunk_bufs evicted = { 0 };
+
+	pthread_mutex_lock(&large_chunk_buf_pool.lock);
+	if (large_chunk_buf_pool.num_idle == LARGE_CHUNK_BUF_POOL_SIZE)
+		evicted = large_chunk_buf_pool.idle[--large_chunk_buf_pool.num_idle];
+	memmove(&large_chunk_buf_pool.idle[1], &large_chunk_buf_pool.idle[0],
+		large_chunk_buf_pool.num_idle *
+			sizeof(large_chunk_buf_pool.idle[0]));
+	large_chunk_buf_pool.idle[0] = (struct large_chunk_bufs) {
+		.ubuf = ctx->ubuf,
+		.cbuf = ctx->cbuf,
+		.buf_size = ctx->buf_size,
+		.ubuf_wim_serial = ctx->ubuf_wim_serial,
+		.ubuf_res_offset = ctx->ubuf_res_offset,
+		.ubuf_chunk = ctx->ubuf_chunk,
+		.ubuf_chunk_valid = ctx->ubuf_chunk_valid,
+	};
+	large_chunk_buf_pool.num_idle++;
+	pthread_mutex_unlock(&large_chunk_buf_pool.lock);
+
+	FREE(evicted.ubuf);
+	FREE(evicted.cbuf);
+	ctx->ubuf = NULL;
+	ctx->cbuf = NULL;
+	ctx->buf_size = 0;
+	ctx->ubuf_chunk_valid = false;
+}
+
+/* Give the read context a pair of chunk buffers of at least @chunk_size bytes
+ * from the large chunk buffer pool, replacing its current buffers.  Returns
+ * false if the pool has no such buffers.  */
+static bool
+take_large_chunk_bufs(struct read_ctx *ctx, size_t chunk_size)
+{
+	struct large_chunk_bufs bufs;
+	unsigned i;
+
+	pthread_mutex_lock(&large_chunk_buf_pool.lock);
+	for (i = 0; i < large_chunk_buf_pool.num_idle; i++)
+		if (large_chunk_buf_pool.idle[i].buf_size >= chunk_size)
+			break;
+	if (i == large_chunk_buf_pool.num_idle) {
+		pthread_mutex_unlock(&large_chunk_buf_pool.lock);
+		return false;
+	}
+	bufs = large_chunk_buf_pool.idle[i];
+	memmove(&large_chunk_buf_pool.idle[i], &large_chunk_buf_pool.idle[i + 1],
+		(large_chunk_buf_pool.num_idle - i - 1) *
+			sizeof(large_chunk_buf_pool.idle[0]));
+	large_chunk_buf_pool.num_idle--;
+	pthread_mutex_unlock(&large_chunk_buf_pool.lock);
+
+	FREE(ctx->ubuf);
+	FREE(ctx->cbuf);
+	ctx->ubuf = bufs.ubuf;
+	ctx->cbuf = bufs.cbuf;
+	ctx->buf_size = bufs.buf_size;
+	ctx->ubuf_wim_serial = bufs.ubuf_wim_serial;
+	ctx->ubuf_res_offset = bufs.ubuf_res_offset;
+	ctx->ubuf_chunk = bufs.ubuf_chunk;
+	ctx->ubuf_chunk_valid = bufs.ubuf_chunk_valid;
+	return true;
+}
+
+/* Free all idle buffers in the large chunk buffer pool.  */
+void
+free_large_chunk_buf_pool(void)
+{
+	pthread_mutex_lock(&large_chunk_buf_pool.lock);
+	while (large_chunk_buf_pool.num_idle) {
+		struct large_chunk_bufs *bufs =
+			&large_chunk_buf_pool.idle[--large_chunk_buf_pool.num_idle];
+
+		FREE(bufs->ubuf);
+		FREE(bufs->cbuf);
+	}
+	pthread_mutex_unlock(&large_chunk_buf_pool.lock);
+}
+
+/* Release a read context obtained with get_read_ctx().  Large chunk buffers go
+ * back to the large chunk buffer pool rather than staying with the thread.  */
+static void
+put_read_ctx(struct read_ctx *ctx)
+{
+	if (unlikely(ctx->buf_size > READ_CTX_MAX_CACHED_BUF_SIZE))
+		return_large_chunk_bufs(ctx);
+	if (unlikely(ctx->temporary)) {
+		free_read_ctx(ctx);
+		return;
+	}
+	if (unlikely(ctx->num_chunk_offsets > READ_CTX_MAX_CACHED_CHUNK_OFFSETS)) {
+		FREE(ctx->chunk_offsets);
+		ctx->chunk_offsets = NULL;
+		ctx->num_chunk_offsets = 0;
+	}
+	ctx->in_use = false;
+}
+
+/* Free the calling thread's cached read context, if any.  Other threads' cached
+ * read contexts are freed when those threads exit.  */
+void
+free_thread_read_ctx(void)
+{
+	struct read_ctx *ctx;
+
+	if (!read_ctx_key_valid)
+		return;
+	ctx = pthread_getspecific(read_ctx_key);
+	if (ctx && !ctx->in_use) {
+		pthread_setspecific(read_ctx_key, NULL);
+		free_read_ctx(ctx);
+	}
+}
+
+/* Make the chunk buffers of the read context at least @chunk_size bytes each.
+ */
+static int
+read_ctx_reserve_buffers(struct read_ctx *ctx, u32 chunk_size)
+{
+	u8 *ubuf, *cbuf;
+
+	if (likely(ctx->buf_size >= chunk_size))
+		return 0;
+
+	if (chunk_size > READ_CTX_MAX_CACHED_BUF_SIZE &&
+	    take_large_chunk_bufs(ctx, chunk_size))
+		return 0;
+
+	ubuf = MALLOC(chunk_size);
+	cbuf = MALLOC(chunk_size);
+	if (unlikely(!ubuf || !cbuf)) {
+		FREE(ubuf);
+		FREE(cbuf);
+		return WIMLIB_ERR_NOMEM;
+	}
+	FREE(ctx->ubuf);
+	FREE(ctx->cbuf);
+	ctx->ubuf = ubuf;
+	ctx->cbuf = cbuf;
+	ctx->buf_size = chunk_size;
+	ctx->ubuf_chunk_valid = false;
+	return 0;
+}
+
+/* Return true if @ubuf of the read context already holds the uncompressed data
+ * of the specified chunk of the specified resource.  */
+static inline bool
+read_ctx_has_chunk(const struct read_ctx *ctx,
+		   const struct wim_resource_descriptor *rdesc, u64 chunk)
+{
+	return ctx->ubuf_chunk_valid &&
+		ctx->ubuf_chunk == chunk &&
+		ctx->ubuf_res_offset == rdesc->offset_in_wim &&
+		ctx->ubuf_wim_serial == rdesc->wim->data_serial;
+}
+
+/* Record that @ubuf of the read context holds the uncompressed data of the
+ * specified chunk of the specified resource.  */
+static inline void
+read_ctx_set_chunk(struct read_ctx *ctx,
+		   const struct wim_resource_descriptor *rdesc, u64 chunk)
+{
+	ctx->ubuf_wim_serial = rdesc->wim->data_serial;
+	ctx->ubuf_res_offset = rdesc->offset_in_wim;
+	ctx->ubuf_chunk = chunk;
+	ctx->ubuf_chunk_valid = true;
+}
+
+/* Make the chunk offsets array of the read context have at least @count
+ * entries.  */
+static int
+read_ctx_reserve_chunk_offsets(struct read_ctx *ctx, u64 count)
+{
+	u64 *chunk_offsets;
+
+	if (likely(ctx->num_chunk_offsets >= count))
+		return 0;
+
+	if (unlikely(count > SIZE_MAX / sizeof(u64)))
+		return WIMLIB_ERR_NOMEM;
+
+	chunk_offsets = MALLOC(count * sizeof(u64));
+	if (unlikely(!chunk_offsets))
+		return WIMLIB_ERR_NOMEM;
+	FREE(ctx->chunk_offsets);
+	ctx->chunk_offsets = chunk_offsets;
+	ctx->num_chunk_offsets = count;
+	return 0;
+}
+
+/*
+ * Load the alternate chunk table of a solid resource and convert it into the
+ * offset of each compressed chunk relative to the end of the chunk table.  The
+ * result is cached in @rdesc->solid_chunk_offsets and also returned in
+ * @offsets_ret.  This may run concurrently in multiple threads reading from the
+ * same resource, in which case the first result published is the one kept.
+ *
+ * Possible return values:
+ *
+ *	WIMLIB_ERR_SUCCESS (0)
+ *	WIMLIB_ERR_READ			  (errno set)
+ *	WIMLIB_ERR_UNEXPECTED_END_OF_FILE (errno set to EINVAL)
+ *	WIMLIB_ERR_NOMEM		  (errno set to ENOMEM)
+ */
+static int
+load_solid_chunk_offsets(struct wim_resource_descriptor *rdesc, u64 num_chunks,
+			 const u64 **offsets_ret)
+{
+	typedef le32 _may_alias_attribute aliased_le32_t;
+	const u64 alloc_size = num_chunks * sizeof(u64);
+	const u64 chunk_table_size = num_chunks * sizeof(le32);
+	u64 *offsets;
+	u64 *expected = NULL;
+	aliased_le32_t *raw_entries;
+	u64 cur_offset;
+	int ret;
+
+	if (unlikely((size_t)alloc_size != alloc_size)) {
+		errno = ENOMEM;
+		goto oom;
+	}
+
+	offsets = MALLOC(alloc_size);
+	if (unlikely(!offsets))
+		goto oom;
+
+	/* Read the raw entries into the end of the buffer, then convert them
+	 * into offsets in place.  Entry i is always consumed before the slot
+	 * for offset i, which overlaps it, is written.  */
+	raw_entries = (aliased_le32_t *)((u8 *)offsets + alloc_size -
+					 chunk_table_size);
+	ret = full_pread(&rdesc->wim->in_fd, raw_entries, chunk_table_size,
+			 rdesc->offset_in_wim +
+				sizeof(struct alt_chunk_table_header_disk) +
+				(rdesc->is_pipable ?
+				 (rdesc->size_in_wim - chunk_table_size) : 0));
+	if (unlikely(ret)) {
+		ERROR_WITH_ERRNO("Error reading data from WIM file");
+		FREE(offsets);
+		return ret;
+	}
+
+	cur_offset = 0;
+	for (u64 i = 0; i < num_chunks; i++) {
+		u32 entry = le32_to_cpu(raw_entries[i]);
+		offsets[i] = cur_offset;
+		cur_offset += entry;
+	}
+
+	if (!__atomic_compare_exchange_n(&rdesc->solid_chunk_offsets,
+					 &expected, offsets, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		/* Another thread got there first.  */
+		FREE(offsets);
+		offsets = expected;
+	}
+	*offsets_ret = offsets;
+	return 0;
+
+oom:
+	ERROR("Out of memory while reading compressed WIM resource");
+	return WIMLIB_ERR_NOMEM;
+}
+
 /*
  * Read data from a compressed WIM resource.
  *
@@ -117,12 +888,10 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 			     const struct consume_chunk_callback *cb)
 {
 	int ret;
-	u64 *chunk_offsets = NULL;
-	u8 *ubuf = NULL;
-	void *cbuf = NULL;
-	bool chunk_offsets_malloced = false;
-	bool ubuf_malloced = false;
-	bool cbuf_malloced = false;
+	struct read_ctx *ctx;
+	const u64 *chunk_offsets = NULL;
+	u8 *ubuf;
+	u8 *cbuf;
 	struct wimlib_decompressor *decompressor = NULL;
 
 	/* Sanity checks  */
@@ -165,27 +934,24 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 		ERROR("Invalid compressed resource: "
 		      "expected power-of-2 chunk size (got %"PRIu32")",
 		      chunk_size);
-		ret = WIMLIB_ERR_INVALID_CHUNK_SIZE;
 		errno = EINVAL;
-		goto out_cleanup;
+		return WIMLIB_ERR_INVALID_CHUNK_SIZE;
+	}
+
+	/* Get the read context, which provides the buffers.  */
+	ctx = get_read_ctx();
+	if (unlikely(!ctx)) {
+		errno = ENOMEM;
+		ERROR("Out of memory while reading compressed WIM resource");
+		return WIMLIB_ERR_NOMEM;
 	}
 
 	/* Get valid decompressor.  */
-	if (likely(ctype == rdesc->wim->decompressor_ctype &&
-		   chunk_size == rdesc->wim->decompressor_max_block_size))
-	{
-		/* Cached decompressor.  */
-		decompressor = rdesc->wim->decompressor;
-		rdesc->wim->decompressor_ctype = WIMLIB_COMPRESSION_TYPE_NONE;
-		rdesc->wim->decompressor = NULL;
-	} else {
-		ret = wimlib_create_decompressor(ctype, chunk_size,
-						 &decompressor);
-		if (unlikely(ret)) {
-			if (ret != WIMLIB_ERR_NOMEM)
-				errno = EINVAL;
-			goto out_cleanup;
-		}
+	ret = borrow_decompressor(ctype, chunk_size, &decompressor);
+	if (unlikely(ret)) {
+		if (ret != WIMLIB_ERR_NOMEM)
+			errno = EINVAL;
+		goto out_cleanup;
 	}
 
 	const u32 chunk_order = bsr32(chunk_size);
@@ -229,56 +995,59 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 		(alt_chunk_table) ? chunk_table_size + sizeof(struct alt_chunk_table_header_disk)
 				  : chunk_table_size;
 
-	if (!is_pipe_read) {
+	if (alt_chunk_table) {
+		/* The alternate chunk table contains chunk sizes, not offsets,
+		 * so the offset of a chunk can only be determined by summing
+		 * the sizes of all preceding chunks.  Rather than do this on
+		 * every read, do it once for the whole resource and cache the
+		 * resulting offsets in the resource descriptor.  */
+		const u64 *solid_chunk_offsets =
+			__atomic_load_n(&rdesc->solid_chunk_offsets,
+					__ATOMIC_ACQUIRE);
+		if (!solid_chunk_offsets) {
+			ret = load_solid_chunk_offsets(
+				(struct wim_resource_descriptor *)rdesc,
+				num_chunks, &solid_chunk_offsets);
+			if (unlikely(ret))
+				goto out_cleanup;
+		}
+		chunk_offsets = &solid_chunk_offsets[read_start_chunk];
+	} else if (!is_pipe_read) {
 		/* Read the needed chunk table entries into memory and use them
 		 * to initialize the chunk_offsets array.  */
 
 		u64 first_chunk_entry_to_read;
 		u64 num_chunk_entries_to_read;
 
-		if (alt_chunk_table) {
-			/* The alternate chunk table contains chunk sizes, not
-			 * offsets, so we always must read all preceding entries
-			 * in order to determine offsets.  */
+		num_chunk_entries_to_read = last_needed_chunk - read_start_chunk + 1;
+
+		/* The first chunk has no explicit chunk table entry.  */
+		if (read_start_chunk == 0) {
+			num_chunk_entries_to_read--;
 			first_chunk_entry_to_read = 0;
-			num_chunk_entries_to_read = last_needed_chunk + 1;
 		} else {
-
-			num_chunk_entries_to_read = last_needed_chunk - read_start_chunk + 1;
-
-			/* The first chunk has no explicit chunk table entry.  */
-			if (read_start_chunk == 0) {
-				num_chunk_entries_to_read--;
-				first_chunk_entry_to_read = 0;
-			} else {
-				first_chunk_entry_to_read = read_start_chunk - 1;
-			}
-
-			/* Unless we're reading the final chunk of the resource,
-			 * we need the offset of the chunk following the last
-			 * needed chunk so that the compressed size of the last
-			 * needed chunk can be computed.  */
-			if (last_needed_chunk < num_chunks - 1)
-				num_chunk_entries_to_read++;
+			first_chunk_entry_to_read = read_start_chunk - 1;
 		}
 
+		/* Unless we're reading the final chunk of the resource, we need
+		 * the offset of the chunk following the last needed chunk so
+		 * that the compressed size of the last needed chunk can be
+		 * computed.  */
+		if (last_needed_chunk < num_chunks - 1)
+			num_chunk_entries_to_read++;
+
+		const u64 num_chunk_offsets = max(num_chunk_entries_to_read,
+						  num_needed_chunk_offsets);
 		const u64 chunk_offsets_alloc_size =
-			max(num_chunk_entries_to_read,
-			    num_needed_chunk_offsets) * sizeof(chunk_offsets[0]);
+			num_chunk_offsets * sizeof(chunk_offsets[0]);
 
-		if (unlikely((size_t)chunk_offsets_alloc_size != chunk_offsets_alloc_size)) {
+		if (unlikely(read_ctx_reserve_chunk_offsets(ctx,
+							    num_chunk_offsets)))
+		{
 			errno = ENOMEM;
 			goto oom;
 		}
-
-		if (likely(chunk_offsets_alloc_size <= STACK_MAX)) {
-			chunk_offsets = alloca(chunk_offsets_alloc_size);
-		} else {
-			chunk_offsets = MALLOC(chunk_offsets_alloc_size);
-			if (unlikely(!chunk_offsets))
-				goto oom;
-			chunk_offsets_malloced = true;
-		}
+		chunk_offsets = ctx->chunk_offsets;
 
 		const size_t chunk_table_size_to_read =
 			num_chunk_entries_to_read * chunk_entry_size;
@@ -289,7 +1058,7 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 			+ (rdesc->is_pipable ? (rdesc->size_in_wim - chunk_table_size) : 0);
 
 		void * const chunk_table_data =
-			(u8*)chunk_offsets +
+			(u8*)ctx->chunk_offsets +
 			chunk_offsets_alloc_size -
 			chunk_table_size_to_read;
 
@@ -303,35 +1072,23 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 		 * to allocate yet another array.  */
 		typedef le64 _may_alias_attribute aliased_le64_t;
 		typedef le32 _may_alias_attribute aliased_le32_t;
-		u64 * chunk_offsets_p = chunk_offsets;
+		u64 * chunk_offsets_p = ctx->chunk_offsets;
 
-		if (alt_chunk_table) {
-			u64 cur_offset = 0;
-			aliased_le32_t *raw_entries = chunk_table_data;
+		if (read_start_chunk == 0)
+			*chunk_offsets_p++ = 0;
 
-			for (size_t i = 0; i < num_chunk_entries_to_read; i++) {
-				u32 entry = le32_to_cpu(raw_entries[i]);
-				if (i >= read_start_chunk)
-					*chunk_offsets_p++ = cur_offset;
-				cur_offset += entry;
-			}
-			if (last_needed_chunk < num_chunks - 1)
-				*chunk_offsets_p = cur_offset;
+		if (chunk_entry_size == 4) {
+			aliased_le32_t *raw_entries = chunk_table_data;
+			for (size_t i = 0; i < num_chunk_entries_to_read; i++)
+				*chunk_offsets_p++ = le32_to_cpu(raw_entries[i]);
 		} else {
-			if (read_start_chunk == 0)
-				*chunk_offsets_p++ = 0;
-
-			if (chunk_entry_size == 4) {
-				aliased_le32_t *raw_entries = chunk_table_data;
-				for (size_t i = 0; i < num_chunk_entries_to_read; i++)
-					*chunk_offsets_p++ = le32_to_cpu(raw_entries[i]);
-			} else {
-				aliased_le64_t *raw_entries = chunk_table_data;
-				for (size_t i = 0; i < num_chunk_entries_to_read; i++)
-					*chunk_offsets_p++ = le64_to_cpu(raw_entries[i]);
-			}
+			aliased_le64_t *raw_entries = chunk_table_data;
+			for (size_t i = 0; i < num_chunk_entries_to_read; i++)
+				*chunk_offsets_p++ = le64_to_cpu(raw_entries[i]);
 		}
+	}
 
+	if (!is_pipe_read) {
 		/* Set offset to beginning of first chunk to read.  */
 		cur_read_offset += chunk_offsets[0];
 		if (rdesc->is_pipable)
@@ -340,28 +1097,23 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 			cur_read_offset += chunk_table_size;
 	}
 
-	/* Allocate buffer for holding the uncompressed data of each chunk.  */
-	if (chunk_size <= STACK_MAX) {
-		ubuf = alloca(chunk_size);
-	} else {
-		ubuf = MALLOC(chunk_size);
-		if (unlikely(!ubuf))
-			goto oom;
-		ubuf_malloced = true;
+	/* Get a buffer for holding the uncompressed data of each chunk, and a
+	 * buffer for reading compressed chunks, each of which can be at most
+	 * @chunk_size - 1 bytes.  (Compressed chunks that are a full
+	 * @chunk_size bytes are actually stored uncompressed.)  */
+	if (unlikely(read_ctx_reserve_buffers(ctx, chunk_size))) {
+		errno = ENOMEM;
+		goto oom;
 	}
+	ubuf = ctx->ubuf;
+	cbuf = ctx->cbuf;
 
-	/* Allocate a temporary buffer for reading compressed chunks, each of
-	 * which can be at most @chunk_size - 1 bytes.  This excludes compressed
-	 * chunks that are a full @chunk_size bytes, which are actually stored
-	 * uncompressed.  */
-	if (chunk_size - 1 <= STACK_MAX) {
-		cbuf = alloca(chunk_size - 1);
-	} else {
-		cbuf = MALLOC(chunk_size - 1);
-		if (unlikely(!cbuf))
-			goto oom;
-		cbuf_malloced = true;
-	}
+	/* Reuse the chunk left in @ubuf by an earlier read, if possible.  This
+	 * isn't done for pipes, which must be read sequentially, or while the
+	 * WIM file is being compacted, since data is moving around in the file
+	 * then.  */
+	const bool can_reuse_chunk = !is_pipe_read &&
+				     !rdesc->wim->being_compacted;
 
 	/* Set current data range.  */
 	const struct data_range *cur_range = ranges;
@@ -429,34 +1181,40 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 			}
 		} else {
 
-			/* Read the chunk and feed data to the callback
-			 * function.  */
-			u8 *read_buf;
+			/* Read the chunk (unless it's already in @ubuf) and
+			 * feed data to the callback function.  */
+			if (!can_reuse_chunk || !read_ctx_has_chunk(ctx, rdesc, i)) {
+				u8 *read_buf;
 
-			if (chunk_csize == chunk_usize)
-				read_buf = ubuf;
-			else
-				read_buf = cbuf;
+				ctx->ubuf_chunk_valid = false;
 
-			ret = full_pread(in_fd,
-					 read_buf,
-					 chunk_csize,
-					 cur_read_offset);
-			if (unlikely(ret))
-				goto read_error;
+				if (chunk_csize == chunk_usize)
+					read_buf = ubuf;
+				else
+					read_buf = cbuf;
 
-			if (read_buf == cbuf) {
-				ret = wimlib_decompress(cbuf,
-							chunk_csize,
-							ubuf,
-							chunk_usize,
-							decompressor);
-				if (unlikely(ret)) {
-					ERROR("Failed to decompress data!");
-					ret = WIMLIB_ERR_DECOMPRESSION;
-					errno = EINVAL;
-					goto out_cleanup;
+				ret = full_pread(in_fd,
+						 read_buf,
+						 chunk_csize,
+						 cur_read_offset);
+				if (unlikely(ret))
+					goto read_error;
+
+				if (read_buf == cbuf) {
+					ret = wimlib_decompress(cbuf,
+								chunk_csize,
+								ubuf,
+								chunk_usize,
+								decompressor);
+					if (unlikely(ret)) {
+						ERROR("Failed to decompress data!");
+						ret = WIMLIB_ERR_DECOMPRESSION;
+						errno = EINVAL;
+						goto out_cleanup;
+					}
 				}
+				if (can_reuse_chunk)
+					read_ctx_set_chunk(ctx, rdesc, i);
 			}
 			cur_read_offset += chunk_csize;
 
@@ -508,18 +1266,193 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 	ret = 0;
 
 out_cleanup:
-	if (decompressor) {
-		wimlib_free_decompressor(rdesc->wim->decompressor);
-		rdesc->wim->decompressor = decompressor;
-		rdesc->wim->decompressor_ctype = ctype;
-		rdesc->wim->decompressor_max_block_size = chunk_size;
+	if (decompressor)
+		return_decompressor(decompressor, ctype, chunk_size);
+	put_read_ctx(ctx);
+	return ret;
+
+oom:
+	ERROR("Out of memory while reading compressed WIM resource");
+	ret = WIMLIB_ERR_NOMEM;
+	goto out_cleanup;
+
+read_error:
+	ERROR_WITH_ERRNO("Error reading data from WIM file");
+	goto out_cleanup;
+}
+
+/*
+ * Read chunks [@first_chunk, @first_chunk + @num_chunks) of the compressed WIM
+ * resource @rdesc exactly as they are stored, without decompressing them, and
+ * feed each one to the specified callback function.  This allows compressed
+ * chunks to be copied into another resource that uses the same compression
+ * type and chunk size.  The WIM file must be seekable.
+ *
+ * Returns 0 on success; or the first nonzero value returned by the callback
+ * function; or a nonzero wimlib error code with errno set as well.
+ */
+int
+read_raw_wim_chunks(const struct wim_resource_descriptor *rdesc,
+		    u64 first_chunk, u64 num_chunks,
+		    const struct consume_raw_chunk_callback *cb)
+{
+	struct filedes * const in_fd = &rdesc->wim->in_fd;
+	const bool alt_chunk_table = (rdesc->flags & WIM_RESHDR_FLAG_SOLID);
+	const u32 chunk_size = rdesc->chunk_size;
+	struct read_ctx *ctx;
+	const u64 *chunk_offsets;
+	int ret;
+
+	wimlib_assert(rdesc->flags & (WIM_RESHDR_FLAG_COMPRESSED |
+				      WIM_RESHDR_FLAG_SOLID));
+	wimlib_assert(filedes_is_seekable(in_fd));
+	wimlib_assert(num_chunks != 0);
+
+	if (unlikely(!is_power_of_2(chunk_size))) {
+		ERROR("Invalid compressed resource: "
+		      "expected power-of-2 chunk size (got %"PRIu32")",
+		      chunk_size);
+		errno = EINVAL;
+		return WIMLIB_ERR_INVALID_CHUNK_SIZE;
 	}
-	if (chunk_offsets_malloced)
-		FREE(chunk_offsets);
-	if (ubuf_malloced)
-		FREE(ubuf);
-	if (cbuf_malloced)
-		FREE(cbuf);
+
+	const u32 chunk_order = bsr32(chunk_size);
+	const u64 total_chunks = (rdesc->uncompressed_size + chunk_size - 1) >> chunk_order;
+	const u64 end_chunk = first_chunk + num_chunks;
+
+	wimlib_assert(end_chunk <= total_chunks);
+
+	const u64 num_chunk_entries = (alt_chunk_table ? total_chunks : total_chunks - 1);
+	const u64 chunk_entry_size = get_chunk_entry_size(rdesc->uncompressed_size,
+							  alt_chunk_table);
+	const u64 chunk_table_size = num_chunk_entries * chunk_entry_size;
+	const u64 chunk_table_full_size =
+		(alt_chunk_table) ? chunk_table_size + sizeof(struct alt_chunk_table_header_disk)
+				  : chunk_table_size;
+
+	/* Offset in the WIM file of the first chunk, and the total size of the
+	 * compressed chunks.  In pipable resources the chunk table is at the
+	 * end, and each chunk is preceded by a chunk header.  */
+	u64 chunks_start_offset = rdesc->offset_in_wim;
+	u64 chunks_total_size = rdesc->size_in_wim - chunk_table_full_size;
+	if (rdesc->is_pipable)
+		chunks_total_size -= total_chunks * sizeof(struct pwm_chunk_hdr);
+	else
+		chunks_start_offset += chunk_table_full_size;
+
+	ctx = get_read_ctx();
+	if (unlikely(!ctx)) {
+		errno = ENOMEM;
+		goto oom;
+	}
+
+	if (alt_chunk_table) {
+		const u64 *solid_chunk_offsets =
+			__atomic_load_n(&rdesc->solid_chunk_offsets,
+					__ATOMIC_ACQUIRE);
+		if (!solid_chunk_offsets) {
+			ret = load_solid_chunk_offsets(
+				(struct wim_resource_descriptor *)rdesc,
+				total_chunks, &solid_chunk_offsets);
+			if (unlikely(ret))
+				goto out_cleanup;
+		}
+		chunk_offsets = &solid_chunk_offsets[first_chunk];
+	} else {
+		/* Load the offsets of the chunks being read, plus the offset
+		 * of the chunk following them if there is one.  The first
+		 * chunk has no explicit chunk table entry.  */
+		const u64 first_entry_chunk = max(first_chunk, 1);
+		const u64 end_entry_chunk = min(end_chunk + 1, total_chunks);
+		const u64 num_entries_to_read = (end_entry_chunk > first_entry_chunk) ?
+						end_entry_chunk - first_entry_chunk : 0;
+		const u64 num_offsets = end_entry_chunk - first_chunk;
+		const size_t entries_size = num_entries_to_read * chunk_entry_size;
+		typedef le64 _may_alias_attribute aliased_le64_t;
+		typedef le32 _may_alias_attribute aliased_le32_t;
+		u64 *offsets_p;
+		void *entries;
+
+		if (unlikely(read_ctx_reserve_chunk_offsets(ctx, num_offsets))) {
+			errno = ENOMEM;
+			goto oom;
+		}
+		offsets_p = ctx->chunk_offsets;
+		entries = (u8 *)ctx->chunk_offsets +
+			  num_offsets * sizeof(u64) - entries_size;
+
+		ret = full_pread(in_fd, entries, entries_size,
+				 rdesc->offset_in_wim +
+					(first_entry_chunk - 1) * chunk_entry_size +
+					(rdesc->is_pipable ?
+					 (rdesc->size_in_wim - chunk_table_size) : 0));
+		if (unlikely(ret))
+			goto read_error;
+
+		if (first_chunk == 0)
+			*offsets_p++ = 0;
+		if (chunk_entry_size == 4) {
+			aliased_le32_t *raw_entries = entries;
+			for (u64 i = 0; i < num_entries_to_read; i++)
+				*offsets_p++ = le32_to_cpu(raw_entries[i]);
+		} else {
+			aliased_le64_t *raw_entries = entries;
+			for (u64 i = 0; i < num_entries_to_read; i++)
+				*offsets_p++ = le64_to_cpu(raw_entries[i]);
+		}
+		chunk_offsets = ctx->chunk_offsets;
+	}
+
+	/* Only @cbuf is used, so that any chunk cached in @ubuf stays valid.
+	 * @cbuf is @chunk_size bytes, so it can hold chunks that are stored
+	 * uncompressed too.  */
+	if (unlikely(read_ctx_reserve_buffers(ctx, chunk_size))) {
+		errno = ENOMEM;
+		goto oom;
+	}
+
+	for (u64 i = first_chunk; i < end_chunk; i++) {
+		const u64 chunk_offset = chunk_offsets[i - first_chunk];
+		u64 chunk_end_offset;
+		u32 chunk_usize;
+		u32 chunk_csize;
+		u64 read_offset;
+
+		if (i == total_chunks - 1) {
+			chunk_end_offset = chunks_total_size;
+			chunk_usize = rdesc->uncompressed_size -
+				      (i << chunk_order);
+		} else {
+			chunk_end_offset = chunk_offsets[i + 1 - first_chunk];
+			chunk_usize = chunk_size;
+		}
+		if (unlikely(chunk_end_offset <= chunk_offset ||
+			     chunk_end_offset - chunk_offset > chunk_usize))
+		{
+			ERROR("Invalid chunk size in compressed resource!");
+			errno = EINVAL;
+			ret = WIMLIB_ERR_DECOMPRESSION;
+			goto out_cleanup;
+		}
+		chunk_csize = chunk_end_offset - chunk_offset;
+
+		read_offset = chunks_start_offset + chunk_offset;
+		if (rdesc->is_pipable)
+			read_offset += (i + 1) * sizeof(struct pwm_chunk_hdr);
+
+		ret = full_pread(in_fd, ctx->cbuf, chunk_csize, read_offset);
+		if (unlikely(ret))
+			goto read_error;
+
+		ret = consume_raw_chunk(cb, ctx->cbuf, chunk_csize, chunk_usize);
+		if (unlikely(ret))
+			goto out_cleanup;
+	}
+	ret = 0;
+
+out_cleanup:
+	if (ctx)
+		put_read_ctx(ctx);
 	return ret;
 
 oom:
@@ -663,24 +1596,72 @@ read_wim_blob_prefix(const struct blob_descriptor *blob, u64 size,
  * the file may need FILE_FLAG_BACKUP_SEMANTICS to be opened, or the file may be
  * encrypted), so Windows uses its own code for its equivalent case.  */
 static int
-read_file_on_disk_prefix(const struct blob_descriptor *blob, u64 size,
-			 const struct consume_chunk_callback *cb)
+read_file_range(const tchar *path, u64 offset, u64 size,
+		const struct consume_chunk_callback *cb)
 {
 	int ret;
 	int raw_fd;
 	struct filedes fd;
 
-	raw_fd = topen(blob->file_on_disk, O_BINARY | O_RDONLY);
+	raw_fd = topen(path, O_BINARY | O_RDONLY);
 	if (unlikely(raw_fd < 0)) {
-		ERROR_WITH_ERRNO("Can't open \"%"TS"\"", blob->file_on_disk);
+		ERROR_WITH_ERRNO("Can't open \"%"TS"\"", path);
 		return WIMLIB_ERR_OPEN;
 	}
 	filedes_init(&fd, raw_fd);
-	ret = read_raw_file_data(&fd, 0, size, cb, blob->file_on_disk);
+	ret = read_raw_file_data(&fd, offset, size, cb, path);
 	filedes_close(&fd);
 	return ret;
 }
 
+static int
+read_file_prefix(const tchar *path, u64 size,
+		 const struct consume_chunk_callback *cb)
+{
+	return read_file_range(path, 0, size, cb);
+}
+
+static int
+read_file_on_disk_prefix(const struct blob_descriptor *blob, u64 size,
+			 const struct consume_chunk_callback *cb)
+{
+	return read_file_prefix(blob->file_on_disk, size, cb);
+}
+
+#ifndef __WIN32__
+/* Like read_file_on_disk_prefix(), but the path must first be built from the
+ * blob's 'struct unix_file'.  */
+static int
+read_unix_file_prefix(const struct blob_descriptor *blob, u64 size,
+		      const struct consume_chunk_callback *cb)
+{
+	char *path;
+	int ret;
+
+	path = get_unix_file_path(blob->unix_file);
+	if (unlikely(!path))
+		return WIMLIB_ERR_NOMEM;
+	ret = read_file_prefix(path, size, cb);
+	FREE(path);
+	return ret;
+}
+
+static int
+read_unix_file_range(const struct blob_descriptor *blob, u64 offset, u64 size,
+		     const struct consume_chunk_callback *cb)
+{
+	char *path;
+	int ret;
+
+	path = get_unix_file_path(blob->unix_file);
+	if (unlikely(!path))
+		return WIMLIB_ERR_NOMEM;
+	ret = read_file_range(path, offset, size, cb);
+	FREE(path);
+	return ret;
+}
+#endif
+
 #ifdef WITH_FUSE
 static int
 read_staging_file_prefix(const struct blob_descriptor *blob, u64 size,
@@ -746,6 +1727,8 @@ read_blob_prefix(const struct blob_descriptor *blob, u64 size,
 	#endif
 	#ifdef __WIN32__
 		[BLOB_IN_WINDOWS_FILE] = read_windows_file_prefix,
+	#else
+		[BLOB_IN_UNIX_FILE] = read_unix_file_prefix,
 	#endif
 	};
 	wimlib_assert(blob->blob_location < ARRAY_LEN(handlers)
@@ -754,6 +1737,67 @@ read_blob_prefix(const struct blob_descriptor *blob, u64 size,
 	return handlers[blob->blob_location](blob, size, cb);
 }
 
+struct skip_prefix_ctx {
+	u64 bytes_to_skip;
+	const struct consume_chunk_callback *cb;
+};
+
+static int
+skip_prefix_cb(const void *chunk, size_t size, void *_ctx)
+{
+	struct skip_prefix_ctx *ctx = _ctx;
+
+	if (ctx->bytes_to_skip >= size) {
+		ctx->bytes_to_skip -= size;
+		return 0;
+	}
+	chunk = (const u8 *)chunk + ctx->bytes_to_skip;
+	size -= ctx->bytes_to_skip;
+	ctx->bytes_to_skip = 0;
+	return consume_chunk(ctx->cb, chunk, size);
+}
+
+/*
+ * Read the range [@offset, @offset + @size) of the uncompressed data of @blob,
+ * which must be within the blob, and feed it in nonempty chunks to @cb.
+ *
+ * Data in WIM resources is read directly, decompressing only the needed chunks,
+ * and data in regular files is read directly at the needed offset.  Blobs in
+ * other locations can only be read from the beginning, so the data preceding
+ * the range is read and discarded.
+ */
+int
+read_blob_range(const struct blob_descriptor *blob, u64 offset, u64 size,
+		const struct consume_chunk_callback *cb)
+{
+	wimlib_assert(offset + size <= blob->size && offset + size >= offset);
+
+	if (!size)
+		return 0;
+
+	if (blob->blob_location == BLOB_IN_WIM) {
+		return read_partial_wim_resource(blob->rdesc,
+						 blob->offset_in_res + offset,
+						 size, cb);
+	} else if (blob->blob_location == BLOB_IN_FILE_ON_DISK) {
+		return read_file_range(blob->file_on_disk, offset, size, cb);
+#ifndef __WIN32__
+	} else if (blob->blob_location == BLOB_IN_UNIX_FILE) {
+		return read_unix_file_range(blob, offset, size, cb);
+#endif
+	} else {
+		struct skip_prefix_ctx ctx = {
+			.bytes_to_skip = offset,
+			.cb = cb,
+		};
+		struct consume_chunk_callback skip_cb = {
+			.func = skip_prefix_cb,
+			.ctx = &ctx,
+		};
+		return read_blob_prefix(blob, offset + size, &skip_cb);
+	}
+}
+
 struct blob_chunk_ctx {
 	const struct blob_descriptor *blob;
 	const struct read_blob_callbacks *cbs;
@@ -771,11 +1815,85 @@ consume_blob_chunk(const void *chunk, size_t size, void *_ctx)
 	return ret;
 }
 
-/* Read the full data of the specified blob, passing the data into the specified
- * callbacks (all of which are optional).  */
-int
-read_blob_with_cbs(struct blob_descriptor *blob,
-		   const struct read_blob_callbacks *cbs)
+/*
+ * Wrapper around read_blob_callbacks which passes the data of each blob through
+ * while also copying it into a new blob cache entry.  The entry is added to the
+ * cache only if the wrapped end_blob() succeeds, so if the wrapped callbacks
+ * verify the SHA-1 message digest, corrupted data is never cached.
+ */
+struct blob_cache_filler {
+	const struct read_blob_callbacks *cbs;
+	struct blob_cache_entry *entry;
+};
+
+static int
+filler_begin_blob(struct blob_descriptor *blob, void *_ctx)
+{
+	struct blob_cache_filler *ctx = _ctx;
+	int ret;
+
+	ret = call_begin_blob(blob, ctx->cbs);
+	if (ret)
+		return ret;
+	ctx->entry = new_blob_cache_entry(blob);
+	return 0;
+}
+
+static int
+filler_continue_blob(const struct blob_descriptor *blob, u64 offset,
+		     const void *chunk, size_t size, void *_ctx)
+{
+	struct blob_cache_filler *ctx = _ctx;
+
+	if (ctx->entry)
+		memcpy(&ctx->entry->data[offset], chunk, size);
+	return call_continue_blob(blob, offset, chunk, size, ctx->cbs);
+}
+
+static int
+filler_end_blob(struct blob_descriptor *blob, int status, void *_ctx)
+{
+	struct blob_cache_filler *ctx = _ctx;
+
+	status = call_end_blob(blob, status, ctx->cbs);
+	if (ctx->entry) {
+		if (status == 0)
+			insert_blob_cache_entry(ctx->entry);
+		else
+			put_blob_cache_entry(ctx->entry);
+		ctx->entry = NULL;
+	}
+	return status;
+}
+
+#define BLOB_CACHE_FILLER_CBS(filler) {		\
+	.begin_blob	= filler_begin_blob,	\
+	.continue_blob	= filler_continue_blob,	\
+	.end_blob	= filler_end_blob,	\
+	.ctx		= (filler),		\
+}
+
+/* Feed the cached data of @blob to @cbs, then drop the reference to @entry.  */
+static int
+read_blob_from_cache(struct blob_descriptor *blob,
+		     struct blob_cache_entry *entry,
+		     const struct read_blob_callbacks *cbs)
+{
+	int ret;
+
+	ret = call_begin_blob(blob, cbs);
+	if (likely(!ret)) {
+		ret = call_continue_blob(blob, 0, entry->data, entry->size,
+					 cbs);
+		ret = call_end_blob(blob, ret, cbs);
+	}
+	put_blob_cache_entry(entry);
+	return ret;
+}
+
+static int
+do_read_blob_with_cbs(struct blob_descriptor *blob,
+		      const struct read_blob_callbacks *cbs)
 {
 	int ret;
 	struct blob_chunk_ctx ctx = {
@@ -797,6 +1915,30 @@ read_blob_with_cbs(struct blob_descriptor *blob,
 	return call_end_blob(blob, ret, cbs);
 }
 
+/* Read the full data of the specified blob, passing the data into the specified
+ * callbacks (all of which are optional).  If the blob cache is enabled, the data
+ * may come from, or be added to, the cache.  */
+int
+read_blob_with_cbs(struct blob_descriptor *blob,
+		   const struct read_blob_callbacks *cbs)
+{
+	struct blob_cache_entry *entry;
+	bool cacheable;
+
+	entry = lookup_blob_cache_entry(blob, &cacheable);
+	if (entry)
+		return read_blob_from_cache(blob, entry, cbs);
+
+	if (cacheable) {
+		struct blob_cache_filler filler = { .cbs = cbs };
+		const struct read_blob_callbacks filler_cbs =
+			BLOB_CACHE_FILLER_CBS(&filler);
+
+		return do_read_blob_with_cbs(blob, &filler_cbs);
+	}
+	return do_read_blob_with_cbs(blob, cbs);
+}
+
 /* Read the full uncompressed data of the specified blob into the specified
  * buffer, which must have space for at least blob->size bytes.  The SHA-1
  * message digest is *not* checked.  */
@@ -990,11 +2132,15 @@ report_sha1_mismatch_error(const struct blob_descriptor *blob,
 	sprint_hash(actual_hash, actual_hashstr);
 
 	if (blob_is_in_file(blob)) {
+		const tchar *path = blob_get_file_path(blob);
+
 		ERROR("A file was concurrently modified!\n"
 		      "        Path: \"%"TS"\"\n"
 		      "        Expected SHA-1: %"TS"\n"
 		      "        Actual SHA-1: %"TS"\n",
-		      blob_file_path(blob), expected_hashstr, actual_hashstr);
+		      path ? path : T("(unknown)"),
+		      expected_hashstr, actual_hashstr);
+		blob_put_file_path(blob, path);
 		return WIMLIB_ERR_CONCURRENT_MODIFICATION_DETECTED;
 	} else if (blob->blob_location == BLOB_IN_WIM) {
 		const struct wim_resource_descriptor *rdesc = blob->rdesc;
@@ -1268,12 +2414,46 @@ read_blob_list(struct list_head *blob_list, size_t list_head_offset,
 				 * sorted by offset; @blob specifies the first
 				 * blob in the resource that needs to be read
 				 * and @blob_last specifies the last blob in the
-				 * resource that needs to be read.  */
+				 * resource that needs to be read.  If @blob is
+				 * cached, then just read it from the cache and
+				 * consider the rest of the blobs next time.
+				 * Likewise, cached blobs at the end of the
+				 * sequence are left for next time, so that the
+				 * chunks containing only them aren't
+				 * decompressed.  */
+				struct blob_cache_entry *entry;
+				struct blob_cache_filler filler = {
+					.cbs = sink_cbs,
+				};
+				const struct read_blob_callbacks filler_cbs =
+					BLOB_CACHE_FILLER_CBS(&filler);
+				bool cacheable;
+
+				entry = lookup_blob_cache_entry(blob,
+								&cacheable);
+				if (entry) {
+					ret = read_blob_from_cache(blob, entry,
+								   sink_cbs);
+					if (unlikely(ret && ret != BEGIN_BLOB_STATUS_SKIP_BLOB))
+						return ret;
+					continue;
+				}
+				while (blob_last != blob &&
+				       blob_is_in_cache(blob_last))
+				{
+					next2 = (struct list_head *)
+						((u8 *)blob_last +
+						 list_head_offset);
+					blob_last = (struct blob_descriptor *)
+						((u8 *)next2->prev -
+						 list_head_offset);
+					blob_count--;
+				}
 				next = next2;
 				ret = read_blobs_in_solid_resource(blob, blob_last,
 								   blob_count,
 								   list_head_offset,
-								   sink_cbs);
+								   &filler_cbs);
 				if (ret)
 					return ret;
 				continue;
@@ -1354,6 +2534,7 @@ wim_reshdr_to_desc(const struct wim_reshdr *reshdr, WIMStruct *wim,
 	INIT_LIST_HEAD(&rdesc->blob_list);
 	rdesc->flags = reshdr->flags;
 	rdesc->is_pipable = wim_is_pipable(wim);
+	rdesc->solid_chunk_offsets = NULL;
 	if (rdesc->flags & WIM_RESHDR_FLAG_COMPRESSED) {
 		rdesc->compression_type = wim->compression_type;
 		rdesc->chunk_size = wim->chunk_size;
@@ -1378,6 +2559,15 @@ wim_reshdr_to_desc_and_blob(const struct wim_reshdr *reshdr, WIMStruct *wim,
 	blob_set_is_located_in_wim_resource(blob, rdesc, 0);
 }
 
+/* Free a resource descriptor that was allocated with MALLOC(), along with any
+ * data cached in it.  */
+void
+free_wim_resource_descriptor(struct wim_resource_descriptor *rdesc)
+{
+	FREE(rdesc->solid_chunk_offsets);
+	FREE(rdesc);
+}
+
 /* Import a WIM resource header from the on-disk format.  */
 void
 get_wim_reshdr(const struct wim_reshdr_disk *disk_reshdr,
@@ -208,6 +208,8 @@ sort_blob_list_for_solid_compression(struct list_head *blob_list)
 		case BLOB_IN_FILE_ON_DISK:
 	#ifdef __WIN32__
 		case BLOB_IN_WINDOWS_FILE:
+	#else
+		case BLOB_IN_UNIX_FILE:
 	#endif
 			blob_set_solid_sort_name_from_inode(blob, blob->file_inode);
 			break;
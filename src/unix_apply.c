@@ -23,6 +23,7 @@
 #  include "config.h"
 #endif
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -82,6 +83,10 @@ struct unix_apply_ctx {
 	/* Index of next pathbuf to use  */
 	unsigned which_pathbuf;
 
+	/* Index in ctx->common.targets of the target currently prefilled in
+	 * the path buffers  */
+	size_t cur_target;
+
 	/* Currently open file descriptors for extraction  */
 	struct filedes open_fds[MAX_OPEN_FILES];
 
@@ -102,8 +107,13 @@ struct unix_apply_ctx {
 	/* Pointer to the next byte in @reparse_data to fill  */
 	u8 *reparse_ptr;
 
-	/* Absolute path to the target directory (allocated buffer).  Only set
-	 * if needed for absolute symbolic link fixups.  */
+	/* Absolute paths to the target directories (allocated), indexed like
+	 * ctx->common.targets.  Only set if needed for absolute symbolic link
+	 * fixups.  */
+	char **target_abspaths;
+
+	/* Absolute path to the current target directory, from
+	 * @target_abspaths.  */
 	char *target_abspath;
 
 	/* Number of characters in target_abspath.  */
@@ -113,6 +123,23 @@ struct unix_apply_ctx {
 	unsigned long num_special_files_ignored;
 };
 
+/* Returns the next dentry, going up the tree, whose name is a component of the
+ * extracted path of a dentry whose path contains @d, or NULL if @d is the
+ * topmost component.  The root of an image normally maps to the target
+ * directory itself, but when all images are extracted at once each root has
+ * a name of its own.  */
+static const struct wim_dentry *
+unix_next_path_component(const struct wim_dentry *d)
+{
+	if (dentry_is_root(d))
+		return NULL;
+	d = d->d_parent;
+	if (!will_extract_dentry(d) ||
+	    (dentry_is_root(d) && !d->d_extraction_name_nchars))
+		return NULL;
+	return d;
+}
+
 /* Returns the number of characters needed to represent the path to the
  * specified @dentry when extracted, not including the null terminator or the
  * path to the target directory itself.  */
@@ -122,11 +149,8 @@ unix_dentry_path_length(const struct wim_dentry *dentry)
 	size_t len = 0;
 	const struct wim_dentry *d;
 
-	d = dentry;
-	do {
+	for (d = dentry; d; d = unix_next_path_component(d))
 		len += d->d_extraction_name_nchars + 1;
-		d = d->d_parent;
-	} while (!dentry_is_root(d) && will_extract_dentry(d));
 
 	return len;
 }
@@ -142,45 +166,78 @@ unix_compute_path_max(const struct list_head *dentry_list,
 	size_t len;
 	const struct wim_dentry *dentry;
 
+	size_t target_max = 0;
+
 	list_for_each_entry(dentry, dentry_list, d_extraction_list_node) {
 		len = unix_dentry_path_length(dentry);
 		if (len > max)
 			max = len;
 	}
 
+	for (size_t i = 0; i < ctx->common.num_targets; i++) {
+		len = strlen(ctx->common.targets[i]);
+		if (len > target_max)
+			target_max = len;
+	}
+
 	/* Account for target and null terminator.  */
-	return ctx->common.target_nchars + max + 1;
+	return target_max + max + 1;
 }
 
-/* Builds and returns the filesystem path to which to extract @dentry.
- * This cycles through NUM_PATHBUFS different buffers.  */
-static const char *
-unix_build_extraction_path(const struct wim_dentry *dentry,
-			   struct unix_apply_ctx *ctx)
+/* Writes the path to which to extract @dentry into @pathbuf, whose first
+ * @target_nchars characters must already contain the path to the target.  */
+static void
+unix_fill_extraction_path(char *pathbuf, size_t target_nchars,
+			  const struct wim_dentry *dentry)
 {
-	char *pathbuf;
 	char *p;
 	const struct wim_dentry *d;
 
-	pathbuf = ctx->pathbufs[ctx->which_pathbuf];
-	ctx->which_pathbuf = (ctx->which_pathbuf + 1) % NUM_PATHBUFS;
-
-	p = &pathbuf[ctx->common.target_nchars +
-		     unix_dentry_path_length(dentry)];
+	p = &pathbuf[target_nchars + unix_dentry_path_length(dentry)];
 	*p = '\0';
-	d = dentry;
-	do {
+	for (d = dentry; d; d = unix_next_path_component(d)) {
 		p -= d->d_extraction_name_nchars;
 		if (d->d_extraction_name_nchars)
 			memcpy(p, d->d_extraction_name,
 			       d->d_extraction_name_nchars);
 		*--p = '/';
-		d = d->d_parent;
-	} while (!dentry_is_root(d) && will_extract_dentry(d));
+	}
+}
+
+/* Builds and returns the filesystem path to which to extract @dentry.
+ * This cycles through NUM_PATHBUFS different buffers.  */
+static const char *
+unix_build_extraction_path(const struct wim_dentry *dentry,
+			   struct unix_apply_ctx *ctx)
+{
+	char *pathbuf;
 
+	pathbuf = ctx->pathbufs[ctx->which_pathbuf];
+	ctx->which_pathbuf = (ctx->which_pathbuf + 1) % NUM_PATHBUFS;
+
+	unix_fill_extraction_path(pathbuf, ctx->common.target_nchars, dentry);
 	return pathbuf;
 }
 
+/* Makes subsequently built extraction paths refer to the target with the
+ * specified index in ctx->common.targets.  */
+static void
+unix_select_target(struct unix_apply_ctx *ctx, size_t t)
+{
+	if (t == ctx->cur_target)
+		return;
+	ctx->cur_target = t;
+	ctx->common.target = ctx->common.targets[t];
+	ctx->common.target_nchars = strlen(ctx->common.target);
+	for (unsigned i = 0; i < NUM_PATHBUFS; i++)
+		memcpy(ctx->pathbufs[i],
+		       ctx->common.target, ctx->common.target_nchars);
+	if (ctx->target_abspaths) {
+		ctx->target_abspath = ctx->target_abspaths[t];
+		ctx->target_abspath_nchars = strlen(ctx->target_abspath);
+	}
+}
+
 /* This causes the next call to unix_build_extraction_path() to use the same
  * path buffer as the previous call.  */
 static void
@@ -492,6 +549,89 @@ unix_create_hardlinks(const struct wim_inode *inode,
 	return 0;
 }
 
+/* Deletes the file or directory tree at @path.  Returns 0 or -1 with errno
+ * set.  */
+static int
+unix_remove_tree(const char *path)
+{
+	struct stat stbuf;
+	DIR *dir;
+	struct dirent *ent;
+	int ret = 0;
+
+	if (lstat(path, &stbuf))
+		return -1;
+	if (!S_ISDIR(stbuf.st_mode))
+		return unlink(path);
+
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+	while ((ent = readdir(dir))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+
+		char child_path[strlen(path) + 1 + strlen(ent->d_name) + 1];
+
+		sprintf(child_path, "%s/%s", path, ent->d_name);
+		ret = unix_remove_tree(child_path);
+		if (ret)
+			break;
+	}
+	closedir(dir);
+	if (ret)
+		return ret;
+	return rmdir(path);
+}
+
+/* In incremental mode, deletes each entry of the existing directory @path, to
+ * which @dentry is being extracted, that either isn't being extracted or would
+ * have to change between directory and nondirectory.  */
+static int
+unix_remove_stale_entries(const struct wim_dentry *dentry, const char *path)
+{
+	DIR *dir;
+	struct dirent *ent;
+	int ret = 0;
+
+	dir = opendir(path);
+	if (!dir) {
+		ERROR_WITH_ERRNO("Can't open directory \"%s\"", path);
+		return WIMLIB_ERR_OPENDIR;
+	}
+	while ((ent = readdir(dir))) {
+		const struct wim_dentry *child;
+		size_t name_nchars = strlen(ent->d_name);
+		struct stat stbuf;
+
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+
+		char child_path[strlen(path) + 1 + name_nchars + 1];
+
+		sprintf(child_path, "%s/%s", path, ent->d_name);
+
+		child = get_dentry_child_with_name(dentry, ent->d_name,
+						   WIMLIB_CASE_SENSITIVE);
+		if (child && will_extract_dentry(child) &&
+		    child->d_extraction_name_nchars == name_nchars &&
+		    !memcmp(child->d_extraction_name, ent->d_name, name_nchars) &&
+		    !lstat(child_path, &stbuf) &&
+		    !S_ISDIR(stbuf.st_mode) ==
+				!should_extract_as_directory(child->d_inode))
+			continue;
+
+		if (unix_remove_tree(child_path)) {
+			ERROR_WITH_ERRNO("Can't delete stale file \"%s\"",
+					 child_path);
+			ret = WIMLIB_ERR_WRITE;
+			break;
+		}
+	}
+	closedir(dir);
+	return ret;
+}
+
 /* If @dentry represents a directory, create it.  */
 static int
 unix_create_if_directory(const struct wim_dentry *dentry,
@@ -499,25 +639,34 @@ unix_create_if_directory(const struct wim_dentry *dentry,
 {
 	const char *path;
 	struct stat stbuf;
+	int ret;
 
 	if (!should_extract_as_directory(dentry->d_inode))
 		return 0;
 
 	path = unix_build_extraction_path(dentry, ctx);
-	if (mkdir(path, 0755) &&
-	    /* It's okay if the path already exists, as long as it's a
-	     * directory.  */
-	    !(errno == EEXIST && !lstat(path, &stbuf) && S_ISDIR(stbuf.st_mode)))
-	{
-		ERROR_WITH_ERRNO("Can't create directory \"%s\"", path);
-		return WIMLIB_ERR_MKDIR;
+	if (mkdir(path, 0755)) {
+		/* It's okay if the path already exists, as long as it's a
+		 * directory.  */
+		if (!(errno == EEXIST && !lstat(path, &stbuf) &&
+		      S_ISDIR(stbuf.st_mode)))
+		{
+			ERROR_WITH_ERRNO("Can't create directory \"%s\"", path);
+			return WIMLIB_ERR_MKDIR;
+		}
+		if (ctx->common.extract_flags & WIMLIB_EXTRACT_FLAG_INCREMENTAL) {
+			ret = unix_remove_stale_entries(dentry, path);
+			if (ret)
+				return ret;
+		}
 	}
 
 	return report_file_created(&ctx->common);
 }
 
 /* If @dentry represents an empty regular file or a special file, create it, set
- * its metadata, and create any needed hard links.  */
+ * its metadata, and create any needed hard links.  Also set the metadata of a
+ * regular file whose data was found to be unchanged in incremental mode.  */
 static int
 unix_extract_if_empty_file(const struct wim_dentry *dentry,
 			   struct unix_apply_ctx *ctx)
@@ -533,6 +682,14 @@ unix_extract_if_empty_file(const struct wim_dentry *dentry,
 	if (dentry != inode_first_extraction_dentry(inode))
 		return 0;
 
+	/* Is the file's data already in place?  */
+	if (inode->i_data_unchanged) {
+		ret = unix_set_metadata(-1, inode, NULL, ctx);
+		if (ret)
+			return ret;
+		return report_file_created(&ctx->common);
+	}
+
 	/* Is this a directory, a symbolic link, or any type of nonempty file?
 	 */
 	if (should_extract_as_directory(inode) || inode_is_symlink(inode) ||
@@ -628,7 +785,8 @@ unix_count_dentries(const struct list_head *dentry_list,
 			dir_count++;
 		else if ((dentry == inode_first_extraction_dentry(inode)) &&
 			 !inode_is_symlink(inode) &&
-			 !inode_get_blob_for_unnamed_data_stream_resolved(inode))
+			 (!inode_get_blob_for_unnamed_data_stream_resolved(inode) ||
+			  inode->i_data_unchanged))
 			empty_file_count++;
 	}
 
@@ -642,15 +800,40 @@ unix_create_symlink(const struct wim_inode *inode, const char *path,
 {
 	char target[REPARSE_POINT_MAX_SIZE];
 	struct blob_descriptor blob_override;
+	const struct wim_dentry *root;
+	size_t abspath_nchars;
 	int ret;
 
 	blob_set_is_located_in_attached_buffer(&blob_override,
 					       ctx->reparse_data, rpdatalen);
 
+	/* Absolute links are fixed up relative to the directory to which the
+	 * image is being extracted, which is a named subdirectory of the
+	 * target if all images are being extracted at once.  */
+	root = inode_first_extraction_dentry(inode);
+	while (!dentry_is_root(root))
+		root = root->d_parent;
+	abspath_nchars = ctx->target_abspath_nchars;
+	if (ctx->target_abspath && root->d_extraction_name_nchars)
+		abspath_nchars += 1 + root->d_extraction_name_nchars;
+
+	char abspath[abspath_nchars + 1];
+
+	if (ctx->target_abspath) {
+		memcpy(abspath, ctx->target_abspath, ctx->target_abspath_nchars);
+		if (abspath_nchars != ctx->target_abspath_nchars) {
+			abspath[ctx->target_abspath_nchars] = '/';
+			memcpy(&abspath[ctx->target_abspath_nchars + 1],
+			       root->d_extraction_name,
+			       root->d_extraction_name_nchars);
+		}
+		abspath[abspath_nchars] = '\0';
+	}
+
 	ret = wim_inode_readlink(inode, target, sizeof(target) - 1,
 				 &blob_override,
-				 ctx->target_abspath,
-				 ctx->target_abspath_nchars);
+				 ctx->target_abspath ? abspath : NULL,
+				 abspath_nchars);
 	if (unlikely(ret < 0)) {
 		errno = -ret;
 		return WIMLIB_ERR_READLINK;
@@ -736,15 +919,18 @@ unix_begin_extract_blob(struct blob_descriptor *blob, void *_ctx)
 	struct unix_apply_ctx *ctx = _ctx;
 	const struct blob_extraction_target *targets = blob_extraction_targets(blob);
 
-	for (u32 i = 0; i < blob->out_refcnt; i++) {
-		int ret = unix_begin_extract_blob_instance(blob,
-							   targets[i].inode,
-							   targets[i].stream,
-							   ctx);
-		if (ret) {
-			ctx->reparse_ptr = NULL;
-			unix_cleanup_open_fds(ctx, 0);
-			return ret;
+	for (size_t t = 0; t < ctx->common.num_targets; t++) {
+		unix_select_target(ctx, t);
+		for (u32 i = 0; i < blob->out_refcnt; i++) {
+			int ret = unix_begin_extract_blob_instance(blob,
+								   targets[i].inode,
+								   targets[i].stream,
+								   ctx);
+			if (ret) {
+				ctx->reparse_ptr = NULL;
+				unix_cleanup_open_fds(ctx, 0);
+				return ret;
+			}
 		}
 	}
 	return 0;
@@ -807,49 +993,53 @@ unix_end_extract_blob(struct blob_descriptor *blob, int status, void *_ctx)
 
 	j = 0;
 	ret = 0;
-	for (u32 i = 0; i < blob->out_refcnt; i++) {
-		struct wim_inode *inode = targets[i].inode;
-
-		if (inode_is_symlink(inode)) {
-			/* We finally have the symlink data, so we can create
-			 * the symlink.  */
-			const char *path;
+	for (size_t t = 0; t < ctx->common.num_targets; t++) {
+		unix_select_target(ctx, t);
+		for (u32 i = 0; i < blob->out_refcnt; i++) {
+			struct wim_inode *inode = targets[i].inode;
 
-			path = unix_build_inode_extraction_path(inode, ctx);
-			ret = unix_create_symlink(inode, path, blob->size, ctx);
-			if (ret) {
-				ERROR_WITH_ERRNO("Can't create symbolic link "
-						 "\"%s\"", path);
-				break;
-			}
-			ret = unix_set_metadata(-1, inode, path, ctx);
-			if (ret)
-				break;
-		} else {
-			struct filedes *fd = &ctx->open_fds[j];
-
-			/* If the file is sparse, extend it to its final size. */
-			if (ctx->is_sparse_file[j] && ftruncate(fd->fd, blob->size)) {
-				ERROR_WITH_ERRNO("Error extending \"%s\" to final size",
-						 unix_build_inode_extraction_path(inode, ctx));
-				ret = WIMLIB_ERR_WRITE;
-				break;
-			}
-
-			/* Set metadata on regular file just before closing.  */
-			ret = unix_set_metadata(fd->fd, inode, NULL, ctx);
-			if (ret)
-				break;
+			if (inode_is_symlink(inode)) {
+				/* We finally have the symlink data, so we can create
+				 * the symlink.  */
+				const char *path;
 
-			if (filedes_close(fd)) {
-				ERROR_WITH_ERRNO("Error closing \"%s\"",
-						 unix_build_inode_extraction_path(inode, ctx));
-				ret = WIMLIB_ERR_WRITE;
-				break;
+				path = unix_build_inode_extraction_path(inode, ctx);
+				ret = unix_create_symlink(inode, path, blob->size, ctx);
+				if (ret) {
+					ERROR_WITH_ERRNO("Can't create symbolic link "
+							 "\"%s\"", path);
+					goto out;
+				}
+				ret = unix_set_metadata(-1, inode, path, ctx);
+				if (ret)
+					goto out;
+			} else {
+				struct filedes *fd = &ctx->open_fds[j];
+
+				/* If the file is sparse, extend it to its final size. */
+				if (ctx->is_sparse_file[j] && ftruncate(fd->fd, blob->size)) {
+					ERROR_WITH_ERRNO("Error extending \"%s\" to final size",
+							 unix_build_inode_extraction_path(inode, ctx));
+					ret = WIMLIB_ERR_WRITE;
+					goto out;
+				}
+
+				/* Set metadata on regular file just before closing.  */
+				ret = unix_set_metadata(fd->fd, inode, NULL, ctx);
+				if (ret)
+					goto out;
+
+				if (filedes_close(fd)) {
+					ERROR_WITH_ERRNO("Error closing \"%s\"",
+							 unix_build_inode_extraction_path(inode, ctx));
+					ret = WIMLIB_ERR_WRITE;
+					goto out;
+				}
+				j++;
 			}
-			j++;
 		}
 	}
+out:
 	unix_cleanup_open_fds(ctx, j);
 	return ret;
 }
@@ -873,6 +1063,67 @@ unix_set_dir_metadata(struct list_head *dentry_list, struct unix_apply_ctx *ctx)
 	return 0;
 }
 
+/* Returns true if the last modification time of an existing file, as far as
+ * the file system reports it, matches the WIM timestamp @timestamp.  */
+static bool
+unix_mtime_matches(const struct stat *stbuf, u64 timestamp)
+{
+#ifdef HAVE_STAT_NANOSECOND_PRECISION
+	return timespec_to_wim_timestamp(&stbuf->st_mtim) == timestamp;
+#else
+	return stbuf->st_mtime == wim_timestamp_to_time_t(timestamp);
+#endif
+}
+
+/*
+ * In incremental mode, a regular file's data is considered unchanged if, in
+ * every target, all its extraction aliases already exist as hard links to one
+ * regular file with the same size and last modification time.  All aliases are
+ * checked when the first one comes up, and the result is cached in the inode.
+ */
+static int
+unix_is_data_unchanged(struct wim_dentry *dentry, struct apply_ctx *ctx)
+{
+	struct wim_inode *inode = dentry->d_inode;
+	const struct blob_descriptor *blob;
+	const struct wim_dentry *alias;
+	struct stat stbuf;
+	dev_t dev = 0;
+	ino_t ino = 0;
+
+	if (inode->i_visited)
+		return inode->i_data_unchanged ? 0 : -1;
+
+	blob = inode_get_blob_for_unnamed_data_stream_resolved(inode);
+	if (!blob)
+		return -1;
+
+	for (size_t t = 0; t < ctx->num_targets; t++) {
+		const char *target = ctx->targets[t];
+		size_t target_nchars = strlen(target);
+
+		inode_for_each_extraction_alias(alias, inode) {
+			char path[target_nchars +
+				  unix_dentry_path_length(alias) + 1];
+
+			memcpy(path, target, target_nchars);
+			unix_fill_extraction_path(path, target_nchars, alias);
+			if (lstat(path, &stbuf) || !S_ISREG(stbuf.st_mode) ||
+			    (u64)stbuf.st_size != blob->size ||
+			    !unix_mtime_matches(&stbuf, inode->i_last_write_time))
+				return -1;
+			if (alias == inode_first_extraction_dentry(inode)) {
+				dev = stbuf.st_dev;
+				ino = stbuf.st_ino;
+			} else if (stbuf.st_dev != dev || stbuf.st_ino != ino) {
+				return -1;
+			}
+		}
+	}
+	inode->i_data_unchanged = 1;
+	return 0;
+}
+
 static int
 unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 {
@@ -904,28 +1155,44 @@ unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 	 * representatives in the blob list.  */
 
 	unix_count_dentries(dentry_list, &dir_count, &empty_file_count);
+	dir_count *= ctx->common.num_targets;
+	empty_file_count *= ctx->common.num_targets;
 
 	ret = start_file_structure_phase(&ctx->common, dir_count + empty_file_count);
 	if (ret)
 		goto out;
 
-	ret = unix_create_dirs_and_empty_files(dentry_list, ctx);
-	if (ret)
-		goto out;
+	for (size_t t = 0; t < ctx->common.num_targets; t++) {
+		unix_select_target(ctx, t);
+		ret = unix_create_dirs_and_empty_files(dentry_list, ctx);
+		if (ret)
+			goto out;
+	}
 
 	ret = end_file_structure_phase(&ctx->common);
 	if (ret)
 		goto out;
 
-	/* Get full path to target if needed for absolute symlink fixups.  */
+	/* Get full paths to the targets if needed for absolute symlink
+	 * fixups.  */
 	if ((ctx->common.extract_flags & WIMLIB_EXTRACT_FLAG_RPFIX) &&
 	    ctx->common.required_features.symlink_reparse_points)
 	{
-		ctx->target_abspath = realpath(ctx->common.target, NULL);
-		if (!ctx->target_abspath) {
+		ctx->target_abspaths = CALLOC(ctx->common.num_targets,
+					      sizeof(ctx->target_abspaths[0]));
+		if (!ctx->target_abspaths) {
 			ret = WIMLIB_ERR_NOMEM;
 			goto out;
 		}
+		for (size_t t = 0; t < ctx->common.num_targets; t++) {
+			ctx->target_abspaths[t] =
+				realpath(ctx->common.targets[t], NULL);
+			if (!ctx->target_abspaths[t]) {
+				ret = WIMLIB_ERR_NOMEM;
+				goto out;
+			}
+		}
+		ctx->target_abspath = ctx->target_abspaths[ctx->cur_target];
 		ctx->target_abspath_nchars = strlen(ctx->target_abspath);
 	}
 
@@ -948,9 +1215,12 @@ unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 	if (ret)
 		goto out;
 
-	ret = unix_set_dir_metadata(dentry_list, ctx);
-	if (ret)
-		goto out;
+	for (size_t t = 0; t < ctx->common.num_targets; t++) {
+		unix_select_target(ctx, t);
+		ret = unix_set_dir_metadata(dentry_list, ctx);
+		if (ret)
+			goto out;
+	}
 
 	ret = end_file_metadata_phase(&ctx->common);
 	if (ret)
@@ -963,7 +1233,11 @@ unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 out:
 	for (unsigned i = 0; i < NUM_PATHBUFS; i++)
 		FREE(ctx->pathbufs[i]);
-	FREE(ctx->target_abspath);
+	if (ctx->target_abspaths) {
+		for (size_t t = 0; t < ctx->common.num_targets; t++)
+			FREE(ctx->target_abspaths[t]);
+		FREE(ctx->target_abspaths);
+	}
 	return ret;
 }
 
@@ -971,5 +1245,8 @@ const struct apply_operations unix_apply_ops = {
 	.name			= "UNIX",
 	.get_supported_features = unix_get_supported_features,
 	.extract                = unix_extract,
+	.is_data_unchanged      = unix_is_data_unchanged,
 	.context_size           = sizeof(struct unix_apply_ctx),
+	.supports_multi_image   = true,
+	.supports_multiple_targets = true,
 };
@@ -278,10 +278,130 @@ out:
 }
 #endif /* HAVE_LINUX_XATTR_SUPPORT */
 
+/*
+ * Capturing a large directory tree creates a blob for every nonempty regular
+ * file, and each blob has to remember where to read the file's data from until
+ * the WIM is written.  Storing each file's full path would duplicate the path
+ * of its directory many times.  So instead, all files captured from a directory
+ * share one reference-counted copy of the directory's path, and each file only
+ * stores its own name.
+ */
+struct unix_dir_path {
+	size_t refcnt;
+	size_t path_nbytes;
+	char path[]; /* includes trailing '/', if needed; not null-terminated */
+};
+
+struct unix_file {
+	/* The directory containing the file, or NULL if @name is the full path
+	 * (when capturing a single file).  */
+	struct unix_dir_path *dir;
+
+	/* The null-terminated name of the file  */
+	char name[];
+};
+
+static struct unix_dir_path *
+new_unix_dir_path(const char *path, size_t path_nbytes)
+{
+	struct unix_dir_path *dir;
+
+	dir = MALLOC(sizeof(*dir) + path_nbytes);
+	if (dir) {
+		dir->refcnt = 1;
+		dir->path_nbytes = path_nbytes;
+		memcpy(dir->path, path, path_nbytes);
+	}
+	return dir;
+}
+
+static void
+put_unix_dir_path(struct unix_dir_path *dir)
+{
+	if (dir && --dir->refcnt == 0)
+		FREE(dir);
+}
+
+static struct unix_file *
+new_unix_file(struct unix_dir_path *dir, const char *name)
+{
+	size_t name_nbytes = strlen(name);
+	struct unix_file *file;
+
+	file = MALLOC(sizeof(*file) + name_nbytes + 1);
+	if (file) {
+		file->dir = dir;
+		if (dir)
+			dir->refcnt++;
+		memcpy(file->name, name, name_nbytes + 1);
+	}
+	return file;
+}
+
+struct unix_file *
+clone_unix_file(const struct unix_file *file)
+{
+	return new_unix_file(file->dir, file->name);
+}
+
+void
+free_unix_file(struct unix_file *file)
+{
+	if (file) {
+		put_unix_dir_path(file->dir);
+		FREE(file);
+	}
+}
+
+int
+cmp_unix_files(const struct unix_file *file1, const struct unix_file *file2)
+{
+	/* Just a heuristic that will place files in the same directory next to
+	 * each other.  */
+	if (file1->dir != file2->dir) {
+		if (!file1->dir || !file2->dir)
+			return file1->dir ? 1 : -1;
+		int v = memcmp(file1->dir->path, file2->dir->path,
+			       min(file1->dir->path_nbytes,
+				   file2->dir->path_nbytes));
+		if (v)
+			return v;
+		v = cmp_u64(file1->dir->path_nbytes, file2->dir->path_nbytes);
+		if (v)
+			return v;
+	}
+	return strcmp(file1->name, file2->name);
+}
+
+/* Build the full path to the file.  Returns a newly allocated string, or NULL
+ * if out of memory.  */
+char *
+get_unix_file_path(const struct unix_file *file)
+{
+	size_t dir_nbytes = file->dir ? file->dir->path_nbytes : 0;
+	size_t name_nbytes = strlen(file->name);
+	char *path;
+
+	path = MALLOC(dir_nbytes + name_nbytes + 1);
+	if (path) {
+		if (dir_nbytes)
+			memcpy(path, file->dir->path, dir_nbytes);
+		memcpy(&path[dir_nbytes], file->name, name_nbytes + 1);
+	}
+	return path;
+}
+
+/*
+ * Create the blob for a regular file's data.  @relpath is the file's name
+ * relative to its directory, and *@dir_path_p is the shared path of that
+ * directory, or NULL if it hasn't been needed yet.  @dir_path_p itself is NULL
+ * if the file is the root of the capture, in which case @relpath is the full
+ * path.
+ */
 static int
-unix_scan_regular_file(const char *path, u64 blocks, u64 size,
-		       struct wim_inode *inode,
-		       struct list_head *unhashed_blobs)
+unix_scan_regular_file(const char *relpath, struct unix_dir_path **dir_path_p,
+		       u64 blocks, u64 size, struct wim_inode *inode,
+		       struct scan_params *params)
 {
 	struct blob_descriptor *blob = NULL;
 	struct wim_inode_stream *strm;
@@ -296,13 +416,28 @@ unix_scan_regular_file(const char *path, u64 blocks, u64 size,
 		inode->i_attributes = FILE_ATTRIBUTE_NORMAL;
 
 	if (size) {
+		struct unix_dir_path *dir = NULL;
+
+		if (dir_path_p) {
+			if (!*dir_path_p) {
+				/* The directory's path is the current path
+				 * minus the file name.  */
+				*dir_path_p = new_unix_dir_path(
+						params->cur_path,
+						params->cur_path_nchars -
+						strlen(relpath));
+				if (unlikely(!*dir_path_p))
+					goto err_nomem;
+			}
+			dir = *dir_path_p;
+		}
 		blob = new_blob_descriptor();
 		if (unlikely(!blob))
 			goto err_nomem;
-		blob->file_on_disk = STRDUP(path);
-		if (unlikely(!blob->file_on_disk))
+		blob->unix_file = new_unix_file(dir, relpath);
+		if (unlikely(!blob->unix_file))
 			goto err_nomem;
-		blob->blob_location = BLOB_IN_FILE_ON_DISK;
+		blob->blob_location = BLOB_IN_UNIX_FILE;
 		blob->size = size;
 		blob->file_inode = inode;
 	}
@@ -311,7 +446,8 @@ unix_scan_regular_file(const char *path, u64 blocks, u64 size,
 	if (unlikely(!strm))
 		goto err_nomem;
 
-	prepare_unhashed_blob(blob, inode, strm->stream_id, unhashed_blobs);
+	prepare_unhashed_blob(blob, inode, strm->stream_id,
+			      params->unhashed_blobs);
 	return 0;
 
 err_nomem:
@@ -322,6 +458,7 @@ err_nomem:
 static int
 unix_build_dentry_tree_recursive(struct wim_dentry **tree_ret,
 				 int dirfd, const char *relpath,
+				 struct unix_dir_path **dir_path_p,
 				 struct scan_params *params);
 
 static int
@@ -332,6 +469,7 @@ unix_scan_directory(struct wim_dentry *dir_dentry,
 
 	int dirfd;
 	DIR *dir;
+	struct unix_dir_path *dir_path = NULL;
 	int ret;
 
 	dirfd = my_openat(params->cur_path, parent_dirfd, dir_relpath, O_RDONLY);
@@ -378,13 +516,15 @@ unix_scan_directory(struct wim_dentry *dir_dentry,
 					 &orig_path_len))
 			break;
 		ret = unix_build_dentry_tree_recursive(&child, dirfd,
-						       entry->d_name, params);
+						       entry->d_name, &dir_path,
+						       params);
 		pathbuf_truncate(params, orig_path_len);
 		if (ret)
 			break;
 		attach_scanned_tree(dir_dentry, child, params->blob_table);
 	}
 	closedir(dir);
+	put_unix_dir_path(dir_path);
 	return ret;
 }
 
@@ -529,6 +669,7 @@ unix_scan_symlink(int dirfd, const char *relpath,
 static int
 unix_build_dentry_tree_recursive(struct wim_dentry **tree_ret,
 				 int dirfd, const char *relpath,
+				 struct unix_dir_path **dir_path_p,
 				 struct scan_params *params)
 {
 	struct wim_dentry *tree = NULL;
@@ -628,9 +769,9 @@ unix_build_dentry_tree_recursive(struct wim_dentry **tree_ret,
 	}
 
 	if (S_ISREG(stbuf.st_mode)) {
-		ret = unix_scan_regular_file(params->cur_path, stbuf.st_blocks,
-					     stbuf.st_size, inode,
-					     params->unhashed_blobs);
+		ret = unix_scan_regular_file(relpath, dir_path_p,
+					     stbuf.st_blocks, stbuf.st_size,
+					     inode, params);
 	} else if (S_ISDIR(stbuf.st_mode)) {
 		ret = unix_scan_directory(tree, dirfd, relpath, params);
 	} else if (S_ISLNK(stbuf.st_mode)) {
@@ -685,7 +826,7 @@ unix_build_dentry_tree(struct wim_dentry **root_ret,
 		return ret;
 
 	return unix_build_dentry_tree_recursive(root_ret, AT_FDCWD,
-						root_disk_path, params);
+						root_disk_path, NULL, params);
 }
 
 #endif /* !__WIN32__ */
@@ -32,11 +32,13 @@
 #include "wimlib.h"
 #include "wimlib/assert.h"
 #include "wimlib/blob_table.h"
+#include "wimlib/compact.h"
 #include "wimlib/dentry.h"
 #include "wimlib/encoding.h"
 #include "wimlib/file_io.h"
 #include "wimlib/integrity.h"
 #include "wimlib/metadata.h"
+#include "wimlib/resource.h"
 #include "wimlib/security.h"
 #include "wimlib/wim.h"
 #include "wimlib/xml.h"
@@ -143,6 +145,7 @@ new_wim_struct(void)
 		return NULL;
 
 	wim->refcnt = 1;
+	wim_new_data_serial(wim);
 	filedes_invalidate(&wim->in_fd);
 	filedes_invalidate(&wim->out_fd);
 	wim->out_solid_compression_type = wim_default_solid_compression_type();
@@ -151,6 +154,17 @@ new_wim_struct(void)
 	return wim;
 }
 
+/* Give the WIMStruct a new data serial number, invalidating any data cached from
+ * its WIM file under the old one.  */
+void
+wim_new_data_serial(WIMStruct *wim)
+{
+	static u64 last_data_serial;
+
+	wim->data_serial = __atomic_add_fetch(&last_data_serial, 1,
+					      __ATOMIC_RELAXED);
+}
+
 /* API function documented in wimlib.h  */
 WIMLIBAPI int
 wimlib_create_new_wim(enum wimlib_compression_type ctype, WIMStruct **wim_ret)
@@ -222,6 +236,7 @@ put_image_metadata(struct wim_image_metadata *imd)
 	list_for_each_entry_safe(blob, tmp, &imd->unhashed_blobs, unhashed_list)
 		free_blob_descriptor(blob);
 	free_blob_descriptor(imd->metadata_blob);
+	free_blob_descriptor(imd->prev_metadata_blob);
 	FREE(imd);
 }
 
@@ -319,7 +334,6 @@ new_unloaded_image_metadata(struct blob_descriptor *metadata_blob)
 int
 select_wim_image(WIMStruct *wim, int image)
 {
-	struct wim_image_metadata *imd;
 	int ret;
 
 	if (image == WIMLIB_NO_IMAGE)
@@ -336,14 +350,10 @@ select_wim_image(WIMStruct *wim, int image)
 
 	deselect_current_wim_image(wim);
 
-	imd = wim->image_metadata[image - 1];
-	if (!is_image_loaded(imd)) {
-		ret = read_metadata_resource(imd);
-		if (ret)
-			return ret;
-	}
+	ret = pin_wim_image(wim, image);
+	if (ret)
+		return ret;
 	wim->current_image = image;
-	imd->selected_refcnt++;
 	return 0;
 }
 
@@ -359,11 +369,47 @@ deselect_current_wim_image(WIMStruct *wim)
 	if (wim->current_image == WIMLIB_NO_IMAGE)
 		return;
 	imd = wim_get_current_image_metadata(wim);
+	wim->current_image = WIMLIB_NO_IMAGE;
+	unpin_wim_image(wim, imd);
+}
+
+/*
+ * Load the metadata of the specified image, if not already loaded, and keep it
+ * loaded until a matching call to unpin_wim_image().  Unlike
+ * select_wim_image(), this doesn't change the WIMStruct's currently selected
+ * image, so the metadata of several images can be in use at the same time.
+ * @image must be a valid 1-based image index.
+ */
+int
+pin_wim_image(WIMStruct *wim, int image)
+{
+	struct wim_image_metadata *imd;
+	int ret;
+
+	if (!wim_has_metadata(wim))
+		return WIMLIB_ERR_METADATA_NOT_FOUND;
+
+	imd = wim->image_metadata[image - 1];
+	if (!is_image_loaded(imd)) {
+		ret = read_metadata_resource(imd);
+		if (ret)
+			return ret;
+	}
+	imd->selected_refcnt++;
+	return 0;
+}
+
+/*
+ * Release a reference taken by pin_wim_image().  To reduce memory usage,
+ * possibly unload the image's metadata from memory.
+ */
+void
+unpin_wim_image(WIMStruct *wim, struct wim_image_metadata *imd)
+{
 	wimlib_assert(imd->selected_refcnt > 0);
 	imd->selected_refcnt--;
-	wim->current_image = WIMLIB_NO_IMAGE;
 
-	if (can_unload_image(imd)) {
+	if (can_unload_image(imd) && !wim->concurrent_reads) {
 		wimlib_assert(list_empty(&imd->unhashed_blobs));
 		unload_image_metadata(imd);
 	}
@@ -676,10 +722,30 @@ begin_read(WIMStruct *wim, const void *wim_filename_or_fd, int open_flags)
 		return ret;
 
 	if (wim->hdr.flags & WIM_HDR_FLAG_WRITE_IN_PROGRESS) {
-		WARNING("The WIM_HDR_FLAG_WRITE_IN_PROGRESS flag is set in the header of\n"
-			"          \"%"TS"\".  It may be being changed by another process,\n"
-			"          or a process may have crashed while writing the WIM.",
-			wimfile);
+		bool finished = false;
+
+		/* Finish any interrupted compaction.  */
+		if (wimfile) {
+			ret = finish_interrupted_compaction(wim, open_flags,
+							    &finished);
+			if (ret)
+				return ret;
+		}
+		if (finished) {
+			if (filedes_seek(&wim->in_fd, 0) == -1) {
+				ERROR_WITH_ERRNO("Can't seek to beginning of "
+						 "\"%"TS"\"", wimfile);
+				return WIMLIB_ERR_READ;
+			}
+			ret = read_wim_header(wim, &wim->hdr);
+			if (ret)
+				return ret;
+		} else {
+			WARNING("The WIM_HDR_FLAG_WRITE_IN_PROGRESS flag is set in the header of\n"
+				"          \"%"TS"\".  It may be being changed by another process,\n"
+				"          or a process may have crashed while writing the WIM.",
+				wimfile);
+		}
 	}
 
 	if (open_flags & WIMLIB_OPEN_FLAG_WRITE_ACCESS) {
@@ -769,6 +835,23 @@ begin_read(WIMStruct *wim, const void *wim_filename_or_fd, int open_flags)
 		if (ret)
 			return ret;
 	}
+
+	if (open_flags & WIMLIB_OPEN_FLAG_CONCURRENT_READS) {
+		/* Load the metadata of all images now, so that concurrent
+		 * readers never need to modify it.  */
+		for (int i = 0; wim->image_metadata && i < wim->hdr.image_count;
+		     i++)
+		{
+			struct wim_image_metadata *imd = wim->image_metadata[i];
+
+			if (!is_image_loaded(imd)) {
+				ret = read_metadata_resource(imd);
+				if (ret)
+					return ret;
+			}
+		}
+		wim->concurrent_reads = 1;
+	}
 	return 0;
 }
 
@@ -809,7 +892,8 @@ wimlib_open_wim_with_progress(const tchar *wimfile, int open_flags,
 {
 	if (open_flags & ~(WIMLIB_OPEN_FLAG_CHECK_INTEGRITY |
 			   WIMLIB_OPEN_FLAG_ERROR_IF_SPLIT |
-			   WIMLIB_OPEN_FLAG_WRITE_ACCESS))
+			   WIMLIB_OPEN_FLAG_WRITE_ACCESS |
+			   WIMLIB_OPEN_FLAG_CONCURRENT_READS))
 		return WIMLIB_ERR_INVALID_PARAM;
 
 	if (!wimfile || !*wimfile || !wim_ret)
@@ -896,7 +980,6 @@ wim_decrement_refcnt(WIMStruct *wim)
 		filedes_close(&wim->in_fd);
 	if (filedes_valid(&wim->out_fd))
 		filedes_close(&wim->out_fd);
-	wimlib_free_decompressor(wim->decompressor);
 	xml_free_info_struct(wim->xml_info);
 	FREE(wim->filename);
 	FREE(wim);
@@ -1011,6 +1094,10 @@ wimlib_global_cleanup(void)
 		goto out_unlock;
 
 	xml_global_cleanup();
+	free_thread_read_ctx();
+	free_large_chunk_buf_pool();
+	free_decompressor_pool();
+	free_blob_cache();
 #ifdef __WIN32__
 	win32_global_cleanup();
 #endif
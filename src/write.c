@@ -39,8 +39,10 @@
 
 #include "wimlib/alloca.h"
 #include "wimlib/assert.h"
+#include "wimlib/bitops.h"
 #include "wimlib/blob_table.h"
 #include "wimlib/chunk_compressor.h"
+#include "wimlib/compact.h"
 #include "wimlib/endianness.h"
 #include "wimlib/error.h"
 #include "wimlib/file_io.h"
@@ -63,6 +65,16 @@
 #define WRITE_RESOURCE_FLAG_SOLID		0x00000004
 #define WRITE_RESOURCE_FLAG_SEND_DONE_WITH_FILE	0x00000008
 #define WRITE_RESOURCE_FLAG_SOLID_SORT		0x00000010
+#define WRITE_RESOURCE_FLAG_SOLID_RANDOM_ACCESS	0x00000020
+#define WRITE_RESOURCE_FLAG_WRITEBACK		0x00000040
+
+/* With WIMLIB_WRITE_FLAG_FSYNC, blob data is written back to disk in windows of
+ * this size while it's being written, rather than all at once at the end.  */
+#define WRITEBACK_WINDOW_SIZE			(32 << 20)
+
+/* Maximum chunk size for solid resources written with
+ * WIMLIB_WRITE_FLAG_SOLID_RANDOM_ACCESS.  */
+#define SOLID_RANDOM_ACCESS_MAX_CHUNK_SIZE	1048576
 
 static int
 write_flags_to_resource_flags(int write_flags)
@@ -86,6 +98,12 @@ write_flags_to_resource_flags(int write_flags)
 	    WIMLIB_WRITE_FLAG_SOLID)
 		write_resource_flags |= WRITE_RESOURCE_FLAG_SOLID_SORT;
 
+	if (write_flags & WIMLIB_WRITE_FLAG_SOLID_RANDOM_ACCESS)
+		write_resource_flags |= WRITE_RESOURCE_FLAG_SOLID_RANDOM_ACCESS;
+
+	if (write_flags & WIMLIB_WRITE_FLAG_FSYNC)
+		write_resource_flags |= WRITE_RESOURCE_FLAG_WRITEBACK;
+
 	return write_resource_flags;
 }
 
@@ -156,13 +174,71 @@ may_filter_blobs(const struct filter_context *ctx)
 	return (may_soft_filter_blobs(ctx) || may_hard_filter_blobs(ctx));
 }
 
+/*
+ * For a solid resource from which only some blobs are being written, find the
+ * chunks that contain data of at least one of those blobs.  Only these chunks
+ * need to be copied; the others can be left out.
+ *
+ * Returns an array that maps the index of each needed chunk to its index in a
+ * solid resource made up of just the needed chunks, and the index of each
+ * other chunk to ~0.  Also returns the number of needed chunks and their total
+ * uncompressed size.  Returns NULL if out of memory or if the resource has an
+ * invalid chunk size.
+ */
+static u64 *
+map_needed_solid_chunks(const struct wim_resource_descriptor *rdesc,
+			u64 *num_needed_chunks_ret, u64 *needed_size_ret)
+{
+	const struct blob_descriptor *blob;
+	u64 num_chunks;
+	u64 num_needed_chunks;
+	u64 needed_size;
+	u32 chunk_order;
+	u64 *map;
+
+	if (!is_power_of_2(rdesc->chunk_size))
+		return NULL;
+	chunk_order = bsr32(rdesc->chunk_size);
+	num_chunks = DIV_ROUND_UP(rdesc->uncompressed_size, rdesc->chunk_size);
+	if (num_chunks > SIZE_MAX / sizeof(map[0]))
+		return NULL;
+	map = CALLOC(num_chunks, sizeof(map[0]));
+	if (!map)
+		return NULL;
+
+	list_for_each_entry(blob, &rdesc->blob_list, rdesc_node) {
+		if (!blob->will_be_in_output_wim || !blob->size)
+			continue;
+		for (u64 i = blob->offset_in_res >> chunk_order;
+		     i <= (blob->offset_in_res + blob->size - 1) >> chunk_order;
+		     i++)
+			map[i] = 1;
+	}
+
+	num_needed_chunks = 0;
+	needed_size = 0;
+	for (u64 i = 0; i < num_chunks; i++) {
+		if (map[i]) {
+			map[i] = num_needed_chunks++;
+			needed_size += min(rdesc->chunk_size,
+					   rdesc->uncompressed_size -
+						(i << chunk_order));
+		} else {
+			map[i] = ~(u64)0;
+		}
+	}
+	*num_needed_chunks_ret = num_needed_chunks;
+	*needed_size_ret = needed_size;
+	return map;
+}
+
 /* Return true if the specified blob is located in a WIM resource which can be
  * reused in the output WIM file, without being recompressed.  */
 static bool
 can_raw_copy(const struct blob_descriptor *blob, int write_resource_flags,
 	     int out_ctype, u32 out_chunk_size)
 {
-	const struct wim_resource_descriptor *rdesc;
+	struct wim_resource_descriptor *rdesc;
 
 	/* Recompress everything if requested.  */
 	if (write_resource_flags & WRITE_RESOURCE_FLAG_RECOMPRESS)
@@ -198,10 +274,9 @@ can_raw_copy(const struct blob_descriptor *blob, int write_resource_flags,
 	    !!(write_resource_flags & WRITE_RESOURCE_FLAG_SOLID))
 		return false;
 
-	/* Note: it is theoretically possible to copy chunks of compressed data
-	 * between non-solid, solid, and pipable resources.  However, we don't
-	 * currently implement this optimization because it would be complex and
-	 * would usually go unused.  */
+	/* Note: blobs that fail the above checks may still be able to have
+	 * their compressed chunks copied individually; see can_copy_chunks().
+	 */
 
 	if (rdesc->flags & WIM_RESHDR_FLAG_COMPRESSED) {
 		/* To re-use a non-solid resource, it must use the desired
@@ -210,30 +285,98 @@ can_raw_copy(const struct blob_descriptor *blob, int write_resource_flags,
 			rdesc->chunk_size == out_chunk_size);
 	} else {
 		/* Solid resource: Such resources may contain multiple blobs,
-		 * and in general only a subset of them need to be written.  As
-		 * a heuristic, re-use the raw data if more than two-thirds the
-		 * uncompressed size is being written.  */
+		 * and in general only a subset of them need to be written.
+		 * Chunks that contain none of the data being written are left
+		 * out of the copy (see write_raw_copy_resource()).  As a
+		 * heuristic, re-use the raw data if more than two-thirds the
+		 * uncompressed size of the remaining chunks is being written.
+		 */
 
 		/* Note: solid resources contain a header that specifies the
 		 * compression type and chunk size; therefore we don't need to
 		 * check if they are compatible with @out_ctype and
 		 * @out_chunk_size.  */
 
-		/* Did we already decide to reuse the resource?  */
-		if (rdesc->raw_copy_ok)
-			return true;
+		/* Did we already decide whether to reuse the resource?  This
+		 * is checked once per resource rather than once per blob, since
+		 * it requires looking at all the blobs in the resource.  */
+		if (rdesc->raw_copy_checked)
+			return rdesc->raw_copy_ok;
+
+		/* Don't reuse resources with chunks larger than requested for
+		 * random access.  */
+		if ((write_resource_flags &
+		     WRITE_RESOURCE_FLAG_SOLID_RANDOM_ACCESS) &&
+		    rdesc->chunk_size > out_chunk_size)
+			return false;
 
 		struct blob_descriptor *res_blob;
 		u64 write_size = 0;
+		u64 needed_size = rdesc->uncompressed_size;
+		u64 num_needed_chunks;
+		u64 *map;
 
 		list_for_each_entry(res_blob, &rdesc->blob_list, rdesc_node)
 			if (res_blob->will_be_in_output_wim)
 				write_size += res_blob->size;
 
-		return (write_size > rdesc->uncompressed_size * 2 / 3);
+		map = map_needed_solid_chunks(rdesc, &num_needed_chunks,
+					      &needed_size);
+		FREE(map);
+
+		rdesc->raw_copy_checked = 1;
+		rdesc->raw_copy_needed_size = needed_size;
+		rdesc->raw_copy_ok = (write_size > needed_size * 2 / 3);
+		return rdesc->raw_copy_ok;
 	}
 }
 
+/*
+ * Return true if the specified blob, which is located in a WIM resource that
+ * can't be reused as a whole, can instead be written as a non-solid resource by
+ * copying the compressed chunks that hold its data.  This works across
+ * non-solid, solid, and pipable resources, provided that the compression type
+ * and chunk size match and that the blob begins on a chunk boundary.  Only the
+ * last chunk, if it also holds data that follows the blob, needs to be
+ * recompressed.  See write_chunk_copy_blob().
+ */
+static bool
+can_copy_chunks(const struct blob_descriptor *blob, int write_resource_flags,
+		int out_ctype, u32 out_chunk_size)
+{
+	const struct wim_resource_descriptor *rdesc;
+
+	if (write_resource_flags & (WRITE_RESOURCE_FLAG_RECOMPRESS |
+				    WRITE_RESOURCE_FLAG_SOLID))
+		return false;
+
+	if (blob->blob_location != BLOB_IN_WIM)
+		return false;
+
+	rdesc = blob->rdesc;
+
+	if (out_ctype == WIMLIB_COMPRESSION_TYPE_NONE ||
+	    !(rdesc->flags & (WIM_RESHDR_FLAG_COMPRESSED |
+			      WIM_RESHDR_FLAG_SOLID)))
+		return false;
+
+	if (rdesc->compression_type != out_ctype ||
+	    rdesc->chunk_size != out_chunk_size ||
+	    !is_power_of_2(out_chunk_size))
+		return false;
+
+	if (blob->offset_in_res & (out_chunk_size - 1))
+		return false;
+
+	/* The chunk table is needed, so the WIM can't be read from a pipe.  */
+	if (!filedes_is_seekable(&rdesc->wim->in_fd))
+		return false;
+
+	/* Don't bother if there's no chunk to copy.  */
+	return blob->size >= out_chunk_size ||
+	       blob->offset_in_res + blob->size == rdesc->uncompressed_size;
+}
+
 static u32
 reshdr_flags_for_blob(const struct blob_descriptor *blob)
 {
@@ -253,12 +396,9 @@ blob_set_out_reshdr_for_reuse(struct blob_descriptor *blob)
 
 	if (rdesc->flags & WIM_RESHDR_FLAG_SOLID) {
 		blob->out_reshdr.offset_in_wim = blob->offset_in_res;
-		blob->out_reshdr.uncompressed_size = 0;
-		blob->out_reshdr.size_in_wim = blob->size;
-
+		blob->out_reshdr.uncompressed_size = rdesc->uncompressed_size;
+		blob->out_reshdr.size_in_wim = rdesc->size_in_wim;
 		blob->out_res_offset_in_wim = rdesc->offset_in_wim;
-		blob->out_res_size_in_wim = rdesc->size_in_wim;
-		blob->out_res_uncompressed_size = rdesc->uncompressed_size;
 	} else {
 		blob->out_reshdr.offset_in_wim = rdesc->offset_in_wim;
 		blob->out_reshdr.uncompressed_size = rdesc->uncompressed_size;
@@ -396,8 +536,31 @@ struct write_blobs_ctx {
 	/* Offset in the output file of the start of the chunks of the resource
 	 * currently being written.  */
 	u64 chunks_start_offset;
+
+	/* With WRITE_RESOURCE_FLAG_WRITEBACK: the output file range whose
+	 * writeback was started most recently is [@writeback_start,
+	 * @writeback_end).  */
+	off_t writeback_start;
+	off_t writeback_end;
 };
 
+/* Start writing back the data written since the last call, if there is enough
+ * of it.  */
+static void
+maybe_start_writeback(struct write_blobs_ctx *ctx)
+{
+	off_t end = ctx->out_fd->offset;
+
+	if (!(ctx->write_resource_flags & WRITE_RESOURCE_FLAG_WRITEBACK) ||
+	    end < ctx->writeback_end + WRITEBACK_WINDOW_SIZE)
+		return;
+
+	filedes_writeback(ctx->out_fd, ctx->writeback_start,
+			  ctx->writeback_end, end);
+	ctx->writeback_start = ctx->writeback_end;
+	ctx->writeback_end = end;
+}
+
 /* Reserve space for the chunk table and prepare to accumulate the chunk table
  * in memory.  */
 static int
@@ -650,7 +813,9 @@ do_done_with_blob(struct blob_descriptor *blob,
 	if (--inode->i_num_remaining_streams > 0)
 		return 0;
 
-	path = blob_file_path(blob);
+	path = blob_get_file_path(blob);
+	if (!path)
+		return WIMLIB_ERR_NOMEM;
 
 	cookie1 = progress_get_streamless_path(path);
 	cookie2 = progress_get_win32_path(path);
@@ -660,6 +825,7 @@ do_done_with_blob(struct blob_descriptor *blob,
 	progress_put_win32_path(cookie2);
 	progress_put_streamless_path(cookie1);
 
+	blob_put_file_path(blob, path);
 	return ret;
 }
 
@@ -913,6 +1079,8 @@ write_chunk(struct write_blobs_ctx *ctx, const void *cchunk,
 	if (ret)
 		goto write_error;
 
+	maybe_start_writeback(ctx);
+
 	ctx->cur_write_blob_offset += usize;
 
 	completed_size = usize;
@@ -973,6 +1141,10 @@ write_chunk(struct write_blobs_ctx *ctx, const void *cchunk,
 		}
 	}
 
+	if (ctx->compressor != NULL)
+		ctx->progress_data.progress.write_streams.skipped_compression_bytes =
+			ctx->compressor->skipped_bytes;
+
 	return do_write_blobs_progress(&ctx->progress_data, completed_size,
 				       completed_blob_count, false);
 
@@ -1156,28 +1328,35 @@ compute_blob_list_stats(struct list_head *blob_list,
 	ctx->progress_data.progress.write_streams.compression_type  = ctx->out_ctype;
 	ctx->progress_data.progress.write_streams.total_parts       = total_parts;
 	ctx->progress_data.progress.write_streams.completed_parts   = 0;
+	ctx->progress_data.progress.write_streams.skipped_compression_bytes = 0;
 	ctx->progress_data.next_progress = 0;
 	return 0;
 }
 
 /* Find blobs in @blob_list that can be copied to the output WIM in raw form
  * rather than compressed.  Delete these blobs from @blob_list and move them to
- * @raw_copy_blobs.  Return the total uncompressed size of the blobs that need
- * to be compressed.  */
+ * @raw_copy_blobs, or to @chunk_copy_blobs if only their chunks can be copied.
+ * Return the total uncompressed size of the blobs that need to be compressed.
+ */
 static u64
 find_raw_copy_blobs(struct list_head *blob_list, int write_resource_flags,
 		    int out_ctype, u32 out_chunk_size,
-		    struct list_head *raw_copy_blobs)
+		    struct list_head *raw_copy_blobs,
+		    struct list_head *chunk_copy_blobs)
 {
 	struct blob_descriptor *blob, *tmp;
 	u64 num_nonraw_bytes = 0;
 
 	INIT_LIST_HEAD(raw_copy_blobs);
+	INIT_LIST_HEAD(chunk_copy_blobs);
 
-	/* Initialize temporary raw_copy_ok flag.  */
-	list_for_each_entry(blob, blob_list, write_blobs_list)
-		if (blob->blob_location == BLOB_IN_WIM)
+	/* Initialize temporary raw_copy_ok and raw_copy_checked flags.  */
+	list_for_each_entry(blob, blob_list, write_blobs_list) {
+		if (blob->blob_location == BLOB_IN_WIM) {
 			blob->rdesc->raw_copy_ok = 0;
+			blob->rdesc->raw_copy_checked = 0;
+		}
+	}
 
 	list_for_each_entry_safe(blob, tmp, blob_list, write_blobs_list) {
 		if (can_raw_copy(blob, write_resource_flags,
@@ -1185,6 +1364,10 @@ find_raw_copy_blobs(struct list_head *blob_list, int write_resource_flags,
 		{
 			blob->rdesc->raw_copy_ok = 1;
 			list_move_tail(&blob->write_blobs_list, raw_copy_blobs);
+		} else if (can_copy_chunks(blob, write_resource_flags,
+					   out_ctype, out_chunk_size))
+		{
+			list_move_tail(&blob->write_blobs_list, chunk_copy_blobs);
 		} else {
 			num_nonraw_bytes += blob->size;
 		}
@@ -1193,6 +1376,114 @@ find_raw_copy_blobs(struct list_head *blob_list, int write_resource_flags,
 	return num_nonraw_bytes;
 }
 
+struct write_raw_chunks_ctx {
+	struct filedes *out_fd;
+	le32 *chunk_csizes;
+	u64 chunk_index;
+};
+
+static int
+write_raw_solid_chunk(const void *cchunk, u32 csize, u32 usize, void *_ctx)
+{
+	struct write_raw_chunks_ctx *ctx = _ctx;
+	int ret;
+
+	ctx->chunk_csizes[ctx->chunk_index++] = cpu_to_le32(csize);
+	ret = full_write(ctx->out_fd, cchunk, csize);
+	if (ret)
+		ERROR_WITH_ERRNO("Error writing raw data to WIM file");
+	return ret;
+}
+
+/*
+ * Write a new solid resource made up of the raw compressed chunks of the solid
+ * resource @in_rdesc that are marked as needed in @map (see
+ * map_needed_solid_chunks()), and set the output resource headers of the blobs
+ * being written from @in_rdesc accordingly.  Leaving out chunks shifts the
+ * data that follows by a multiple of the chunk size, so no chunk has to be
+ * recompressed.
+ */
+static int
+write_needed_solid_chunks(struct wim_resource_descriptor *in_rdesc,
+			  const u64 *map, u64 num_needed_chunks,
+			  u64 needed_size, struct filedes *out_fd)
+{
+	const u32 chunk_order = bsr32(in_rdesc->chunk_size);
+	const u64 num_chunks = DIV_ROUND_UP(in_rdesc->uncompressed_size,
+					    in_rdesc->chunk_size);
+	const size_t chunk_table_size = num_needed_chunks * sizeof(le32);
+	struct alt_chunk_table_header_disk hdr;
+	struct write_raw_chunks_ctx ctx;
+	struct consume_raw_chunk_callback cb = {
+		.func	= write_raw_solid_chunk,
+		.ctx	= &ctx,
+	};
+	struct blob_descriptor *blob;
+	u64 out_offset_in_wim;
+	int ret;
+
+	ctx.out_fd = out_fd;
+	ctx.chunk_index = 0;
+	ctx.chunk_csizes = CALLOC(num_needed_chunks, sizeof(le32));
+	if (!ctx.chunk_csizes)
+		return WIMLIB_ERR_NOMEM;
+
+	/* Write the header and reserve space for the chunk table.  */
+	out_offset_in_wim = out_fd->offset;
+	hdr.res_usize = cpu_to_le64(needed_size);
+	hdr.chunk_size = cpu_to_le32(in_rdesc->chunk_size);
+	hdr.compression_format = cpu_to_le32(in_rdesc->compression_type);
+	ret = full_write(out_fd, &hdr, sizeof(hdr));
+	if (!ret)
+		ret = full_write(out_fd, ctx.chunk_csizes, chunk_table_size);
+	if (ret) {
+		ERROR_WITH_ERRNO("Error writing raw data to WIM file");
+		goto out;
+	}
+
+	/* Copy each run of needed chunks.  */
+	for (u64 i = 0; i < num_chunks; ) {
+		u64 j;
+
+		if (map[i] == ~(u64)0) {
+			i++;
+			continue;
+		}
+		for (j = i + 1; j < num_chunks && map[j] != ~(u64)0; j++)
+			;
+		ret = read_raw_wim_chunks(in_rdesc, i, j - i, &cb);
+		if (ret)
+			goto out;
+		i = j;
+	}
+	wimlib_assert(ctx.chunk_index == num_needed_chunks);
+
+	ret = full_pwrite(out_fd, ctx.chunk_csizes, chunk_table_size,
+			  out_offset_in_wim + sizeof(hdr));
+	if (ret) {
+		ERROR_WITH_ERRNO("Error writing chunk table to WIM file");
+		goto out;
+	}
+
+	list_for_each_entry(blob, &in_rdesc->blob_list, rdesc_node) {
+		if (blob->will_be_in_output_wim) {
+			u64 chunk = blob->offset_in_res >> chunk_order;
+
+			blob_set_out_reshdr_for_reuse(blob);
+			blob->out_reshdr.offset_in_wim =
+				(map[chunk] << chunk_order) +
+				(blob->offset_in_res & (in_rdesc->chunk_size - 1));
+			blob->out_reshdr.size_in_wim =
+				out_fd->offset - out_offset_in_wim;
+			blob->out_reshdr.uncompressed_size = needed_size;
+			blob->out_res_offset_in_wim = out_offset_in_wim;
+		}
+	}
+out:
+	FREE(ctx.chunk_csizes);
+	return ret;
+}
+
 /* Copy a raw compressed resource located in another WIM file to the WIM file
  * being written.  */
 static int
@@ -1208,6 +1499,34 @@ write_raw_copy_resource(struct wim_resource_descriptor *in_rdesc,
 	struct blob_descriptor *blob;
 	u64 out_offset_in_wim;
 
+	/* If only some chunks of a solid resource contain data being written,
+	 * copy only those chunks.  Compactions are excluded since they reuse
+	 * resources in place.  can_raw_copy() already found the size of the
+	 * needed chunks, so the map is only built if it is really used.  */
+	if ((in_rdesc->flags & WIM_RESHDR_FLAG_SOLID) &&
+	    !in_rdesc->wim->being_compacted &&
+	    is_power_of_2(in_rdesc->chunk_size) &&
+	    !(in_rdesc->raw_copy_checked &&
+	      in_rdesc->raw_copy_needed_size == in_rdesc->uncompressed_size))
+	{
+		u64 num_needed_chunks;
+		u64 needed_size;
+		u64 *map;
+
+		map = map_needed_solid_chunks(in_rdesc, &num_needed_chunks,
+					      &needed_size);
+		if (!map)
+			return WIMLIB_ERR_NOMEM;
+		if (needed_size != in_rdesc->uncompressed_size) {
+			ret = write_needed_solid_chunks(in_rdesc, map,
+							num_needed_chunks,
+							needed_size, out_fd);
+			FREE(map);
+			return ret;
+		}
+		FREE(map);
+	}
+
 	/* Copy the raw data.  */
 	cur_read_offset = in_rdesc->offset_in_wim;
 	end_read_offset = cur_read_offset + in_rdesc->size_in_wim;
@@ -1329,6 +1648,82 @@ finish_remaining_chunks(struct write_blobs_ctx *ctx)
 	return 0;
 }
 
+static int
+write_raw_chunk(const void *cchunk, u32 csize, u32 usize, void *_ctx)
+{
+	return write_chunk(_ctx, cchunk, csize, usize);
+}
+
+/* Write a blob as a non-solid resource by copying the compressed chunks that
+ * hold its data from the WIM resource it is located in.  See
+ * can_copy_chunks().  */
+static int
+write_chunk_copy_blob(struct blob_descriptor *blob,
+		      struct write_blobs_ctx *ctx)
+{
+	const struct wim_resource_descriptor *rdesc = blob->rdesc;
+	const u32 chunk_order = bsr32(ctx->out_chunk_size);
+	const u64 num_chunks = DIV_ROUND_UP(blob->size, ctx->out_chunk_size);
+	u64 num_copied_chunks = num_chunks;
+	struct consume_raw_chunk_callback cb = {
+		.func	= write_raw_chunk,
+		.ctx	= ctx,
+	};
+	int ret;
+
+	/* A partial last chunk must be recompressed, unless the blob ends
+	 * where the resource does; otherwise the compressed chunk also holds
+	 * data following the blob.  */
+	if ((blob->size & (ctx->out_chunk_size - 1)) &&
+	    blob->offset_in_res + blob->size != rdesc->uncompressed_size)
+		num_copied_chunks--;
+
+	list_move_tail(&blob->write_blobs_list, &ctx->blobs_being_compressed);
+
+	if (num_copied_chunks) {
+		ret = read_raw_wim_chunks(rdesc,
+					  blob->offset_in_res >> chunk_order,
+					  num_copied_chunks, &cb);
+		if (ret)
+			return ret;
+	}
+
+	if (num_copied_chunks != num_chunks) {
+		u64 offset = num_copied_chunks << chunk_order;
+		size_t size = blob->size - offset;
+
+		ret = prepare_chunk_buffer(ctx);
+		if (ret)
+			return ret;
+		ret = read_partial_wim_blob_into_buf(blob, offset, size,
+						     ctx->cur_chunk_buf);
+		if (ret)
+			return ret;
+		ctx->compressor->signal_chunk_filled(ctx->compressor, size);
+		ctx->cur_chunk_buf = NULL;
+		ret = finish_remaining_chunks(ctx);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* Write each blob in @chunk_copy_blobs by copying its compressed chunks.  */
+static int
+write_chunk_copy_blobs(struct list_head *chunk_copy_blobs,
+		       struct write_blobs_ctx *ctx)
+{
+	struct blob_descriptor *blob, *tmp;
+	int ret;
+
+	list_for_each_entry_safe(blob, tmp, chunk_copy_blobs, write_blobs_list) {
+		ret = write_chunk_copy_blob(blob, ctx);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 static void
 validate_blob_list(struct list_head *blob_list)
 {
@@ -1421,10 +1816,11 @@ init_done_with_file_info(struct list_head *blob_list)
  * cases, the @out_reshdr of the `struct blob_descriptor' for each blob written will be
  * updated to specify its location, size, and flags in the output WIM.  In the
  * solid resource case, WIM_RESHDR_FLAG_SOLID will be set in the @flags field of
- * each @out_reshdr, and furthermore @out_res_offset_in_wim and
- * @out_res_size_in_wim of each @out_reshdr will be set to the offset and size,
- * respectively, in the output WIM of the solid resource containing the
- * corresponding blob.
+ * each @out_reshdr, the @offset_in_wim of each @out_reshdr will be set to the
+ * offset of the blob in the uncompressed solid resource, the @size_in_wim and
+ * @uncompressed_size of each @out_reshdr will be set to the size and
+ * uncompressed size of the solid resource, and @out_res_offset_in_wim will be
+ * set to the offset in the output WIM of the solid resource.
  *
  * Each of the blobs to write may be in any location supported by the
  * resource-handling code (specifically, read_blob_list()), such as the contents
@@ -1477,6 +1873,7 @@ write_blob_list(struct list_head *blob_list,
 	int ret;
 	struct write_blobs_ctx ctx;
 	struct list_head raw_copy_blobs;
+	struct list_head chunk_copy_blobs;
 	u64 num_nonraw_bytes;
 
 	wimlib_assert((write_resource_flags &
@@ -1503,6 +1900,10 @@ write_blob_list(struct list_head *blob_list,
 	ctx.out_chunk_size = out_chunk_size;
 	ctx.write_resource_flags = write_resource_flags;
 	ctx.filter_ctx = filter_ctx;
+	if (out_fd->is_pipe)
+		ctx.write_resource_flags &= ~WRITE_RESOURCE_FLAG_WRITEBACK;
+	ctx.writeback_start = out_fd->offset;
+	ctx.writeback_end = out_fd->offset;
 
 	/*
 	 * We normally sort the blobs to write by a "sequential" order that is
@@ -1538,14 +1939,17 @@ write_blob_list(struct list_head *blob_list,
 
 	num_nonraw_bytes = find_raw_copy_blobs(blob_list, write_resource_flags,
 					       out_ctype, out_chunk_size,
-					       &raw_copy_blobs);
+					       &raw_copy_blobs,
+					       &chunk_copy_blobs);
 
-	/* Unless no data needs to be compressed, allocate a chunk_compressor to
-	 * do compression.  There are serial and parallel implementations of the
+	/* Unless no data needs to be compressed (or have its chunks copied),
+	 * allocate a chunk_compressor to do compression.  There are serial and parallel implementations of the
 	 * chunk_compressor interface.  We default to parallel using the
 	 * specified number of threads, unless the upper bound on the number
 	 * bytes needing to be compressed is less than a heuristic value.  */
-	if (num_nonraw_bytes != 0 && out_ctype != WIMLIB_COMPRESSION_TYPE_NONE) {
+	if ((num_nonraw_bytes != 0 || !list_empty(&chunk_copy_blobs)) &&
+	    out_ctype != WIMLIB_COMPRESSION_TYPE_NONE)
+	{
 	#ifdef ENABLE_MULTITHREADED_COMPRESSION
 		if (num_nonraw_bytes > max(2000000, out_chunk_size)) {
 			ret = new_parallel_chunk_compressor(out_ctype,
@@ -1584,12 +1988,18 @@ write_blob_list(struct list_head *blob_list,
 	 * without decompression.  */
 	ret = write_raw_copy_resources(&raw_copy_blobs, ctx.out_fd,
 				       &ctx.progress_data);
-
-	if (ret || num_nonraw_bytes == 0)
+	if (ret)
 		goto out_destroy_context;
 
 	INIT_LIST_HEAD(&ctx.blobs_being_compressed);
 
+	/* Copy the compressed chunks of blobs for which that is possible,
+	 * recompressing only chunks shared with other data.  */
+	ret = write_chunk_copy_blobs(&chunk_copy_blobs, &ctx);
+
+	if (ret || num_nonraw_bytes == 0)
+		goto out_destroy_context;
+
 	if (write_resource_flags & WRITE_RESOURCE_FLAG_SOLID) {
 
 		INIT_LIST_HEAD(&ctx.blobs_in_solid_resource);
@@ -1634,14 +2044,12 @@ write_blob_list(struct list_head *blob_list,
 
 		offset_in_res = 0;
 		list_for_each_entry(blob, &ctx.blobs_in_solid_resource, write_blobs_list) {
-			blob->out_reshdr.size_in_wim = blob->size;
+			blob->out_reshdr.size_in_wim = reshdr.size_in_wim;
 			blob->out_reshdr.flags = reshdr_flags_for_blob(blob) |
 						 WIM_RESHDR_FLAG_SOLID;
-			blob->out_reshdr.uncompressed_size = 0;
+			blob->out_reshdr.uncompressed_size = reshdr.uncompressed_size;
 			blob->out_reshdr.offset_in_wim = offset_in_res;
 			blob->out_res_offset_in_wim = reshdr.offset_in_wim;
-			blob->out_res_size_in_wim = reshdr.size_in_wim;
-			blob->out_res_uncompressed_size = reshdr.uncompressed_size;
 			offset_in_res += blob->size;
 		}
 		wimlib_assert(offset_in_res == reshdr.uncompressed_size);
@@ -1671,6 +2079,10 @@ write_file_data_blobs(WIMStruct *wim,
 	if (write_resource_flags & WRITE_RESOURCE_FLAG_SOLID) {
 		out_chunk_size = wim->out_solid_chunk_size;
 		out_ctype = wim->out_solid_compression_type;
+		if (write_resource_flags &
+		    WRITE_RESOURCE_FLAG_SOLID_RANDOM_ACCESS)
+			out_chunk_size = min(out_chunk_size,
+					     SOLID_RANDOM_ACCESS_MAX_CHUNK_SIZE);
 	} else {
 		out_chunk_size = wim->out_chunk_size;
 		out_ctype = wim->out_compression_type;
@@ -1688,13 +2100,15 @@ write_file_data_blobs(WIMStruct *wim,
 			       wim->progctx);
 }
 
-/* Write the contents of the specified blob as a WIM resource.  */
+/* Write the contents of the specified blob as a WIM resource, compressing it
+ * with up to @num_threads threads (0 means the default number).  */
 static int
 write_wim_resource(struct blob_descriptor *blob,
 		   struct filedes *out_fd,
 		   int out_ctype,
 		   u32 out_chunk_size,
-		   int write_resource_flags)
+		   int write_resource_flags,
+		   unsigned num_threads)
 {
 	LIST_HEAD(blob_list);
 	list_add(&blob->write_blobs_list, &blob_list);
@@ -1704,7 +2118,7 @@ write_wim_resource(struct blob_descriptor *blob,
 			       write_resource_flags & ~WRITE_RESOURCE_FLAG_SOLID,
 			       out_ctype,
 			       out_chunk_size,
-			       1,
+			       num_threads,
 			       NULL,
 			       NULL,
 			       NULL,
@@ -1721,7 +2135,8 @@ write_wim_resource_from_buffer(const void *buf,
 			       u32 out_chunk_size,
 			       struct wim_reshdr *out_reshdr,
 			       u8 *hash_ret,
-			       int write_resource_flags)
+			       int write_resource_flags,
+			       unsigned num_threads)
 {
 	int ret;
 	struct blob_descriptor blob;
@@ -1739,7 +2154,7 @@ write_wim_resource_from_buffer(const void *buf,
 	blob.is_metadata = is_metadata;
 
 	ret = write_wim_resource(&blob, out_fd, out_ctype, out_chunk_size,
-				 write_resource_flags);
+				 write_resource_flags, num_threads);
 	if (ret)
 		return ret;
 
@@ -1750,6 +2165,196 @@ write_wim_resource_from_buffer(const void *buf,
 	return 0;
 }
 
+/*
+ * Return true if the compressed chunks of @old_blob, which holds a previous
+ * version of some data, can be reused by
+ * write_wim_resource_from_buffer_reusing_chunks().  This requires that
+ * @old_blob be located in a non-solid compressed resource with the output
+ * compression type and chunk size, in a seekable WIM file that isn't being
+ * compacted (which could overwrite the old resource).
+ */
+bool
+can_reuse_resource_chunks(const struct blob_descriptor *old_blob,
+			  int out_ctype, u32 out_chunk_size,
+			  int write_resource_flags)
+{
+	const struct wim_resource_descriptor *rdesc;
+
+	if (write_resource_flags & (WRITE_RESOURCE_FLAG_RECOMPRESS |
+				    WRITE_RESOURCE_FLAG_PIPABLE |
+				    WRITE_RESOURCE_FLAG_SOLID))
+		return false;
+
+	if (old_blob->blob_location != BLOB_IN_WIM || old_blob->size == 0)
+		return false;
+
+	rdesc = old_blob->rdesc;
+
+	return out_ctype != WIMLIB_COMPRESSION_TYPE_NONE &&
+	       (rdesc->flags & WIM_RESHDR_FLAG_COMPRESSED) &&
+	       !(rdesc->flags & WIM_RESHDR_FLAG_SOLID) &&
+	       rdesc->compression_type == out_ctype &&
+	       rdesc->chunk_size == out_chunk_size &&
+	       is_power_of_2(out_chunk_size) &&
+	       filedes_is_seekable(&rdesc->wim->in_fd) &&
+	       !rdesc->wim->being_compacted;
+}
+
+/* Return true if chunk @i of @buf is the same as chunk @i of @old_buf.  */
+static bool
+chunk_unchanged(const u8 *buf, size_t buf_size,
+		const u8 *old_buf, size_t old_size, u64 i, u32 chunk_size)
+{
+	u64 offset = i * chunk_size;
+	size_t size = min(chunk_size, buf_size - offset);
+
+	return offset < old_size &&
+	       size == min(chunk_size, old_size - offset) &&
+	       !memcmp(&buf[offset], &old_buf[offset], size);
+}
+
+/*
+ * Write the contents of the specified buffer as a non-solid WIM resource, like
+ * write_wim_resource_from_buffer(), but copy the compressed chunks of
+ * @old_blob, for which can_reuse_resource_chunks() must have returned true,
+ * wherever the uncompressed data of a chunk is unchanged.  Only the changed
+ * chunks are compressed.  If nothing can be reused (or the old data can't be
+ * verified), the buffer is simply compressed in full.
+ */
+int
+write_wim_resource_from_buffer_reusing_chunks(const void *buf,
+					      size_t buf_size,
+					      bool is_metadata,
+					      const struct blob_descriptor *old_blob,
+					      struct filedes *out_fd,
+					      int out_ctype,
+					      u32 out_chunk_size,
+					      struct wim_reshdr *out_reshdr,
+					      u8 *hash_ret,
+					      int write_resource_flags,
+					      unsigned num_threads)
+{
+	const u8 *new_data = buf;
+	void *old_buf;
+	u8 old_hash[SHA1_HASH_SIZE];
+	const u64 num_chunks = DIV_ROUND_UP(buf_size, out_chunk_size);
+	u64 num_same_chunks = 0;
+	u64 num_changed_bytes;
+	struct blob_descriptor blob;
+	struct write_blobs_ctx ctx;
+	struct consume_raw_chunk_callback cb = {
+		.func	= write_raw_chunk,
+		.ctx	= &ctx,
+	};
+	int ret;
+
+	if (buf_size == 0 || read_blob_into_alloc_buf(old_blob, &old_buf))
+		goto write_in_full;
+
+	/* The old resource must really contain the old data, since that is
+	 * what the copied chunks will decompress to.  */
+	sha1_buffer(old_buf, old_blob->size, old_hash);
+	if (hashes_equal(old_hash, old_blob->hash)) {
+		for (u64 i = 0; i < num_chunks; i++)
+			num_same_chunks += chunk_unchanged(new_data, buf_size,
+							   old_buf,
+							   old_blob->size,
+							   i, out_chunk_size);
+	}
+	if (num_same_chunks == 0) {
+		FREE(old_buf);
+		goto write_in_full;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.out_fd = out_fd;
+	ctx.out_ctype = out_ctype;
+	ctx.out_chunk_size = out_chunk_size;
+	ctx.write_resource_flags = write_resource_flags;
+	if (out_fd->is_pipe)
+		ctx.write_resource_flags &= ~WRITE_RESOURCE_FLAG_WRITEBACK;
+	ctx.writeback_start = out_fd->offset;
+	ctx.writeback_end = out_fd->offset;
+	INIT_LIST_HEAD(&ctx.blobs_being_compressed);
+
+	num_changed_bytes = (num_chunks - num_same_chunks) * out_chunk_size;
+#ifdef ENABLE_MULTITHREADED_COMPRESSION
+	if (num_changed_bytes > max(2000000, out_chunk_size))
+		new_parallel_chunk_compressor(out_ctype, out_chunk_size,
+					      num_threads, 0, &ctx.compressor);
+#endif
+	if (ctx.compressor == NULL) {
+		ret = new_serial_chunk_compressor(out_ctype, out_chunk_size,
+						  &ctx.compressor);
+		if (ret)
+			goto out;
+	}
+
+	blob_set_is_located_in_attached_buffer(&blob, (void *)buf, buf_size);
+	sha1_buffer(buf, buf_size, blob.hash);
+	blob.unhashed = 0;
+	blob.is_metadata = is_metadata;
+	blob.will_be_in_output_wim = 1;
+	list_add(&blob.write_blobs_list, &ctx.blobs_being_compressed);
+
+	for (u64 i = 0; i < num_chunks; ) {
+		u64 offset = i * out_chunk_size;
+		u64 count = 0;
+
+		while (i + count < num_chunks &&
+		       chunk_unchanged(new_data, buf_size,
+				       old_buf, old_blob->size,
+				       i + count, out_chunk_size))
+			count++;
+
+		if (count) {
+			/* Copy a run of unchanged chunks, after writing any
+			 * chunks still being compressed.  */
+			ret = finish_remaining_chunks(&ctx);
+			if (ret)
+				goto out;
+			ret = read_raw_wim_chunks(old_blob->rdesc, i, count,
+						  &cb);
+			if (ret)
+				goto out;
+			i += count;
+		} else {
+			size_t size = min(out_chunk_size, buf_size - offset);
+
+			ret = prepare_chunk_buffer(&ctx);
+			if (ret)
+				goto out;
+			memcpy(ctx.cur_chunk_buf, &new_data[offset], size);
+			ctx.compressor->signal_chunk_filled(ctx.compressor,
+							    size);
+			ctx.cur_chunk_buf = NULL;
+			i++;
+		}
+	}
+	ret = finish_remaining_chunks(&ctx);
+	if (ret)
+		goto out;
+
+	wimlib_assert(list_empty(&ctx.blobs_being_compressed));
+
+	copy_reshdr(out_reshdr, &blob.out_reshdr);
+	if (hash_ret)
+		copy_hash(hash_ret, blob.hash);
+out:
+	FREE(ctx.chunk_csizes);
+	if (ctx.compressor)
+		ctx.compressor->destroy(ctx.compressor);
+	FREE(old_buf);
+	return ret;
+
+write_in_full:
+	return write_wim_resource_from_buffer(buf, buf_size, is_metadata,
+					      out_fd, out_ctype, out_chunk_size,
+					      out_reshdr, hash_ret,
+					      write_resource_flags,
+					      num_threads);
+}
+
 struct blob_size_table {
 	struct hlist_head *array;
 	size_t num_entries;
@@ -1936,6 +2541,147 @@ insert_other_if_hard_filtered(struct blob_descriptor *blob, void *_ctx)
 	return 0;
 }
 
+/* Same-size blobs at least this large are compared by digests of their first
+ * and last SAMPLE_SIZE bytes before any of them is checksummed in full.  */
+#define SAMPLE_SIZE		4096
+#define MIN_SAMPLED_BLOB_SIZE	(8 * SAMPLE_SIZE)
+
+struct sampled_blob {
+	struct blob_descriptor *blob;
+	u8 digest[SHA1_HASH_SIZE];
+};
+
+static int
+sample_hasher_cb(const void *chunk, size_t size, void *_ctx)
+{
+	sha1_update(_ctx, chunk, size);
+	return 0;
+}
+
+/* Can the data of @blob be sampled cheaply, without reading all of it?  */
+static bool
+can_sample_blob(const struct blob_descriptor *blob)
+{
+	if (!blob->unhashed || blob->size < MIN_SAMPLED_BLOB_SIZE)
+		return false;
+
+	switch (blob->blob_location) {
+	case BLOB_IN_FILE_ON_DISK:
+	case BLOB_IN_ATTACHED_BUFFER:
+#ifndef __WIN32__
+	case BLOB_IN_UNIX_FILE:
+#endif
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int
+sample_blob(struct sampled_blob *sample)
+{
+	const struct blob_descriptor *blob = sample->blob;
+	SHA_CTX ctx;
+	const struct consume_chunk_callback cb = {
+		.func = sample_hasher_cb,
+		.ctx = &ctx,
+	};
+	int ret;
+
+	sha1_init(&ctx);
+	ret = read_blob_range(blob, 0, SAMPLE_SIZE, &cb);
+	if (ret)
+		return ret;
+	ret = read_blob_range(blob, blob->size - SAMPLE_SIZE, SAMPLE_SIZE, &cb);
+	if (ret)
+		return ret;
+	sha1_final(sample->digest, &ctx);
+	return 0;
+}
+
+static int
+cmp_sampled_blobs_by_size(const void *p1, const void *p2)
+{
+	const struct sampled_blob *s1 = p1, *s2 = p2;
+
+	return cmp_u64(s1->blob->size, s2->blob->size);
+}
+
+static int
+cmp_sampled_blobs_by_digest(const void *p1, const void *p2)
+{
+	const struct sampled_blob *s1 = p1, *s2 = p2;
+
+	return hashes_cmp(s1->digest, s2->digest);
+}
+
+/*
+ * An unhashed blob whose size is not unique must normally be checksummed before
+ * it is written, to find out whether it is a duplicate.  That means reading it
+ * twice.  To avoid this for blobs that merely happen to have the same size,
+ * such as many files from a fixed-size build output, compare the digests of
+ * samples of the data of each group of same-size blobs first.  A blob whose
+ * sample digest differs from those of all the other blobs of its size can't be
+ * a duplicate, so its size is treated as unique.
+ *
+ * This is only done for groups in which every blob is unhashed and can be
+ * sampled cheaply; a hashed blob might be in a WIM resource.
+ */
+static int
+prefilter_same_size_blobs(struct blob_size_table *tab)
+{
+	struct sampled_blob *samples;
+	struct blob_descriptor *blob;
+	size_t num_samples = 0;
+	size_t i, j, k;
+	int ret;
+
+	if (tab->num_entries < 2)
+		return 0;
+
+	samples = MALLOC(tab->num_entries * sizeof(samples[0]));
+	if (!samples)
+		return WIMLIB_ERR_NOMEM;
+
+	for (i = 0; i < tab->capacity; i++)
+		hlist_for_each_entry(blob, &tab->array[i], hash_list_2)
+			if (!blob->unique_size)
+				samples[num_samples++].blob = blob;
+
+	qsort(samples, num_samples, sizeof(samples[0]),
+	      cmp_sampled_blobs_by_size);
+
+	for (i = 0; i < num_samples; i = j) {
+		bool all_samplable = true;
+
+		for (j = i; j < num_samples &&
+		     samples[j].blob->size == samples[i].blob->size; j++)
+			if (!can_sample_blob(samples[j].blob))
+				all_samplable = false;
+		if (!all_samplable)
+			continue;
+
+		for (k = i; k < j; k++) {
+			ret = sample_blob(&samples[k]);
+			if (ret)
+				goto out;
+		}
+		qsort(&samples[i], j - i, sizeof(samples[0]),
+		      cmp_sampled_blobs_by_digest);
+		for (k = i; k < j; k++) {
+			if ((k == i || !hashes_equal(samples[k].digest,
+						     samples[k - 1].digest)) &&
+			    (k == j - 1 || !hashes_equal(samples[k].digest,
+							 samples[k + 1].digest)))
+				samples[k].blob->unique_size = 1;
+		}
+	}
+	ret = 0;
+out:
+	FREE(samples);
+	return ret;
+}
+
 static int
 determine_blob_size_uniquity(struct list_head *blob_list,
 			     struct blob_table *lt,
@@ -1960,8 +2706,10 @@ determine_blob_size_uniquity(struct list_head *blob_list,
 	list_for_each_entry(blob, blob_list, write_blobs_list)
 		blob_size_table_insert(blob, &tab);
 
+	ret = prefilter_same_size_blobs(&tab);
+
 	destroy_blob_size_table(&tab);
-	return 0;
+	return ret;
 }
 
 static void
@@ -2049,7 +2797,8 @@ filter_blob_list_for_write(struct list_head *blob_list,
  * Still furthermore, @unique_size will be set to 1 on all blobs in
  * @blob_list_ret that have unique size among all blobs in @blob_list_ret and
  * among all blobs in the blob table of @wim that are ineligible for being
- * written due to filtering.
+ * written due to filtering, and on unhashed blobs whose sampled data is unique
+ * among the blobs of the same size (see prefilter_same_size_blobs()).
  *
  * Returns 0 on success; nonzero on read error, memory allocation error, or
  * otherwise.
@@ -2136,8 +2885,11 @@ write_file_data(WIMStruct *wim, int image, int write_flags,
 				     filter_ctx);
 }
 
+/* Write the metadata resources of the specified image(s).  Large metadata
+ * resources are compressed with up to @num_threads threads, like file data.  */
 static int
-write_metadata_resources(WIMStruct *wim, int image, int write_flags)
+write_metadata_resources(WIMStruct *wim, int image, int write_flags,
+			 unsigned num_threads)
 {
 	int ret;
 	int start_image;
@@ -2174,7 +2926,8 @@ write_metadata_resources(WIMStruct *wim, int image, int write_flags)
 			 * newly added, so we have to build and write a new
 			 * metadata resource.  */
 			ret = write_metadata_resource(wim, i,
-						      write_resource_flags);
+						      write_resource_flags,
+						      num_threads);
 		} else if (is_image_unchanged_from_wim(imd, wim) &&
 			   (write_flags & (WIMLIB_WRITE_FLAG_UNSAFE_COMPACT |
 					   WIMLIB_WRITE_FLAG_APPEND)))
@@ -2195,7 +2948,8 @@ write_metadata_resources(WIMStruct *wim, int image, int write_flags)
 						 &wim->out_fd,
 						 wim->out_compression_type,
 						 wim->out_chunk_size,
-						 write_resource_flags);
+						 write_resource_flags,
+						 num_threads);
 		}
 		if (ret)
 			return ret;
@@ -2415,6 +3169,22 @@ finish_write(WIMStruct *wim, int image, int write_flags,
 		zero_reshdr(&wim->out_hdr.integrity_table_reshdr);
 	}
 
+	/* When syncing, make sure that everything the final header refers to is
+	 * on disk before the header is written.  Otherwise, after a crash the
+	 * header could point to a blob table or XML data that never made it to
+	 * disk, which for an in-place update would ruin the existing WIM file.
+	 */
+	if ((write_flags & (WIMLIB_WRITE_FLAG_FSYNC |
+			    WIMLIB_WRITE_FLAG_SYNC_BEFORE_HEADER)) &&
+	    !(write_flags & WIMLIB_WRITE_FLAG_PIPABLE))
+	{
+		if (filedes_sync_data(&wim->out_fd)) {
+			ERROR_WITH_ERRNO("Error syncing data to WIM file");
+			ret = WIMLIB_ERR_WRITE;
+			goto out;
+		}
+	}
+
 	/* Now that all information in the WIM header has been determined, the
 	 * preliminary header written earlier can be overwritten, the header of
 	 * the existing WIM file can be overwritten, or the final header can be
@@ -2611,7 +3381,7 @@ write_pipable_wim(WIMStruct *wim, int image, int write_flags,
 
 	/* Write metadata resources for the image(s) being included in the
 	 * output WIM.  */
-	ret = write_metadata_resources(wim, image, write_flags);
+	ret = write_metadata_resources(wim, image, write_flags, num_threads);
 	if (ret)
 		return ret;
 
@@ -2849,7 +3619,7 @@ write_wim_part(WIMStruct *wim,
 		if (ret)
 			goto out_cleanup;
 
-		ret = write_metadata_resources(wim, image, write_flags);
+		ret = write_metadata_resources(wim, image, write_flags, num_threads);
 		if (ret)
 			goto out_cleanup;
 	} else {
@@ -3038,6 +3808,10 @@ free_blob_if_invalidated(struct blob_descriptor *blob, void *_wim)
  * explicitly requested by the library user with the flag
  * WIMLIB_WRITE_FLAG_UNSAFE_COMPACT.  (Another disadvantage is that a compaction
  * can be much slower than an append.)
+ *
+ * With WIMLIB_WRITE_FLAG_COMPACT, a normal append is done first, and then the
+ * file is compacted by compact_wim_file(), which keeps a journal so that the
+ * compaction can be finished if it is interrupted.
  */
 static int
 overwrite_wim_inplace(WIMStruct *wim, int write_flags, unsigned num_threads)
@@ -3047,6 +3821,7 @@ overwrite_wim_inplace(WIMStruct *wim, int write_flags, unsigned num_threads)
 	struct list_head blob_list;
 	struct list_head blob_table_list;
 	struct filter_context filter_ctx;
+	int compact_flags;
 
 	/* Include an integrity table by default if no preference was given and
 	 * the WIM already had an integrity table.  */
@@ -3055,6 +3830,12 @@ overwrite_wim_inplace(WIMStruct *wim, int write_flags, unsigned num_threads)
 		if (wim_has_integrity_table(wim))
 			write_flags |= WIMLIB_WRITE_FLAG_CHECK_INTEGRITY;
 
+	/* For a safe compaction, the integrity table is calculated after the
+	 * compaction rather than for the intermediate appended file.  */
+	compact_flags = write_flags;
+	if (write_flags & WIMLIB_WRITE_FLAG_COMPACT)
+		write_flags &= ~WIMLIB_WRITE_FLAG_CHECK_INTEGRITY;
+
 	/* Start preparing the updated file header.  */
 	memcpy(&wim->out_hdr, &wim->hdr, sizeof(wim->out_hdr));
 
@@ -3105,9 +3886,12 @@ overwrite_wim_inplace(WIMStruct *wim, int write_flags, unsigned num_threads)
 	} else {
 		u64 old_blob_table_end, old_xml_begin, old_xml_end;
 
-		/* Set additional flags for append.  */
-		write_flags |= WIMLIB_WRITE_FLAG_APPEND |
-			       WIMLIB_WRITE_FLAG_STREAMS_OK;
+		/* Set additional flags for append.  For a safe compaction, the
+		 * blob table must not list blobs that are no longer referenced,
+		 * since the compaction keeps exactly the listed resources.  */
+		write_flags |= WIMLIB_WRITE_FLAG_APPEND;
+		if (!(write_flags & WIMLIB_WRITE_FLAG_COMPACT))
+			write_flags |= WIMLIB_WRITE_FLAG_STREAMS_OK;
 
 		/* Make sure there is no data after the XML data, except
 		 * possibily an integrity table.  If this were the case, then
@@ -3204,7 +3988,8 @@ overwrite_wim_inplace(WIMStruct *wim, int write_flags, unsigned num_threads)
 	if (ret)
 		goto out_truncate;
 
-	ret = write_metadata_resources(wim, WIMLIB_ALL_IMAGES, write_flags);
+	ret = write_metadata_resources(wim, WIMLIB_ALL_IMAGES, write_flags,
+				       num_threads);
 	if (ret)
 		goto out_truncate;
 
@@ -3213,8 +3998,14 @@ overwrite_wim_inplace(WIMStruct *wim, int write_flags, unsigned num_threads)
 	if (ret)
 		goto out_truncate;
 
+	/* The WIM file is now valid and up to date.  For a safe compaction,
+	 * shift its contents down to remove the holes, while still holding
+	 * the lock.  */
+	if (write_flags & WIMLIB_WRITE_FLAG_COMPACT)
+		ret = compact_wim_file(wim, compact_flags);
+
 	unlock_wim_for_append(wim);
-	return 0;
+	return ret;
 
 out_truncate:
 	if (!(write_flags & (WIMLIB_WRITE_FLAG_NO_NEW_BLOBS |
@@ -3231,7 +4022,11 @@ out_unlock_wim:
 out_close_wim:
 	(void)close_wim_writable(wim, write_flags);
 out:
-	wim->being_compacted = 0;
+	if (wim->being_compacted) {
+		/* Resources may have moved.  */
+		wim_new_data_serial(wim);
+		wim->being_compacted = 0;
+	}
 	return ret;
 }
 
@@ -3263,6 +4058,7 @@ overwrite_wim_via_tmpfile(WIMStruct *wim, int write_flags, unsigned num_threads)
 		filedes_close(&wim->in_fd);
 		filedes_invalidate(&wim->in_fd);
 	}
+	wim_new_data_serial(wim);
 
 	/* Rename the new WIM file to the original WIM file.  Note: on Windows
 	 * this actually calls win32_rename_replacement(), not _wrename(), so
@@ -3344,6 +4140,12 @@ wimlib_overwrite(WIMStruct *wim, int write_flags, unsigned num_threads)
 		write_flags |= WIMLIB_WRITE_FLAG_NO_SOLID_SORT;
 	}
 
+	if (write_flags & WIMLIB_WRITE_FLAG_COMPACT) {
+		if (write_flags & WIMLIB_WRITE_FLAG_UNSAFE_COMPACT)
+			return WIMLIB_ERR_INVALID_PARAM;
+		write_flags |= WIMLIB_WRITE_FLAG_SOFT_DELETE;
+	}
+
 	orig_hdr_flags = wim->hdr.flags;
 	if (write_flags & WIMLIB_WRITE_FLAG_IGNORE_READONLY_FLAG)
 		wim->hdr.flags &= ~WIM_HDR_FLAG_READONLY;
@@ -3354,7 +4156,9 @@ wimlib_overwrite(WIMStruct *wim, int write_flags, unsigned num_threads)
 
 	if (can_overwrite_wim_inplace(wim, write_flags)) {
 		ret = overwrite_wim_inplace(wim, write_flags, num_threads);
-		if (ret != WIMLIB_ERR_RESOURCE_ORDER)
+		if (ret != WIMLIB_ERR_RESOURCE_ORDER &&
+		    !(ret == WIMLIB_ERR_COMPACTION_NOT_POSSIBLE &&
+		      (write_flags & WIMLIB_WRITE_FLAG_COMPACT)))
 			return ret;
 		WARNING("Falling back to re-building entire WIM");
 	}
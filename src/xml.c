@@ -1295,7 +1295,8 @@ write_wim_xml_data(WIMStruct *wim, int image, u64 total_bytes,
 					     0,
 					     out_reshdr,
 					     NULL,
-					     write_resource_flags);
+					     write_resource_flags,
+					     1);
 out_free_buffer:
 	xmlBufferFree(buffer);
 out_restore_document:
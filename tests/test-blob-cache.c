@@ -0,0 +1,305 @@
+/*
+ * test-blob-cache.c - Test the accounting of the blob data cache
+ *
+ * This program captures a directory tree of generated files into WIM files,
+ * both with non-solid and with solid resources, then extracts the image
+ * several times with different budgets for the blob cache.  After each
+ * extraction, it checks that the extracted data is correct and that the
+ * statistics returned by wimlib_get_blob_cache_stats() account for exactly the
+ * hits, misses, insertions, and evictions that the extraction must have caused.
+ */
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wimlib.h"
+
+#define TMPDIR		"tmp-blob-cache"
+#define SRCDIR		TMPDIR "/src"
+#define OUTDIR		TMPDIR "/out"
+#define WIMFILE		TMPDIR "/test.wim"
+
+/* The image contains NUM_FILES small files of FILE_SIZE bytes each, which are
+ * cached when the budget allows, and one large file of LARGE_FILE_SIZE bytes,
+ * which is always too large to be cached with the budgets used here.  */
+#define NUM_FILES	16
+#define FILE_SIZE	32768
+#define LARGE_FILE_SIZE	(8 * FILE_SIZE)
+
+static void
+assertion_failed(int line, const char *format, ...)
+{
+	va_list va;
+
+	va_start(va, format);
+	fprintf(stderr, "ASSERTION FAILED at line %d: ", line);
+	vfprintf(stderr, format, va);
+	fputc('\n', stderr);
+	va_end(va);
+
+	exit(1);
+}
+
+#define ASSERT(expr, msg, ...)						\
+({									\
+	if (__builtin_expect(!(expr), 0))				\
+		assertion_failed(__LINE__, (msg), ##__VA_ARGS__);	\
+})
+
+#define CHECK_RET(ret)							\
+({									\
+	int r = (ret);							\
+	ASSERT(!r, "%s", wimlib_get_error_string(r));			\
+})
+
+#define CHECK_STAT(name, expected)					\
+({									\
+	uint64_t v = (name);						\
+	uint64_t e = (expected);					\
+	ASSERT(v == e, "%s is %"PRIu64", but expected %"PRIu64,		\
+	       #name, v, e);						\
+})
+
+/* Generate the contents of file @index: compressible text which differs
+ * between files, so that each file is a different blob.  */
+static void
+generate_data(uint8_t *buf, size_t size, int index)
+{
+	size_t i = 0;
+	int line = 0;
+
+	while (i < size) {
+		char text[64];
+		int len = sprintf(text, "This is line %d of file %d.\n",
+				  line++, index);
+
+		for (int j = 0; j < len && i < size; j++)
+			buf[i++] = text[j];
+	}
+}
+
+static void
+write_file(const char *path, const void *data, size_t size)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	ASSERT(fd >= 0, "%s: open error: %m", path);
+	ASSERT(write(fd, data, size) == (ssize_t)size, "%s: write error: %m",
+	       path);
+	close(fd);
+}
+
+static uint8_t *
+read_file(const char *path, size_t *size_ret)
+{
+	struct stat stbuf;
+	uint8_t *buf;
+	int fd = open(path, O_RDONLY);
+
+	ASSERT(fd >= 0, "%s: open error: %m", path);
+	ASSERT(!fstat(fd, &stbuf), "%s: stat error: %m", path);
+	buf = malloc(stbuf.st_size + 1);
+	ASSERT(buf != NULL, "out of memory");
+	ASSERT(read(fd, buf, stbuf.st_size) == stbuf.st_size,
+	       "%s: read error: %m", path);
+	close(fd);
+	*size_ret = stbuf.st_size;
+	return buf;
+}
+
+static size_t
+file_size(int index)
+{
+	return index == NUM_FILES ? LARGE_FILE_SIZE : FILE_SIZE;
+}
+
+static void
+create_source_tree(void)
+{
+	char path[256];
+
+	ASSERT(!mkdir(TMPDIR, 0755), "%s: mkdir error: %m", TMPDIR);
+	ASSERT(!mkdir(SRCDIR, 0755), "%s: mkdir error: %m", SRCDIR);
+	for (int i = 0; i <= NUM_FILES; i++) {
+		uint8_t *data = malloc(file_size(i));
+
+		ASSERT(data != NULL, "out of memory");
+		generate_data(data, file_size(i), i);
+		sprintf(path, SRCDIR "/file%d", i);
+		write_file(path, data, file_size(i));
+		free(data);
+	}
+}
+
+static void
+delete_tree(const char *path)
+{
+	char cmd[256];
+
+	sprintf(cmd, "rm -rf '%s'", path);
+	ASSERT(system(cmd) == 0, "failed to delete \"%s\"", path);
+}
+
+/* Extract the image from a newly opened WIMStruct, check the extracted data,
+ * and return the statistics of the blob cache from before and after the
+ * extraction.  Opening the WIM file again each time checks that the cache is
+ * shared by all WIMStructs.  */
+static void
+extract_and_check(struct wimlib_blob_cache_stats *before,
+		  struct wimlib_blob_cache_stats *after)
+{
+	WIMStruct *wim;
+	char path[256];
+
+	CHECK_RET(wimlib_open_wim(WIMFILE, 0, &wim));
+	wimlib_get_blob_cache_stats(before);
+	CHECK_RET(wimlib_extract_image(wim, 1, OUTDIR, 0));
+	wimlib_get_blob_cache_stats(after);
+	wimlib_free(wim);
+
+	for (int i = 0; i <= NUM_FILES; i++) {
+		uint8_t *expected = malloc(file_size(i));
+		uint8_t *data;
+		size_t size;
+
+		ASSERT(expected != NULL, "out of memory");
+		generate_data(expected, file_size(i), i);
+		sprintf(path, OUTDIR "/file%d", i);
+		data = read_file(path, &size);
+		ASSERT(size == file_size(i) && !memcmp(data, expected, size),
+		       "%s: extracted data is wrong", path);
+		free(data);
+		free(expected);
+	}
+	delete_tree(OUTDIR);
+
+	/* Whatever happened, the counters must be consistent.  */
+	CHECK_STAT(after->num_cached, before->num_cached +
+		   (after->num_inserted - before->num_inserted) -
+		   (after->num_evicted - before->num_evicted));
+	CHECK_STAT(after->cached_bytes, after->num_cached * FILE_SIZE);
+	ASSERT(after->cached_bytes <= after->max_bytes,
+	       "cache holds %"PRIu64" bytes, over its budget of %"PRIu64,
+	       after->cached_bytes, after->max_bytes);
+	CHECK_STAT(after->hit_bytes - before->hit_bytes,
+		   (after->num_hits - before->num_hits) * FILE_SIZE);
+}
+
+static void
+run_test(const char *name, int ctype, int write_flags)
+{
+	WIMStruct *wim;
+	struct wimlib_blob_cache_stats before, after;
+
+	printf("Testing blob cache with %s\n", name);
+
+	CHECK_RET(wimlib_create_new_wim(ctype, &wim));
+	if (write_flags & WIMLIB_WRITE_FLAG_SOLID)
+		CHECK_RET(wimlib_set_output_pack_compression_type(wim, ctype));
+	CHECK_RET(wimlib_add_image(wim, SRCDIR, NULL, NULL, 0));
+	CHECK_RET(wimlib_write(wim, WIMFILE, WIMLIB_ALL_IMAGES, write_flags, 0));
+	wimlib_free(wim);
+
+	/* With the cache disabled, nothing is counted.  */
+	wimlib_set_blob_cache_size(0);
+	extract_and_check(&before, &after);
+	CHECK_STAT(after.max_bytes, 0);
+	CHECK_STAT(after.num_cached, 0);
+	CHECK_STAT(after.num_hits, before.num_hits);
+	CHECK_STAT(after.num_misses, before.num_misses);
+	CHECK_STAT(after.num_inserted, before.num_inserted);
+
+	/* With room for all the small files, the first extraction misses and
+	 * caches each of them, and the second one finds all of them in the
+	 * cache.  The large file is never cached, nor counted as a miss.  */
+	wimlib_set_blob_cache_size(2 * NUM_FILES * FILE_SIZE);
+	extract_and_check(&before, &after);
+	CHECK_STAT(after.max_bytes, 2 * NUM_FILES * FILE_SIZE);
+	CHECK_STAT(after.num_hits - before.num_hits, 0);
+	CHECK_STAT(after.num_misses - before.num_misses, NUM_FILES);
+	CHECK_STAT(after.num_inserted - before.num_inserted, NUM_FILES);
+	CHECK_STAT(after.num_evicted - before.num_evicted, 0);
+	CHECK_STAT(after.num_cached, NUM_FILES);
+
+	extract_and_check(&before, &after);
+	CHECK_STAT(after.num_hits - before.num_hits, NUM_FILES);
+	CHECK_STAT(after.hit_bytes - before.hit_bytes, NUM_FILES * FILE_SIZE);
+	CHECK_STAT(after.num_misses - before.num_misses, 0);
+	CHECK_STAT(after.num_inserted - before.num_inserted, 0);
+	CHECK_STAT(after.num_cached, NUM_FILES);
+
+	/* Shrinking the budget evicts blobs right away.  */
+	before = after;
+	wimlib_set_blob_cache_size(NUM_FILES / 2 * FILE_SIZE);
+	wimlib_get_blob_cache_stats(&after);
+	CHECK_STAT(after.num_evicted - before.num_evicted, NUM_FILES / 2);
+	CHECK_STAT(after.num_cached, NUM_FILES / 2);
+	CHECK_STAT(after.cached_bytes, NUM_FILES / 2 * FILE_SIZE);
+
+	/* With room for only half of the small files, every blob read is
+	 * either a hit or a miss, and every miss inserts a blob which evicts
+	 * another one, since the cache stays full.  */
+	extract_and_check(&before, &after);
+	CHECK_STAT((after.num_hits - before.num_hits) +
+		   (after.num_misses - before.num_misses), NUM_FILES);
+	CHECK_STAT(after.num_inserted - before.num_inserted,
+		   after.num_misses - before.num_misses);
+	CHECK_STAT(after.num_evicted - before.num_evicted,
+		   after.num_inserted - before.num_inserted);
+	CHECK_STAT(after.num_cached, NUM_FILES / 2);
+
+	/* Disabling the cache evicts everything.  */
+	before = after;
+	wimlib_set_blob_cache_size(0);
+	wimlib_get_blob_cache_stats(&after);
+	CHECK_STAT(after.num_evicted - before.num_evicted, NUM_FILES / 2);
+	CHECK_STAT(after.num_cached, 0);
+	CHECK_STAT(after.cached_bytes, 0);
+
+	ASSERT(!unlink(WIMFILE), "%s: unlink error: %m", WIMFILE);
+}
+
+int
+main(void)
+{
+	delete_tree(TMPDIR);
+	CHECK_RET(wimlib_global_init(0));
+	wimlib_set_print_errors(true);
+
+	create_source_tree();
+
+	run_test("LZX resources", WIMLIB_COMPRESSION_TYPE_LZX, 0);
+	run_test("LZMS solid resource", WIMLIB_COMPRESSION_TYPE_LZMS,
+		 WIMLIB_WRITE_FLAG_SOLID);
+
+	wimlib_global_cleanup();
+	delete_tree(TMPDIR);
+	printf("All tests passed.\n");
+	return 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * test-extract-targets.c - Test extracting an image to several directories
+ *
+ * This program captures a small directory tree containing hard links, files
+ * with the same contents, and an absolute symbolic link into the tree, then
+ * extracts the image with wimlib_extract_image_to_targets() to a few
+ * directories and to more directories than can be extracted in one pass.  It
+ * checks that each directory is a correct copy of the source tree, that hard
+ * links are kept within each directory but not across directories, and that
+ * the fixed-up symbolic link in each directory points into that directory.
+ */
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wimlib.h"
+
+#define TMPDIR		"tmp-extract-targets"
+#define SRCDIR		TMPDIR "/src"
+#define WIMFILE		TMPDIR "/test.wim"
+
+/* Number of directories for the multi-pass test.  This must be more than
+ * MAX_OPEN_FILES (512) in the library, which is both the number of directories
+ * extracted in one pass and the number of files a blob can be written to at
+ * once before it is extracted through a temporary file instead.  */
+#define NUM_MANY_TARGETS	600
+
+static void
+assertion_failed(int line, const char *format, ...)
+{
+	va_list va;
+
+	va_start(va, format);
+	fprintf(stderr, "ASSERTION FAILED at line %d: ", line);
+	vfprintf(stderr, format, va);
+	fputc('\n', stderr);
+	va_end(va);
+
+	exit(1);
+}
+
+#define ASSERT(expr, msg, ...)						\
+({									\
+	if (__builtin_expect(!(expr), 0))				\
+		assertion_failed(__LINE__, (msg), ##__VA_ARGS__);	\
+})
+
+#define CHECK_RET(ret)							\
+({									\
+	int r = (ret);							\
+	ASSERT(!r, "%s", wimlib_get_error_string(r));			\
+})
+
+static void
+write_file(const char *path, const char *contents)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	size_t size = strlen(contents);
+
+	ASSERT(fd >= 0, "%s: open error: %m", path);
+	ASSERT(write(fd, contents, size) == (ssize_t)size,
+	       "%s: write error: %m", path);
+	close(fd);
+}
+
+static void
+delete_tree(const char *path)
+{
+	char cmd[256];
+
+	sprintf(cmd, "rm -rf '%s'", path);
+	ASSERT(system(cmd) == 0, "failed to delete \"%s\"", path);
+}
+
+/*
+ * Create the source tree:
+ *
+ *	file		unique contents
+ *	same1, same2	the same contents, so one blob is extracted to two files
+ *			in each directory
+ *	link1		hard link to subdir/link2
+ *	subdir/file	unique contents
+ *	subdir/abs	absolute symbolic link to subdir/file in the source tree
+ *	rel		relative symbolic link to file
+ */
+static void
+create_source_tree(void)
+{
+	char abspath[PATH_MAX];
+	char target[PATH_MAX + 32];
+
+	ASSERT(!mkdir(TMPDIR, 0755), "%s: mkdir error: %m", TMPDIR);
+	ASSERT(!mkdir(SRCDIR, 0755), "%s: mkdir error: %m", SRCDIR);
+	ASSERT(!mkdir(SRCDIR "/subdir", 0755), "mkdir error: %m");
+	write_file(SRCDIR "/file", "This is a file.\n");
+	write_file(SRCDIR "/same1", "This file has a twin.\n");
+	write_file(SRCDIR "/same2", "This file has a twin.\n");
+	write_file(SRCDIR "/link1", "This file has two names.\n");
+	ASSERT(!link(SRCDIR "/link1", SRCDIR "/subdir/link2"),
+	       "link error: %m");
+	write_file(SRCDIR "/subdir/file", "This is another file.\n");
+	ASSERT(realpath(SRCDIR, abspath) != NULL, "%s: realpath error: %m",
+	       SRCDIR);
+	sprintf(target, "%s/subdir/file", abspath);
+	ASSERT(!symlink(target, SRCDIR "/subdir/abs"), "symlink error: %m");
+	ASSERT(!symlink("file", SRCDIR "/rel"), "symlink error: %m");
+}
+
+static ino_t
+get_inode_number(const char *path)
+{
+	struct stat stbuf;
+
+	ASSERT(!lstat(path, &stbuf), "%s: lstat error: %m", path);
+	return stbuf.st_ino;
+}
+
+/* Check that the directory @target is a correct copy of the source tree and
+ * that its files are not hard links to those of the directory @other.  */
+static void
+check_target(const char *target, const char *other)
+{
+	char path[PATH_MAX + 32];
+	char path2[PATH_MAX + 32];
+	char abspath[PATH_MAX];
+	char link_target[PATH_MAX + 32];
+	char cmd[256];
+	ssize_t len;
+
+	/* diff follows the symbolic links, so this also checks that they
+	 * point to files with the right contents.  */
+	sprintf(cmd, "diff -r '%s' '%s'", SRCDIR, target);
+	ASSERT(system(cmd) == 0, "%s differs from %s", target, SRCDIR);
+
+	/* The hard link is kept within the directory.  */
+	sprintf(path, "%s/link1", target);
+	sprintf(path2, "%s/subdir/link2", target);
+	ASSERT(get_inode_number(path) == get_inode_number(path2),
+	       "%s and %s are not hard linked", path, path2);
+
+	/* ... but not across directories.  */
+	if (other) {
+		sprintf(path2, "%s/link1", other);
+		ASSERT(get_inode_number(path) != get_inode_number(path2),
+		       "%s and %s are hard linked", path, path2);
+	}
+
+	/* Files with the same contents are still separate files.  */
+	sprintf(path, "%s/same1", target);
+	sprintf(path2, "%s/same2", target);
+	ASSERT(get_inode_number(path) != get_inode_number(path2),
+	       "%s and %s are hard linked", path, path2);
+
+	/* The absolute symbolic link was fixed up to point into this
+	 * directory, not the source tree or another directory.  */
+	ASSERT(realpath(target, abspath) != NULL, "%s: realpath error: %m",
+	       target);
+	sprintf(path, "%s/subdir/abs", target);
+	len = readlink(path, link_target, sizeof(link_target) - 1);
+	ASSERT(len >= 0, "%s: readlink error: %m", path);
+	link_target[len] = '\0';
+	sprintf(path2, "%s/subdir/file", abspath);
+	ASSERT(!strcmp(link_target, path2),
+	       "%s points to \"%s\", but expected \"%s\"",
+	       path, link_target, path2);
+
+	sprintf(path, "%s/rel", target);
+	len = readlink(path, link_target, sizeof(link_target) - 1);
+	ASSERT(len >= 0, "%s: readlink error: %m", path);
+	link_target[len] = '\0';
+	ASSERT(!strcmp(link_target, "file"),
+	       "%s points to \"%s\", but expected \"file\"",
+	       path, link_target);
+}
+
+static void
+run_test(WIMStruct *wim, size_t num_targets)
+{
+	char **targets;
+
+	printf("Testing extraction to %zu directories\n", num_targets);
+
+	targets = malloc(num_targets * sizeof(targets[0]));
+	ASSERT(targets != NULL, "out of memory");
+	for (size_t i = 0; i < num_targets; i++) {
+		targets[i] = malloc(64);
+		ASSERT(targets[i] != NULL, "out of memory");
+		sprintf(targets[i], TMPDIR "/out%zu", i);
+	}
+
+	CHECK_RET(wimlib_extract_image_to_targets(wim, 1,
+						  (const char * const *)targets,
+						  num_targets,
+						  WIMLIB_EXTRACT_FLAG_RPFIX));
+
+	for (size_t i = 0; i < num_targets; i++)
+		check_target(targets[i], i ? targets[i - 1] : NULL);
+
+	for (size_t i = 0; i < num_targets; i++) {
+		delete_tree(targets[i]);
+		free(targets[i]);
+	}
+	free(targets);
+}
+
+int
+main(void)
+{
+	WIMStruct *wim;
+
+	delete_tree(TMPDIR);
+	CHECK_RET(wimlib_global_init(0));
+	wimlib_set_print_errors(true);
+
+	create_source_tree();
+
+	CHECK_RET(wimlib_create_new_wim(WIMLIB_COMPRESSION_TYPE_LZX, &wim));
+	CHECK_RET(wimlib_add_image(wim, SRCDIR, NULL, NULL,
+				   WIMLIB_ADD_FLAG_RPFIX));
+	CHECK_RET(wimlib_write(wim, WIMFILE, WIMLIB_ALL_IMAGES, 0, 0));
+	wimlib_free(wim);
+
+	CHECK_RET(wimlib_open_wim(WIMFILE, 0, &wim));
+	run_test(wim, 1);
+	run_test(wim, 3);
+	run_test(wim, NUM_MANY_TARGETS);
+	wimlib_free(wim);
+
+	wimlib_global_cleanup();
+	delete_tree(TMPDIR);
+	printf("All tests passed.\n");
+	return 0;
+}
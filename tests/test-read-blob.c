@@ -0,0 +1,398 @@
+/*
+ * test-read-blob.c - Test the in-memory blob and file read API
+ *
+ * This program captures a directory tree of generated files into WIM files
+ * with several compression settings, including a solid resource, then extracts
+ * each WIM and checks that wimlib_read_blob(), wimlib_read_blob_into_buf(), and
+ * wimlib_read_file_into_buf() return exactly the extracted data.  Range reads
+ * are done at and around chunk boundaries as well as at pseudorandom offsets,
+ * both from a single thread and from several threads at once on a WIM opened
+ * with WIMLIB_OPEN_FLAG_CONCURRENT_READS.
+ */
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wimlib.h"
+
+#define TMPDIR		"tmp-read-blob"
+#define SRCDIR		TMPDIR "/src"
+#define OUTDIR		TMPDIR "/out"
+#define WIMFILE		TMPDIR "/test.wim"
+
+#define NUM_THREADS	4
+
+static void
+assertion_failed(int line, const char *format, ...)
+{
+	va_list va;
+
+	va_start(va, format);
+	fprintf(stderr, "ASSERTION FAILED at line %d: ", line);
+	vfprintf(stderr, format, va);
+	fputc('\n', stderr);
+	va_end(va);
+
+	exit(1);
+}
+
+#define ASSERT(expr, msg, ...)						\
+({									\
+	if (__builtin_expect(!(expr), 0))				\
+		assertion_failed(__LINE__, (msg), ##__VA_ARGS__);	\
+})
+
+#define CHECK_RET(ret)							\
+({									\
+	int r = (ret);							\
+	ASSERT(!r, "%s", wimlib_get_error_string(r));			\
+})
+
+static uint32_t
+rand32(uint64_t *state)
+{
+	/* A simple linear congruential generator  */
+	*state = (*state * 25214903917 + 11) & (((uint64_t)1 << 48) - 1);
+	return *state >> 16;
+}
+
+/* Sizes of the generated files.  They are chosen to be empty, to be smaller
+ * than, equal to, and just larger than a chunk, and to span many chunks.  */
+static const size_t file_sizes[] = {
+	0, 1, 4095, 4096, 4097, 32767, 32768, 32769, 100000, 300001, 1000000,
+};
+
+#define NUM_FILES	(sizeof(file_sizes) / sizeof(file_sizes[0]))
+
+/* Fill @buf with a mix of pseudorandom bytes and repetitive text, so that some
+ * chunks compress and others are stored uncompressed.  */
+static void
+generate_data(uint8_t *buf, size_t size, uint64_t *state)
+{
+	static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+	size_t i = 0;
+
+	while (i < size) {
+		size_t run = 1 + rand32(state) % 20000;
+		bool random = rand32(state) % 3 == 0;
+
+		for (; run && i < size; run--, i++) {
+			if (random)
+				buf[i] = rand32(state);
+			else
+				buf[i] = text[i % (sizeof(text) - 1)];
+		}
+	}
+}
+
+static void
+write_file(const char *path, const void *data, size_t size)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	ASSERT(fd >= 0, "%s: open error: %m", path);
+	ASSERT(write(fd, data, size) == (ssize_t)size, "%s: write error: %m",
+	       path);
+	close(fd);
+}
+
+static uint8_t *
+read_file(const char *path, size_t *size_ret)
+{
+	struct stat stbuf;
+	uint8_t *buf;
+	int fd = open(path, O_RDONLY);
+
+	ASSERT(fd >= 0, "%s: open error: %m", path);
+	ASSERT(!fstat(fd, &stbuf), "%s: stat error: %m", path);
+	buf = malloc(stbuf.st_size + 1);
+	ASSERT(buf != NULL, "out of memory");
+	ASSERT(read(fd, buf, stbuf.st_size) == stbuf.st_size,
+	       "%s: read error: %m", path);
+	close(fd);
+	*size_ret = stbuf.st_size;
+	return buf;
+}
+
+static void
+create_source_tree(void)
+{
+	uint64_t state = 1;
+	char path[256];
+
+	ASSERT(!mkdir(TMPDIR, 0755), "%s: mkdir error: %m", TMPDIR);
+	ASSERT(!mkdir(SRCDIR, 0755), "%s: mkdir error: %m", SRCDIR);
+	for (size_t i = 0; i < NUM_FILES; i++) {
+		uint8_t *data = malloc(file_sizes[i] + 1);
+
+		ASSERT(data != NULL, "out of memory");
+		generate_data(data, file_sizes[i], &state);
+		sprintf(path, SRCDIR "/file%zu", i);
+		write_file(path, data, file_sizes[i]);
+		free(data);
+	}
+}
+
+/* A file in the image, with its extracted data  */
+struct test_file {
+	char *path;
+	uint8_t hash[20];
+	uint8_t *data;
+	size_t size;
+};
+
+static struct test_file files[NUM_FILES];
+static size_t num_files;
+
+static int
+add_test_file(const struct wimlib_dir_entry *dentry, void *_ignore)
+{
+	struct test_file *file;
+	char path[256];
+
+	if (dentry->attributes & WIMLIB_FILE_ATTRIBUTE_DIRECTORY)
+		return 0;
+	ASSERT(num_files < NUM_FILES, "too many files in image");
+	file = &files[num_files++];
+	file->path = strdup(dentry->full_path);
+	ASSERT(file->path != NULL, "out of memory");
+	memcpy(file->hash, dentry->streams[0].resource.sha1_hash, 20);
+	sprintf(path, OUTDIR "%s", dentry->full_path);
+	file->data = read_file(path, &file->size);
+	ASSERT(file->size == dentry->streams[0].resource.uncompressed_size,
+	       "%s: size mismatch", file->path);
+	return 0;
+}
+
+static void
+free_test_files(void)
+{
+	for (size_t i = 0; i < num_files; i++) {
+		free(files[i].path);
+		free(files[i].data);
+	}
+	num_files = 0;
+}
+
+struct range_buf {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static int
+append_to_range_buf(const void *data, size_t size, void *_buf)
+{
+	struct range_buf *buf = _buf;
+
+	ASSERT(size != 0, "callback passed no data");
+	ASSERT(buf->size + size <= buf->capacity, "callback passed too much data");
+	memcpy(&buf->data[buf->size], data, size);
+	buf->size += size;
+	return 0;
+}
+
+static void
+check_range(WIMStruct *wim, const struct test_file *file,
+	    uint64_t offset, uint64_t size)
+{
+	struct range_buf buf;
+
+	if (offset > file->size)
+		offset = file->size;
+	if (size > file->size - offset)
+		size = file->size - offset;
+
+	buf.data = malloc(size + 1);
+	ASSERT(buf.data != NULL, "out of memory");
+	buf.size = 0;
+	buf.capacity = size;
+	CHECK_RET(wimlib_read_blob(wim, file->hash, offset, size,
+				   append_to_range_buf, &buf));
+	ASSERT(buf.size == size && !memcmp(buf.data, &file->data[offset], size),
+	       "%s: range [%"PRIu64", +%"PRIu64") differs from extracted data",
+	       file->path, offset, size);
+	free(buf.data);
+}
+
+/* Check reads of @file's whole data, and of ranges near each boundary of
+ * @chunk_size bytes as well as at pseudorandom offsets.  */
+static void
+check_file(WIMStruct *wim, const struct test_file *file, uint32_t chunk_size,
+	   uint64_t *state)
+{
+	void *buf;
+	size_t bufsize;
+	struct range_buf dummy = { 0 };
+
+	CHECK_RET(wimlib_read_blob_into_buf(wim, file->hash, &buf, &bufsize));
+	ASSERT(bufsize == file->size &&
+	       (bufsize == 0 || !memcmp(buf, file->data, bufsize)),
+	       "%s: blob data differs from extracted data", file->path);
+	free(buf);
+
+	CHECK_RET(wimlib_read_file_into_buf(wim, 1, file->path, &buf, &bufsize));
+	ASSERT(bufsize == file->size &&
+	       (bufsize == 0 || !memcmp(buf, file->data, bufsize)),
+	       "%s: file data differs from extracted data", file->path);
+	free(buf);
+
+	ASSERT(wimlib_read_blob(wim, file->hash, file->size, 1,
+				append_to_range_buf, &dummy) ==
+			WIMLIB_ERR_INVALID_PARAM,
+	       "%s: read past end of blob was not rejected", file->path);
+
+	if (file->size == 0)
+		return;
+
+	check_range(wim, file, 0, file->size);
+	for (uint64_t b = chunk_size; b < file->size; b += chunk_size) {
+		check_range(wim, file, b - 1, 2);
+		check_range(wim, file, b - 100, chunk_size + 200);
+		check_range(wim, file, b, 1);
+	}
+	for (int i = 0; i < 20; i++) {
+		uint64_t offset = rand32(state) % file->size;
+		uint64_t size = 1 + rand32(state) % (3 * chunk_size);
+
+		check_range(wim, file, offset, size);
+	}
+}
+
+struct thread_params {
+	WIMStruct *wim;
+	uint32_t chunk_size;
+	uint64_t seed;
+};
+
+static void *
+reader_thread(void *_params)
+{
+	struct thread_params *params = _params;
+	uint64_t state = params->seed;
+
+	for (int pass = 0; pass < 3; pass++)
+		for (size_t i = 0; i < num_files; i++)
+			check_file(params->wim,
+				   &files[(i + params->seed) % num_files],
+				   params->chunk_size, &state);
+	return NULL;
+}
+
+static void
+delete_tree(const char *path)
+{
+	char cmd[256];
+
+	sprintf(cmd, "rm -rf '%s'", path);
+	ASSERT(system(cmd) == 0, "failed to delete \"%s\"", path);
+}
+
+static void
+run_test(const char *name, int ctype, uint32_t chunk_size, int write_flags)
+{
+	WIMStruct *wim;
+	pthread_t threads[NUM_THREADS];
+	struct thread_params params[NUM_THREADS];
+	uint64_t state = 1;
+
+	printf("Testing %s\n", name);
+
+	/* Capture the source tree.  */
+	CHECK_RET(wimlib_create_new_wim(ctype, &wim));
+	if (write_flags & WIMLIB_WRITE_FLAG_SOLID) {
+		CHECK_RET(wimlib_set_output_pack_compression_type(wim, ctype));
+		CHECK_RET(wimlib_set_output_pack_chunk_size(wim, chunk_size));
+	} else if (ctype != WIMLIB_COMPRESSION_TYPE_NONE) {
+		CHECK_RET(wimlib_set_output_chunk_size(wim, chunk_size));
+	}
+	CHECK_RET(wimlib_add_image(wim, SRCDIR, NULL, NULL, 0));
+	CHECK_RET(wimlib_write(wim, WIMFILE, WIMLIB_ALL_IMAGES, write_flags, 0));
+	wimlib_free(wim);
+
+	/* Extract it; the extracted data is what the reads are compared to.  */
+	CHECK_RET(wimlib_open_wim(WIMFILE, 0, &wim));
+	CHECK_RET(wimlib_extract_image(wim, 1, OUTDIR, 0));
+	CHECK_RET(wimlib_iterate_dir_tree(wim, 1, "/",
+					  WIMLIB_ITERATE_DIR_TREE_FLAG_RECURSIVE,
+					  add_test_file, NULL));
+	ASSERT(num_files == NUM_FILES, "wrong number of files in image");
+
+	/* Read from a single thread.  */
+	for (size_t i = 0; i < num_files; i++)
+		check_file(wim, &files[i], chunk_size, &state);
+	wimlib_free(wim);
+
+	/* Read from several threads at once.  */
+	CHECK_RET(wimlib_open_wim(WIMFILE, WIMLIB_OPEN_FLAG_CONCURRENT_READS,
+				  &wim));
+	for (int i = 0; i < NUM_THREADS; i++) {
+		params[i].wim = wim;
+		params[i].chunk_size = chunk_size;
+		params[i].seed = i + 1;
+		ASSERT(!pthread_create(&threads[i], NULL, reader_thread,
+				       &params[i]),
+		       "failed to create thread");
+	}
+	for (int i = 0; i < NUM_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	wimlib_free(wim);
+
+	free_test_files();
+	delete_tree(OUTDIR);
+	ASSERT(!unlink(WIMFILE), "%s: unlink error: %m", WIMFILE);
+}
+
+int
+main(void)
+{
+	delete_tree(TMPDIR);
+	CHECK_RET(wimlib_global_init(0));
+	wimlib_set_print_errors(true);
+
+	create_source_tree();
+
+	run_test("uncompressed resources", WIMLIB_COMPRESSION_TYPE_NONE,
+		 4096, 0);
+	run_test("XPRESS resources with 4 KiB chunks",
+		 WIMLIB_COMPRESSION_TYPE_XPRESS, 4096, 0);
+	run_test("LZX resources with 32 KiB chunks",
+		 WIMLIB_COMPRESSION_TYPE_LZX, 32768, 0);
+	run_test("LZMS solid resource with 32 KiB chunks",
+		 WIMLIB_COMPRESSION_TYPE_LZMS, 32768, WIMLIB_WRITE_FLAG_SOLID);
+	run_test("XPRESS solid resource with 4 KiB chunks",
+		 WIMLIB_COMPRESSION_TYPE_XPRESS, 4096, WIMLIB_WRITE_FLAG_SOLID);
+
+	wimlib_global_cleanup();
+	delete_tree(TMPDIR);
+	printf("All tests passed.\n");
+	return 0;
+}
@@ -56,6 +56,11 @@ wimdelete()
 	wimlib_imagex delete "$@" > /dev/null
 }
 
+wimdiff()
+{
+	wimlib_imagex diff "$@"
+}
+
 wimdir()
 {
 	wimlib_imagex dir "$@"